@@ -2,6 +2,8 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <fstream>
 #include <curl/curl.h>
 #include <sstream>
 #include <boost/property_tree/ptree.hpp>
@@ -11,21 +13,259 @@
 #include <ctime>
 #include <iomanip>
 #include <thread> // For std::this_thread::sleep_for
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <charconv>
+#include <initializer_list>
+#include <cctype>
+#include <cmath>
+#include <random>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <numeric>
+#include <cerrno>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <bitset>
+#include <shared_mutex>
+#include <csignal>
+#include <filesystem>
+#include <tuple>
+#include <coroutine> // C++20
+#include <span>
+#include <bit>
+#include <type_traits>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 namespace pt = boost::property_tree;
 
+// Process-wide allocation counter reported by the benchmarks. Counting means one shared atomic increment per
+// allocation on every thread, so only benchmark builds (-DCOUNT_ALLOCATIONS) replace the global allocation functions;
+// elsewhere the counter stays at 0.
+std::atomic<uint64_t> allocationCount{0};
+
+#ifdef COUNT_ALLOCATIONS
+constexpr bool kCountingAllocations = true;
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = std::malloc(size ? size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// The array forms and the nothrow new default to these, so replacing the plain and sized deletes pairs every free
+// with the malloc above. Kept out of line: inlined into a caller, gcc sees free() applied to the result of new and
+// warns about a mismatch that is not there.
+[[gnu::noinline]] void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void *memory, size_t) noexcept
+{
+    std::free(memory);
+}
+#else
+constexpr bool kCountingAllocations = false;
+#endif
+
+// Peak resident set size of this process in KiB (0 where unsupported)
+long peak_rss_kib()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        return usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+const int kMinutesPerDay = 24 * 60;
+const int kMinutesPerWeek = 7 * kMinutesPerDay;
+
+// Half-open span [open, close) of minutes since Sunday 00:00 (google's day 0), never wrapping past the week's end
+typedef struct WeekInterval
+{
+    uint16_t open;
+    uint16_t close;
+} WeekInterval;
+
 // Structure to store open hours for a day
 typedef struct OpeningHours
 {
     bool open_now = false;
     std::vector<std::pair<std::string, std::string>> periods; // day's opening periods (open time, close time)
     std::vector<std::string> weekday_text;                    // Formatted opening hours text
+    std::vector<WeekInterval> week;                           // periods compiled at ingest; sorted and merged
 } OpeningHours;
 
+// Parses "HHMM" (as sent in periods) or "HH:MM" into minutes after midnight; -1 if malformed
+int parse_clock_minutes(const std::string &text)
+{
+    int digits[4];
+    int count = 0;
+    for (char c : text)
+    {
+        if (c == ':')
+            continue;
+        if (c < '0' || c > '9' || count == 4)
+            return -1;
+        digits[count++] = c - '0';
+    }
+    if (count != 4)
+    {
+        return -1;
+    }
+    int hours = digits[0] * 10 + digits[1];
+    int minutes = digits[2] * 10 + digits[3];
+    return hours <= 24 && minutes < 60 ? std::min(hours * 60 + minutes, kMinutesPerDay) : -1;
+}
+
+// Compiles one google period into hours.week. Google marks a place open around the clock with a single period that
+// opens Sunday at 0000 and has no close (close_day < 0); a period that closes earlier in the week than it opens wraps
+// past Saturday night and is split in two. Returns false, adding nothing, if the open or close is unusable or a
+// period other than that one has no close.
+bool add_week_interval(OpeningHours &hours, int open_day, const std::string &open_time, int close_day, const std::string &close_time)
+{
+    int open_minute = parse_clock_minutes(open_time);
+    if (open_day < 0 || open_day > 6 || open_minute < 0)
+    {
+        return false;
+    }
+
+    std::vector<WeekInterval> spans;
+    int close_minute = parse_clock_minutes(close_time);
+    if (close_day < 0)
+    {
+        if (open_day != 0 || open_minute != 0)
+        {
+            return false;
+        }
+        spans.push_back({0, static_cast<uint16_t>(kMinutesPerWeek)});
+    }
+    else if (close_day > 6 || close_minute < 0)
+    {
+        return false;
+    }
+    else
+    {
+        int start = open_day * kMinutesPerDay + open_minute;
+        int end = close_day * kMinutesPerDay + close_minute;
+        if (end > start)
+        {
+            spans.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(end)});
+        }
+        else
+        {
+            spans.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(kMinutesPerWeek)});
+            if (end > 0)
+                spans.push_back({0, static_cast<uint16_t>(end)});
+        }
+    }
+
+    // Keep the list sorted and merged so lookups can stop early and adjacent periods read as one
+    std::vector<WeekInterval> &week = hours.week;
+    week.insert(week.end(), spans.begin(), spans.end());
+    std::sort(week.begin(), week.end(), [](const WeekInterval &a, const WeekInterval &b)
+              { return a.open < b.open; });
+    size_t merged = 0;
+    for (size_t i = 1; i < week.size(); i++)
+    {
+        if (week[i].open <= week[merged].close)
+            week[merged].close = std::max(week[merged].close, week[i].close);
+        else
+            week[++merged] = week[i];
+    }
+    week.resize(merged + 1);
+    return true;
+}
+
+// Minute of the week for a day (0 = Sunday, as google numbers them) and a wall-clock time
+int week_minute(int day, int hour, int minute)
+{
+    return day * kMinutesPerDay + hour * 60 + minute;
+}
+
+// Minute of the week of a point in time, in the local time zone (the zone google's hours are given in)
+int week_minute(std::time_t when)
+{
+    std::tm local_tm = {};
+#ifdef _WIN32
+    localtime_s(&local_tm, &when);
+#else
+    localtime_r(&when, &local_tm);
+#endif
+    return week_minute(local_tm.tm_wday, local_tm.tm_hour, local_tm.tm_min);
+}
+
+// week_minute for now; the conversion is redone at most once a minute per thread
+int current_week_minute()
+{
+    static thread_local std::time_t converted_minute = -1;
+    static thread_local int converted = 0;
+    std::time_t now = std::time(nullptr);
+    if (now / 60 != converted_minute)
+    {
+        converted_minute = now / 60;
+        converted = week_minute(now);
+    }
+    return converted;
+}
+
+// Whether count intervals starting at interval cover a minute of the week.
+// Branch-free over the handful of intervals so scans across many restaurants don't stall on mispredictions.
+bool week_covers(const WeekInterval *interval, uint32_t count, int week_minute)
+{
+    unsigned open = 0;
+    for (; count > 0; count--, interval++)
+    {
+        open |= static_cast<unsigned>(week_minute >= interval->open) & static_cast<unsigned>(week_minute < interval->close);
+    }
+    return open != 0;
+}
+
+// Whether compiled hours cover a minute of the week
+bool is_open_at(const std::vector<WeekInterval> &week, int week_minute)
+{
+    for (const WeekInterval &interval : week)
+    {
+        if (week_minute < interval.open)
+            return false;
+        if (week_minute < interval.close)
+            return true;
+    }
+    return false;
+}
+
 typedef struct LatLon
 {
-    float lat;
-    float lon;
+    float lat = 0.0f;
+    float lon = 0.0f;
+    LatLon() {}
     LatLon(float lat, float lon) : lat(lat), lon(lon) {}
 } LatLon;
 
@@ -44,614 +284,9948 @@ typedef struct restaurant_data
     std::string current_status; // Text describing current open/closed statusp
 } restaurant_data;
 
-std::unordered_set<std::string> restaurantTypes = { // set that provides fast lookup for all of google's keys
-    "restuarant", "acai_shop", "afghani_restaurant", "african_restaurant", "american_restaurant",
-    "asian_restaurant", "bagel_shop", "bakery", "bar", "bar_and_grill", "barbecue_restaurant",
-    "brazilian_restaurant", "breakfast_restaurant", "brunch_restaurant", "buffet_restaurant",
-    "cafe", "cafeteria", "candy_store", "cat_cafe", "chinese_restaurant", "chocolate_factory",
-    "chocolate_shop", "coffee_shop", "confectionery", "deli", "dessert_restaurant", "dessert_shop",
-    "diner", "dog_cafe", "donut_shop", "fast_food_restaurant", "fine_dining_restaurant", "food_court",
-    "french_restaurant", "greek_restaurant", "hamburger_restaurant", "ice_cream_shop", "indian_restaurant",
-    "indonesian_restaurant", "italian_restaurant", "japanese_restaurant", "juice_shop", "korean_restaurant",
-    "lebanese_restaurant", "meal_delivery", "meal_takeaway", "mediterranean_restaurant", "mexican_restaurant",
-    "middle_eastern_restaurant", "pizza_restaurant", "pub", "ramen_restaurant", "restaurant", "sandwich_shop",
-    "seafood_restaurant", "spanish_restaurant", "steak_house", "sushi_restaurant", "tea_house", "thai_restaurant",
-    "turkish_restaurant", "vegan_restaurant", "vegetarian_restaurant", "vietnamese_restaurant", "wine_bar"};
-std::unordered_map<std::string, std::vector<restaurant_data>> restaurantInfoMap;
-std::unordered_map<std::string, std::vector<restaurant_data>> restaurantRatingMap;
+// Google place types we know about: every food-related type from the Places API plus the generic categories that
+// come with them. Each becomes a PlaceType value and a fixed bit in TypeSet.
+#define PLACE_TYPE_LIST(X)                                                                                              \
+    X(restaurant) X(food) X(point_of_interest) X(establishment) X(store) X(meal_delivery) X(meal_takeaway)              \
+    X(acai_shop) X(afghani_restaurant) X(african_restaurant) X(american_restaurant) X(asian_restaurant)               \
+    X(bagel_shop) X(bakery) X(bar) X(bar_and_grill) X(barbecue_restaurant) X(brazilian_restaurant)                     \
+    X(breakfast_restaurant) X(brunch_restaurant) X(buffet_restaurant) X(cafe) X(cafeteria) X(candy_store)             \
+    X(cat_cafe) X(chinese_restaurant) X(chocolate_factory) X(chocolate_shop) X(coffee_shop) X(confectionery)          \
+    X(deli) X(dessert_restaurant) X(dessert_shop) X(diner) X(dog_cafe) X(donut_shop) X(fast_food_restaurant)          \
+    X(fine_dining_restaurant) X(food_court) X(french_restaurant) X(greek_restaurant) X(hamburger_restaurant)          \
+    X(ice_cream_shop) X(indian_restaurant) X(indonesian_restaurant) X(italian_restaurant) X(japanese_restaurant)      \
+    X(juice_shop) X(korean_restaurant) X(lebanese_restaurant) X(mediterranean_restaurant) X(mexican_restaurant)       \
+    X(middle_eastern_restaurant) X(pizza_restaurant) X(pub) X(ramen_restaurant) X(sandwich_shop)                      \
+    X(seafood_restaurant) X(spanish_restaurant) X(steak_house) X(sushi_restaurant) X(tea_house) X(thai_restaurant)    \
+    X(turkish_restaurant) X(vegan_restaurant) X(vegetarian_restaurant) X(vietnamese_restaurant) X(wine_bar)           \
+    X(night_club) X(liquor_store) X(convenience_store) X(grocery_or_supermarket) X(supermarket) X(lodging)
 
-// fetch api key
-std::string getAPIKey(const std::string &filename)
+enum class PlaceType : uint8_t
 {
-    std::ifstream file(filename);
-    std::string line;
+#define PLACE_TYPE_ENUM(name) name,
+    PLACE_TYPE_LIST(PLACE_TYPE_ENUM)
+#undef PLACE_TYPE_ENUM
+};
 
-    if (file.is_open())
+constexpr const char *kPlaceTypeNames[] = {
+#define PLACE_TYPE_NAME(name) #name,
+    PLACE_TYPE_LIST(PLACE_TYPE_NAME)
+#undef PLACE_TYPE_NAME
+};
+constexpr int kKnownPlaceTypes = sizeof(kPlaceTypeNames) / sizeof(kPlaceTypeNames[0]);
+
+// Bits per restaurant: the known types first, then types interned at runtime for as long as bits remain
+constexpr int kTypeBits = 256;
+typedef std::bitset<kTypeBits> TypeSet;
+static_assert(kKnownPlaceTypes < kTypeBits, "known place types must leave room for interned ones");
+
+constexpr uint32_t place_type_hash(std::string_view text, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed; // FNV-1a
+    for (char c : text)
     {
-        while (getline(file, line))
-        {
-            if (line.find("API_KEY=") == 0)
-            {
-                return line.substr(8); // Extract key after "API_KEY="
-            }
-        }
-        file.close();
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
     }
+    return hash ^ (hash >> 15);
 }
-static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *s)
+
+// Collision-free hash table over kPlaceTypeNames, built by the compiler: slot holds type index + 1, 0 when empty
+typedef struct PlaceTypeTable
 {
-    // use a string instead of c_style; doesnt require allocation when appending data and directly works with boost JSON stringstream parsing
-    size_t newLength = size * nmemb;
-    try
-    {
-        s->append((char *)contents, newLength);
-        return newLength;
-    }
-    catch (std::bad_alloc &e)
+    static constexpr uint32_t kSlots = 1024;
+    uint32_t seed = 0;
+    uint8_t slots[kSlots] = {};
+} PlaceTypeTable;
+
+// Tries seeds until every known name lands in its own slot
+constexpr PlaceTypeTable build_place_type_table()
+{
+    for (uint32_t seed = 1; seed < 100000; seed++)
     {
-        return 0;
+        PlaceTypeTable table;
+        table.seed = seed;
+        bool collided = false;
+        for (int type = 0; type < kKnownPlaceTypes && !collided; type++)
+        {
+            uint32_t slot = place_type_hash(kPlaceTypeNames[type], seed) & (PlaceTypeTable::kSlots - 1);
+            collided = table.slots[slot] != 0;
+            table.slots[slot] = static_cast<uint8_t>(type + 1);
+        }
+        if (!collided)
+        {
+            return table;
+        }
     }
+    return PlaceTypeTable();
 }
 
-// Function to get current day and time for determining if a restaurant is open
-std::string get_current_day_of_week()
+constexpr PlaceTypeTable kPlaceTypeTable = build_place_type_table();
+static_assert(kPlaceTypeTable.seed != 0, "no collision-free seed for the place type table");
+
+// Index of a known google type, or -1; one hash and one string compare
+constexpr int known_place_type(std::string_view text)
 {
-    std::string days[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_time = std::chrono::system_clock::to_time_t(now);
-    std::tm local_tm = *std::localtime(&now_time);
-    return days[local_tm.tm_wday];
+    int slot = kPlaceTypeTable.slots[place_type_hash(text, kPlaceTypeTable.seed) & (PlaceTypeTable::kSlots - 1)];
+    return slot != 0 && text == kPlaceTypeNames[slot - 1] ? slot - 1 : -1;
 }
+static_assert(known_place_type("sushi_restaurant") == static_cast<int>(PlaceType::sushi_restaurant), "place type table is inconsistent");
 
-// formats unix time to return a string for human time
-std::string get_current_time_string()
+// Types shared by nearly every result; they never name a cuisine
+constexpr bool is_generic_place_type(std::string_view text)
 {
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_time = std::chrono::system_clock::to_time_t(now);
-    std::tm local_tm = *std::localtime(&now_time);
-
-    std::stringstream ss;
-    // setfill ensures leading zeros (i.e. 3:04 instead of 3:4)
-    // setw ensures digit wide (i.e. hours 0-23 or minutes 0-59)
-    ss << std::setfill('0') << std::setw(2) << local_tm.tm_hour << ":"
-       << std::setfill('0') << std::setw(2) << local_tm.tm_min;
-    return ss.str();
+    return text == "restaurant" || text == "food" || text == "establishment" || text == "point_of_interest" ||
+           text.find("_store") != std::string_view::npos;
 }
 
-// Function to fetch details for a specific place including opening hours
-bool fetch_place_details(restaurant_data &restaurant, const std::string &api_key)
+// is_generic_place_type evaluated for every known type at compile time
+typedef struct GenericPlaceTypes
 {
-    if (restaurant.place_id.empty())
+    bool values[kKnownPlaceTypes] = {};
+    constexpr GenericPlaceTypes()
     {
-        return false;
+        for (int type = 0; type < kKnownPlaceTypes; type++)
+            values[type] = is_generic_place_type(kPlaceTypeNames[type]);
     }
+} GenericPlaceTypes;
 
-    // Initialize curl
-    CURL *curl = curl_easy_init();
-    std::string readBuffer;
+constexpr GenericPlaceTypes kGenericPlaceTypes = GenericPlaceTypes();
 
-    if (curl)
+// Side table for types outside the known vocabulary (google adds new ones regularly).
+// Ids continue after the known types; ids below kTypeBits also get a bit in TypeSet.
+typedef struct PlaceTypeInterner
+{
+    // Id of a type, adding it to the table if it is new
+    int intern(std::string_view text)
     {
-        // Build the URL for Place Details API
-        std::string url = "https://maps.googleapis.com/maps/api/place/details/json?"
-                          "place_id=" +
-                          restaurant.place_id +
-                          "&fields=name,url,website,opening_hours,permanently_closed" +
-                          "&key=" + api_key;
-
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-
-        // Perform the request
-        CURLcode res = curl_easy_perform(curl);
-
-        // Check for errors
-        if (res != CURLE_OK)
+        int known = known_place_type(text);
+        if (known >= 0)
         {
-            std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-            curl_easy_cleanup(curl);
-            return false;
+            return known;
         }
-
-        try
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = ids.find(std::string(text));
+        if (found != ids.end())
         {
-            // Parse JSON response using Boost property_tree
-            pt::ptree root;
-            std::stringstream ss(readBuffer);
-            pt::read_json(ss, root);
-
-            // Check if the request was successful
-            if (root.get<std::string>("status") == "OK")
-            {
-                const pt::ptree &result = root.get_child("result");
+            return found->second;
+        }
+        int id = kKnownPlaceTypes + static_cast<int>(names.size());
+        names.emplace_back(text);
+        generic.push_back(is_generic_place_type(text));
+        ids.emplace(names.back(), id);
+        return id;
+    }
 
-                // Get website URL if available
-                try
-                {
-                    restaurant.url = result.get<std::string>("website");
-                }
-                catch (pt::ptree_bad_path &)
-                {
-                    try
-                    {
-                        restaurant.url = result.get<std::string>("url");
-                    }
-                    catch (pt::ptree_bad_path &)
-                    {
-                        restaurant.url = "Not available";
-                    }
-                }
+    // Id of a type without adding it; -1 if it has never been seen
+    int find(std::string_view text)
+    {
+        int known = known_place_type(text);
+        if (known >= 0)
+        {
+            return known;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = ids.find(std::string(text));
+        return found != ids.end() ? found->second : -1;
+    }
 
-                // Check if place is permanently closed
-                try
-                {
-                    restaurant.is_operational = !result.get<bool>("permanently_closed");
-                }
-                catch (pt::ptree_bad_path &)
-                {
-                    restaurant.is_operational = true; // Assume operational if not specified
-                }
+    std::string name(int id)
+    {
+        if (id < kKnownPlaceTypes)
+        {
+            return kPlaceTypeNames[id];
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return names[id - kKnownPlaceTypes];
+    }
 
-                // Get opening hours
-                try
-                {
-                    const pt::ptree &opening_hours = result.get_child("opening_hours");
+    // Number of ids handed out so far, known types included
+    int size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return kKnownPlaceTypes + static_cast<int>(names.size());
+    }
 
-                    // Check if open now
-                    try
-                    {
-                        restaurant.hours.open_now = opening_hours.get<bool>("open_now");
-                    }
-                    catch (pt::ptree_bad_path &)
-                    {
-                        restaurant.hours.open_now = false;
-                    }
+    bool is_generic(int id)
+    {
+        if (id < kKnownPlaceTypes)
+        {
+            return kGenericPlaceTypes.values[id];
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return generic[id - kKnownPlaceTypes];
+    }
 
-                    // Get weekday text (formatted opening hours)
-                    try
-                    {
-                        const pt::ptree &weekday_text = opening_hours.get_child("weekday_text");
-                        for (const auto &text_pair : weekday_text)
-                        {
-                            restaurant.hours.weekday_text.push_back(text_pair.second.get_value<std::string>());
-                        }
-                    }
-                    catch (pt::ptree_bad_path &)
-                    {
-                        // No weekday text available
-                    }
+private:
+    std::mutex mutex;
+    std::deque<std::string> names; // deque so the map's keys can be copies made once
+    std::vector<bool> generic;
+    std::unordered_map<std::string, int> ids;
+} PlaceTypeInterner;
 
-                    // Get detailed period information
-                    try
-                    {
-                        const pt::ptree &periods = opening_hours.get_child("periods");
-                        for (const auto &period_pair : periods)
-                        {
-                            const pt::ptree &period = period_pair.second;
+PlaceTypeInterner placeTypes; // every type string seen at ingest is interned here
 
-                            std::string open_time = period.get_child("open").get<std::string>("time");
+// Bits for a list of type names; a name that has no bit (never seen, or interned past kTypeBits) sets nothing and
+// is reported through unmapped so callers can fall back to comparing strings
+TypeSet type_set(std::initializer_list<std::string_view> names, bool *unmapped = nullptr)
+{
+    TypeSet bits;
+    for (std::string_view name : names)
+    {
+        int id = placeTypes.find(name);
+        if (id >= 0 && id < kTypeBits)
+            bits.set(id);
+        else if (unmapped)
+            *unmapped = true;
+    }
+    return bits;
+}
 
-                            std::string close_time;
-                            try
-                            {
-                                close_time = period.get_child("close").get<std::string>("time");
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                close_time = "24:00"; // Open 24 hours
-                            }
+// Bits for a restaurant's type strings, interning any new ones. Ids past kTypeBits have no bit and go to beyond.
+TypeSet intern_types(const std::vector<std::string> &types, std::vector<uint32_t> &beyond)
+{
+    TypeSet bits;
+    beyond.clear();
+    for (const std::string &type : types)
+    {
+        int id = placeTypes.intern(type);
+        if (id < kTypeBits)
+            bits.set(id);
+        else
+            beyond.push_back(static_cast<uint32_t>(id));
+    }
+    return bits;
+}
 
-                            restaurant.hours.periods.push_back(std::make_pair(open_time, close_time));
-                        }
-                    }
-                    catch (pt::ptree_bad_path &)
-                    {
-                        // No periods available
-                    }
+// Bits kept per restaurant in RestaurantStore::flags
+enum RestaurantFlags : uint8_t
+{
+    FLAG_OPEN_NOW = 1 << 0,
+    FLAG_OPERATIONAL = 1 << 1,
+    FLAG_HAS_HOURS = 1 << 2,
+    FLAG_HAS_RATING = 1 << 3
+};
 
-                    // Determine current status
-                    if (!restaurant.is_operational)
-                    {
-                        restaurant.current_status = "Permanently closed";
-                    }
-                    else if (restaurant.hours.open_now)
-                    {
-                        restaurant.current_status = "Currently open";
+// Owns every loaded restaurant exactly once, addressed by a dense uint32_t index.
+// The fields filters scan (position, rating, status flags) are mirrored into parallel arrays so a scan walks contiguous
+// memory; the full record with its strings is only touched when a result is actually used.
+typedef struct RestaurantStore
+{
+    std::vector<restaurant_data> records;
+    std::vector<float> lat;
+    std::vector<float> lon;
+    std::vector<float> rating;
+    std::vector<uint8_t> flags;
+    std::vector<TypeSet> types;              // interned bits of each record's type strings
+    std::vector<std::vector<uint32_t>> types_beyond; // each record's interned ids past kTypeBits, almost always none
+    std::vector<uint32_t> hours_first;       // start of each restaurant's compiled hours in hours_pool
+    std::vector<uint8_t> hours_count;        // number of intervals at hours_first
+    std::vector<uint8_t> hours_capacity;     // intervals reserved at hours_first; never below hours_count
+    std::vector<WeekInterval> hours_pool;    // every restaurant's hours.week back to back
+    std::unordered_map<std::string, uint32_t> by_place_id;
 
-                        // Try to find when it closes
-                        std::string current_day = get_current_day_of_week();
-                        for (const auto &text : restaurant.hours.weekday_text)
-                        {
-                            if (text.find(current_day) != std::string::npos)
-                            {
-                                size_t close_pos = text.find("–");
-                                if (close_pos != std::string::npos)
-                                {
-                                    restaurant.current_status += " (Closes " + text.substr(close_pos + 1) + ")";
-                                }
-                                break;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        restaurant.current_status = "Currently closed";
+    size_t size() const { return records.size(); }
+    const restaurant_data &operator[](uint32_t index) const { return records[index]; }
 
-                        // Try to find when it opens next
-                        std::string current_day = get_current_day_of_week();
-                        bool found_today = false;
+    // Whether a record carries an interned type, for the ids past kTypeBits that have no bit in types
+    bool has_type(uint32_t index, int type_id) const
+    {
+        const std::vector<uint32_t> &ids = types_beyond[index];
+        return std::find(ids.begin(), ids.end(), static_cast<uint32_t>(type_id)) != ids.end();
+    }
 
-                        for (const auto &text : restaurant.hours.weekday_text)
-                        {
-                            if (text.find(current_day) != std::string::npos)
-                            {
-                                found_today = true;
-                                if (text.find("Closed") != std::string::npos)
-                                {
-                                    restaurant.current_status += " (Closed today)";
-                                }
-                                else
-                                {
-                                    size_t open_pos = text.find(": ");
-                                    if (open_pos != std::string::npos)
-                                    {
-                                        size_t close_pos = text.find("–", open_pos);
-                                        if (close_pos != std::string::npos)
-                                        {
-                                            restaurant.current_status += " (Opens " + text.substr(open_pos + 2, close_pos - open_pos - 3) + ")";
-                                        }
-                                    }
-                                }
-                                break;
-                            }
-                        }
+    // Whether a restaurant's compiled hours cover a minute of the week (false when it has none)
+    bool is_open_at(uint32_t index, int week_minute) const
+    {
+        return week_covers(hours_pool.data() + hours_first[index], hours_count[index], week_minute);
+    }
 
-                        if (!found_today)
-                        {
-                            restaurant.current_status += " (Hours unknown)";
-                        }
-                    }
-                }
-                catch (pt::ptree_bad_path &)
-                {
-                    restaurant.current_status = "Hours not available";
-                }
-            }
-            else
+    // Adds a restaurant (or refreshes the existing record with the same place_id) and returns its index.
+    // inserted is set to false when an existing record was refreshed.
+    uint32_t add(restaurant_data &&restaurant, bool *inserted = nullptr)
+    {
+        if (!restaurant.place_id.empty())
+        {
+            auto existing = by_place_id.find(restaurant.place_id);
+            if (existing != by_place_id.end())
             {
-                std::string status = root.get<std::string>("status");
-                std::cerr << "API Error: " << status << std::endl;
-                try
-                {
-                    std::string error_msg = root.get<std::string>("error_message");
-                    std::cerr << "Error message: " << error_msg << std::endl;
-                }
-                catch (pt::ptree_bad_path &)
+                records[existing->second] = std::move(restaurant);
+                sync_columns(existing->second);
+                if (inserted)
                 {
-                    // No error message available
+                    *inserted = false;
                 }
-                curl_easy_cleanup(curl);
-                return false;
+                return existing->second;
             }
         }
-        catch (pt::json_parser_error &e)
+
+        uint32_t index = static_cast<uint32_t>(records.size());
+        records.push_back(std::move(restaurant));
+        lat.push_back(0.0f);
+        lon.push_back(0.0f);
+        rating.push_back(0.0f);
+        flags.push_back(0);
+        types.push_back(TypeSet());
+        types_beyond.emplace_back();
+        hours_first.push_back(static_cast<uint32_t>(hours_pool.size()));
+        hours_count.push_back(0);
+        hours_capacity.push_back(0);
+        sync_columns(index);
+        if (!records[index].place_id.empty())
         {
-            std::cerr << "JSON parse error: " << e.what() << std::endl;
-            curl_easy_cleanup(curl);
-            return false;
+            by_place_id.emplace(records[index].place_id, index);
         }
-        catch (pt::ptree_error &e)
+        if (inserted)
         {
-            std::cerr << "Property tree error: " << e.what() << std::endl;
-            curl_easy_cleanup(curl);
-            return false;
+            *inserted = true;
         }
+        return index;
+    }
 
-        // Clean up
-        curl_easy_cleanup(curl);
-        return true;
+    // Copies the hot fields of a record into the column arrays after the record changed
+    void sync_columns(uint32_t index)
+    {
+        const restaurant_data &restaurant = records[index];
+        lat[index] = restaurant.location.lat;
+        lon[index] = restaurant.location.lon;
+        rating[index] = static_cast<float>(restaurant.rating);
+        uint8_t bits = 0;
+        if (restaurant.hours.open_now)
+            bits |= FLAG_OPEN_NOW;
+        if (restaurant.is_operational)
+            bits |= FLAG_OPERATIONAL;
+        if (!restaurant.hours.weekday_text.empty() || !restaurant.hours.periods.empty())
+            bits |= FLAG_HAS_HOURS;
+        if (restaurant.rating > 0.0)
+            bits |= FLAG_HAS_RATING;
+        flags[index] = bits;
+        types[index] = intern_types(restaurant.types, types_beyond[index]);
+
+        // Refreshed hours are rewritten in place when they fit the record's run, otherwise appended (the old run is
+        // left unused). The run keeps its size when the hours shrink, so hours that alternate in length settle in
+        // one run instead of leaking one per refresh.
+        const std::vector<WeekInterval> &week = restaurant.hours.week;
+        size_t count = std::min<size_t>(week.size(), UINT8_MAX);
+        if (count > hours_capacity[index])
+        {
+            hours_first[index] = static_cast<uint32_t>(hours_pool.size());
+            hours_pool.resize(hours_pool.size() + count);
+            hours_capacity[index] = static_cast<uint8_t>(count);
+        }
+        std::copy(week.begin(), week.begin() + count, hours_pool.begin() + hours_first[index]);
+        hours_count[index] = static_cast<uint8_t>(count);
     }
 
-    return false;
+    void clear()
+    {
+        records.clear();
+        lat.clear();
+        lon.clear();
+        rating.clear();
+        flags.clear();
+        types.clear();
+        types_beyond.clear();
+        hours_first.clear();
+        hours_count.clear();
+        hours_capacity.clear();
+        hours_pool.clear();
+        by_place_id.clear();
+    }
+} RestaurantStore;
+
+RestaurantStore restaurantStore; // every loaded restaurant, stored once
+int maxDetailsInFlight = 8; // number of place details requests allowed to run concurrently
+std::string placesApiBase = "https://maps.googleapis.com/maps/api/place"; // pointed at the local mock by --bench-e2e
+
+// Keys of the rating index, best first
+const char *const kRatingBuckets[] = {"5.0-4.8", "4.79-4.4", "4.39-3.8", "3.79-3.0", "2.9-2.5", "<=2.49", "no rating"};
+constexpr int kRatingBucketCount = sizeof(kRatingBuckets) / sizeof(kRatingBuckets[0]);
+
+// Position in kRatingBuckets of the bucket a rating falls in (0.0 means google had no rating)
+int rating_bucket_index(double rating)
+{
+    if (rating <= 0.0)
+        return 6;
+    if (rating >= 4.8)
+        return 0;
+    if (rating >= 4.4)
+        return 1;
+    if (rating >= 3.8)
+        return 2;
+    if (rating >= 3.0)
+        return 3;
+    if (rating >= 2.5)
+        return 4;
+    return 5;
 }
 
-// Function to fetch nearby restaurants and return them as a vector of restaurant_data structs
-std::vector<restaurant_data> fetch_nearby_restaurants(const std::string &location,
-                                                      int radius, int limit, // -1 for unlimited
-                                                      const std::string &api_key)
+// Maps a rating onto the buckets of the rating index
+const char *rating_bucket(double rating)
 {
-    std::vector<restaurant_data> restaurants;
+    return kRatingBuckets[rating_bucket_index(rating)];
+}
 
-    // Flag to control pagination
-    bool has_more_results = true;
-    std::string next_page_token = "";
+// Concurrent key -> store index lists (the type and rating indices). Keys are spread over shards with their own locks;
+// ingest workers collect a Batch privately and merge it with one lock per shard it touches, so keys every place has
+// (e.g. "restaurant") cost one append per batch instead of a contended insert per place.
+typedef struct ShardedIndex
+{
+    static const size_t kShards = 16;
 
-    // Keep fetching while there are more results and we haven't hit the limit
-    while (has_more_results && (limit < 0 || restaurants.size() < limit))
+    // Postings gathered by one worker before they are merged; reusing a batch keeps its keys and list capacity
+    typedef struct Batch
     {
-        // Initialize curl for this request
-        CURL *curl = curl_easy_init();
-        std::string readBuffer;
+        std::unordered_map<std::string, std::vector<uint32_t>> postings;
 
-        if (curl)
+        void add(const std::string &key, uint32_t index) { postings[key].push_back(index); }
+    } Batch;
+
+    void merge(Batch &batch)
+    {
+        std::vector<std::pair<const std::string *, std::vector<uint32_t> *>> by_shard[kShards];
+        for (auto &entry : batch.postings)
         {
-            // Type of place to search for
-            std::string type = "restaurant";
+            by_shard[shard_of(entry.first)].emplace_back(&entry.first, &entry.second);
+        }
+        for (size_t s = 0; s < kShards; s++)
+        {
+            if (by_shard[s].empty())
+            {
+                continue;
+            }
+            std::lock_guard<std::shared_mutex> lock(shards[s].mutex);
+            for (auto &entry : by_shard[s])
+            {
+                if (entry.second->empty())
+                {
+                    continue;
+                }
+                std::vector<uint32_t> &list = shards[s].postings[*entry.first];
+                list.insert(list.end(), entry.second->begin(), entry.second->end());
+            }
+        }
+        for (auto &entry : batch.postings)
+        {
+            entry.second.clear();
+        }
+    }
 
-            // Build the URL - either initial request or pagination request
-            std::string url;
-            if (next_page_token.empty())
+    // Indices under key that are below visible_below, in ascending order
+    size_t lookup(const std::string &key, uint32_t visible_below, std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        const Shard &shard = shards[shard_of(key)];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.postings.find(key);
+            if (found == shard.postings.end())
             {
-                // Initial request
-                url = "https://maps.googleapis.com/maps/api/place/nearbysearch/json?"
-                      "location=" +
-                      location +
-                      "&radius=" + std::to_string(radius) +
-                      "&type=" + type +
-                      "&key=" + api_key;
+                return 0;
             }
-            else
+            for (uint32_t index : found->second)
             {
-                // Pagination request using the next page token
-                url = "https://maps.googleapis.com/maps/api/place/nearbysearch/json?"
-                      "pagetoken=" +
-                      next_page_token +
-                      "&key=" + api_key;
+                if (index < visible_below)
+                    out.push_back(index);
+            }
+        }
+        std::sort(out.begin(), out.end()); // merges from concurrent batches interleave
+        return out.size();
+    }
 
-                // Add a small delay as required by Google API before using a page token
-                // This is necessary as the token might not be immediately usable
-                std::cout << "Getting next page of results with token..." << std::endl;
-                std::this_thread::sleep_for(std::chrono::milliseconds(2000)); // 2-second delay; mandatory for google places api
+    std::vector<std::string> keys() const
+    {
+        std::vector<std::string> all;
+        for (const Shard &shard : shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto &entry : shard.postings)
+            {
+                all.push_back(entry.first);
             }
+        }
+        std::sort(all.begin(), all.end());
+        return all;
+    }
 
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+    void clear()
+    {
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::shared_mutex> lock(shard.mutex);
+            shard.postings.clear();
+        }
+    }
 
-            // Perform the request
-            CURLcode res = curl_easy_perform(curl);
+private:
+    typedef struct alignas(64) Shard // one cache line per lock so shards don't share one
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::vector<uint32_t>> postings;
+    } Shard;
 
-            // Check for errors
-            if (res != CURLE_OK)
+    Shard shards[kShards];
+
+    static size_t shard_of(const std::string &key) { return std::hash<std::string>()(key) % kShards; }
+} ShardedIndex;
+
+// Tracks which store indices are fully indexed. Ranges are begun in index order (callers assign them under the store
+// lock) and may complete in any order; visible() is the end of the longest completed prefix, so a reader cutting
+// every lookup at it sees each restaurant in all index lists or in none.
+typedef struct IngestWatermark
+{
+    void begin(uint32_t first, uint32_t end)
+    {
+        if (first == end)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[first] = end;
+        assigned_end = std::max(assigned_end, end);
+    }
+
+    void complete(uint32_t first)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(first);
+        published.store(pending.empty() ? assigned_end : pending.begin()->first, std::memory_order_release);
+    }
+
+    uint32_t visible() const { return published.load(std::memory_order_acquire); }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.clear();
+        assigned_end = 0;
+        published = 0;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<uint32_t, uint32_t> pending; // first -> end of ranges being indexed
+    uint32_t assigned_end = 0;
+    std::atomic<uint32_t> published{0};
+} IngestWatermark;
+
+// Type and rating-bucket indices over a RestaurantStore that many workers can fill at once while readers query them
+typedef struct RestaurantIndex
+{
+    ShardedIndex by_type;   // google type -> indices into the store
+    ShardedIndex by_rating; // rating_bucket -> indices into the store
+    IngestWatermark watermark;
+
+    // A consistent view: every lookup is cut at the same fully indexed prefix of the store
+    typedef struct Snapshot
+    {
+        const RestaurantIndex *index = nullptr;
+        uint32_t visible = 0;
+
+        size_t of_type(const std::string &type, std::vector<uint32_t> &out) const { return index->by_type.lookup(type, visible, out); }
+        size_t in_rating_bucket(const std::string &bucket, std::vector<uint32_t> &out) const { return index->by_rating.lookup(bucket, visible, out); }
+    } Snapshot;
+
+    Snapshot snapshot() const { return Snapshot{this, watermark.visible()}; }
+
+    // Indexes store[first, end), a range already passed to watermark.begin. The records are read under a shared lock
+    // on store_mutex (if given) and the postings merged without it, so other ranges can be added and indexed meanwhile.
+    void index_range(const RestaurantStore &store, uint32_t first, uint32_t end, std::shared_mutex *store_mutex = nullptr)
+    {
+        thread_local ShardedIndex::Batch types;
+        thread_local ShardedIndex::Batch ratings;
+        {
+            std::shared_lock<std::shared_mutex> lock;
+            if (store_mutex)
             {
-                std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-                curl_easy_cleanup(curl);
-                break; // Exit the pagination loop on error
+                lock = std::shared_lock<std::shared_mutex>(*store_mutex);
             }
-            else
+            for (uint32_t index = first; index < end; index++)
             {
-                try
+                const restaurant_data &restaurant = store[index];
+                for (const std::string &type : restaurant.types)
                 {
-                    // Parse JSON response using Boost property_tree
-                    pt::ptree root;
-                    std::stringstream ss(readBuffer);
-                    pt::read_json(ss, root);
+                    types.add(type, index);
+                }
+                ratings.add(rating_bucket(restaurant.rating), index);
+            }
+        }
+        by_type.merge(types);
+        by_rating.merge(ratings);
+        watermark.complete(first);
+    }
 
-                    // Check if the request was successful
-                    if (root.get<std::string>("status") == "OK")
-                    {
-                        // Get the restaurants from results array
-                        const pt::ptree &results = root.get_child("results");
-                        int results_this_page = 0;
+    void clear()
+    {
+        by_type.clear();
+        by_rating.clear();
+        watermark.reset();
+    }
+} RestaurantIndex;
 
-                        // Process each restaurant result
-                        for (const auto &pair : results)
-                        {
-                            if (limit > 0 && restaurants.size() >= limit)
-                            {
-                                // We've hit our limit, stop processing
-                                has_more_results = false;
-                                break;
-                            }
+RestaurantIndex restaurantIndex; // type and rating indices over restaurantStore
 
-                            const pt::ptree &place = pair.second;
+// Rebuilds both indices from scratch over the whole store
+void rebuild_restaurant_maps()
+{
+    restaurantIndex.clear();
+    uint32_t end = static_cast<uint32_t>(restaurantStore.size());
+    restaurantIndex.watermark.begin(0, end);
+    restaurantIndex.index_range(restaurantStore, 0, end);
+}
 
-                            // Create a restaurant_data struct for the current restaurant
-                            restaurant_data restaurant;
+// Optional constraints combined with local queries; default values mean "don't care"
+typedef struct RestaurantFilter
+{
+    std::string type;       // must be one of the restaurant's google types; set through require_type
+    int type_id = -1;       // type's interned id, -1 while type has never been seen
+    TypeSet all_types;      // every one of these must be present too (see type_set)
+    float min_rating = 0.0f;
+    bool open_now_only = false;
+    bool operational_only = false;
+    int open_at = -1;       // minute of the week (see week_minute) the place must be open at; -1 for any
 
-                            // Restaurant name
-                            restaurant.name = place.get<std::string>("name");
+    // Sets type and looks up its id once, rather than for every record the filter is checked against
+    void require_type(const std::string &name)
+    {
+        type = name;
+        type_id = placeTypes.find(name);
+    }
+} RestaurantFilter;
 
-                            // Rating (if available)
-                            try
-                            {
-                                restaurant.rating = place.get<double>("rating");
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                restaurant.rating = 0.0; // Rating not available
-                            }
+// Whether a filter excludes anything at all, so scans can skip matches_filter when it does not
+bool constrains(const RestaurantFilter &filter)
+{
+    return !filter.type.empty() || filter.all_types.any() || filter.min_rating > 0.0f || filter.open_now_only || filter.operational_only ||
+           filter.open_at >= 0;
+}
 
-                            // Address
-                            try
-                            {
-                                restaurant.address = place.get<std::string>("vicinity");
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                restaurant.address = "Address not available";
-                            }
+// Checks a stored restaurant against a filter, using the column arrays before touching the record.
+// Store is a RestaurantStore or anything else with the same columns (see MappedSnapshot).
+template <typename Store>
+bool matches_filter(const Store &store, uint32_t index, const RestaurantFilter &filter)
+{
+    if (store.rating[index] < filter.min_rating)
+        return false;
+    if (filter.open_now_only && !(store.flags[index] & FLAG_OPEN_NOW))
+        return false;
+    if (filter.operational_only && !(store.flags[index] & FLAG_OPERATIONAL))
+        return false;
+    if (filter.open_at >= 0 && !store.is_open_at(index, filter.open_at))
+        return false;
+    if ((store.types[index] & filter.all_types) != filter.all_types)
+        return false;
+    if (!filter.type.empty())
+    {
+        if (filter.type_id < 0)
+            return false; // no stored restaurant had this type when the filter was built
+        if (filter.type_id < kTypeBits)
+            return store.types[index].test(filter.type_id);
+        return store.has_type(index, filter.type_id);
+    }
+    return true;
+}
 
-                            // Extract latitude and longitude
-                            restaurant.location = LatLon(static_cast<float>(place.get_child("geometry").get_child("location").get<double>("lat")), static_cast<float>(place.get_child("geometry").get_child("location").get<double>("lng")));
-                            // Store all types in the restaurant.types vector
-                            try
-                            {
-                                const pt::ptree &type_array = place.get_child("types");
-                                for (const auto &type_pair : type_array)
-                                {
-                                    std::string type_str = type_pair.second.get_value<std::string>();
-                                    restaurant.types.push_back(type_str);
-                                }
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                restaurant.types.push_back("No types available");
-                            }
+// Collects every restaurant carrying all of the given types, e.g. type_set({"vegan_restaurant", "bar"})
+size_t restaurants_with_types(const RestaurantStore &store, const TypeSet &required, std::vector<uint32_t> &out)
+{
+    out.clear();
+    for (uint32_t index = 0; index < store.size(); index++)
+    {
+        if ((store.types[index] & required) == required)
+            out.push_back(index);
+    }
+    return out.size();
+}
 
-                            // Determine cuisine type based on types (using original logic)
-                            restaurant.cuisine = "Not specified";
-                            for (const auto &type_str : restaurant.types)
-                            {
-                                // Look for food-related types
-                                if (type_str != "restaurant" && type_str != "food" &&
-                                    type_str != "establishment" && type_str != "point_of_interest" &&
-                                    type_str.find("_store") == std::string::npos)
-                                {
-                                    restaurant.cuisine = type_str;
+// Collects every restaurant whose hours cover a minute of the week, e.g. week_minute(5, 22, 30) for Friday 22:30.
+// Only the hours columns are read, so this stays a flat scan however large the records are.
+size_t restaurants_open_at(const RestaurantStore &store, int week_minute, std::vector<uint32_t> &out)
+{
+    out.resize(store.size());
+    size_t found = 0;
+    for (uint32_t index = 0; index < store.size(); index++)
+    {
+        out[found] = index; // written unconditionally and kept only if open, so the loop has no data-dependent branch
+        found += store.is_open_at(index, week_minute);
+    }
+    out.resize(found);
+    return found;
+}
 
-                                    // Replace underscores with spaces and capitalize
-                                    std::replace(restaurant.cuisine.begin(), restaurant.cuisine.end(), '_', ' ');
-                                    if (!restaurant.cuisine.empty())
-                                    {
-                                        restaurant.cuisine[0] = std::toupper(restaurant.cuisine[0]);
-                                    }
-                                    break;
-                                }
-                            }
+const double kEarthRadiusMeters = 6371008.8;
+const double kDegToRad = 3.14159265358979323846 / 180.0;
 
-                            // Check for open_now information in the nearby search results
-                            try
-                            {
-                                const pt::ptree &hours = place.get_child("opening_hours");
-                                restaurant.hours.open_now = hours.get<bool>("open_now");
-                                restaurant.current_status = restaurant.hours.open_now ? "Currently open" : "Currently closed";
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                restaurant.current_status = "Hours not available";
-                            }
+// Great-circle distance between two points in meters
+double distance_meters(double lat1, double lon1, double lat2, double lon2)
+{
+    double dlat = (lat2 - lat1) * kDegToRad;
+    double dlon = (lon2 - lon1) * kDegToRad;
+    double a = std::sin(dlat / 2) * std::sin(dlat / 2) +
+               std::cos(lat1 * kDegToRad) * std::cos(lat2 * kDegToRad) * std::sin(dlon / 2) * std::sin(dlon / 2);
+    return 2.0 * kEarthRadiusMeters * std::asin(std::sqrt(std::min(1.0, a)));
+}
 
-                            // Place ID for getting more details
-                            try
-                            {
-                                restaurant.place_id = place.get<std::string>("place_id");
-                            }
-                            catch (pt::ptree_bad_path &)
-                            {
-                                restaurant.place_id = "";
-                            }
+// Placement of a GridIndex's cells; plain data so a snapshot can store it as is
+typedef struct GridShape
+{
+    double min_lat = 0.0;
+    double min_lon = 0.0;
+    double cell_lat = 1.0;
+    double cell_lon = 1.0;
+    double cell_height_m = 0.0;
+    double cell_width_m = 0.0; // narrowest cell width over the grid's latitude range
+    int32_t rows = 0;
+    int32_t cols = 0;
+} GridShape;
 
-                            // Website would require a second API call
-                            restaurant.url = "Not available";
+// Uniform grid over the store's coordinates. Entries are bucketed by cell in one flat array (CSR layout), so a query
+// only visits the handful of cells overlapping its search area. Store is anything with lat/lon columns that
+// matches_filter accepts: the live RestaurantStore, or a MappedSnapshot whose grid arrays are adopted from the file.
+template <typename Store>
+struct GridIndex
+{
+    GridIndex() {}
+    GridIndex(const GridIndex &) = delete; // the spans may point into this index's own vectors
+    GridIndex &operator=(const GridIndex &) = delete;
 
-                            // Add the restaurant to our vector
-                            restaurants.push_back(restaurant);
-                            results_this_page++;
-                        }
+    // Rebuilds the grid over every restaurant in the store; cell_meters is the approximate cell edge length
+    void build(const Store &restaurants, double cell_meters = 250.0)
+    {
+        store = &restaurants;
+        built_cells.clear();
+        built_entries.clear();
+        cell_start = built_cells;
+        entries = built_entries;
+        if (restaurants.size() == 0)
+        {
+            shape.rows = shape.cols = 0;
+            return;
+        }
 
-                        std::cout << "Retrieved " << results_this_page << " restaurants (total: " << restaurants.size() << ")" << std::endl;
+        shape.min_lat = *std::min_element(restaurants.lat.begin(), restaurants.lat.end());
+        shape.min_lon = *std::min_element(restaurants.lon.begin(), restaurants.lon.end());
+        double max_lat = *std::max_element(restaurants.lat.begin(), restaurants.lat.end());
+        double max_lon = *std::max_element(restaurants.lon.begin(), restaurants.lon.end());
 
-                        // Check for next page token
-                        try
+        // Degrees per cell, widened in longitude so cells stay roughly square at this latitude.
+        // Sparse data spread over a large area gets coarser cells so the grid stays proportional to the data.
+        double mid_lat = (shape.min_lat + max_lat) / 2.0;
+        double mid_cos = std::max(0.01, std::cos(mid_lat * kDegToRad));
+        size_t max_cells = std::max<size_t>(1024, 4 * restaurants.size());
+        do
+        {
+            shape.cell_lat = cell_meters / (kEarthRadiusMeters * kDegToRad);
+            shape.cell_lon = shape.cell_lat / mid_cos;
+            shape.rows = static_cast<int>((max_lat - shape.min_lat) / shape.cell_lat) + 1;
+            shape.cols = static_cast<int>((max_lon - shape.min_lon) / shape.cell_lon) + 1;
+            cell_meters *= 2.0;
+        } while (static_cast<size_t>(shape.rows) * shape.cols > max_cells);
+        shape.cell_height_m = cell_meters / 2.0;
+        shape.cell_width_m = shape.cell_height_m * std::max(0.01, std::cos(std::max(std::abs(shape.min_lat), std::abs(max_lat)) * kDegToRad)) / mid_cos;
+
+        // Counting sort of the entries by cell
+        built_cells.assign(static_cast<size_t>(shape.rows) * shape.cols + 1, 0);
+        std::vector<uint32_t> cell_of(restaurants.size());
+        for (uint32_t i = 0; i < restaurants.size(); i++)
+        {
+            cell_of[i] = static_cast<uint32_t>(row_of(restaurants.lat[i]) * shape.cols + col_of(restaurants.lon[i]));
+            built_cells[cell_of[i] + 1]++;
+        }
+        for (size_t c = 1; c < built_cells.size(); c++)
+        {
+            built_cells[c] += built_cells[c - 1];
+        }
+        built_entries.resize(restaurants.size());
+        std::vector<uint32_t> fill(built_cells.begin(), built_cells.end() - 1);
+        for (uint32_t i = 0; i < restaurants.size(); i++)
+        {
+            built_entries[fill[cell_of[i]]++] = i;
+        }
+        cell_start = built_cells;
+        entries = built_entries;
+    }
+
+    // Uses a grid built earlier (e.g. one stored in a snapshot) without copying it; the arrays must outlive the index
+    void adopt(const Store &restaurants, const GridShape &grid, std::span<const uint32_t> cells, std::span<const uint32_t> cell_entries)
+    {
+        store = &restaurants;
+        shape = grid;
+        built_cells.clear();
+        built_entries.clear();
+        cell_start = cells;
+        entries = cell_entries;
+    }
+
+    const GridShape &grid() const { return shape; }
+    std::span<const uint32_t> cells() const { return cell_start; }
+    std::span<const uint32_t> cell_entries() const { return entries; }
+
+    // Restaurants within meters of center, in no particular order
+    std::vector<uint32_t> within_radius(LatLon center, double meters, const RestaurantFilter &filter = RestaurantFilter()) const
+    {
+        std::vector<uint32_t> found;
+        if (shape.rows == 0)
+            return found;
+
+        double dlat = meters / (kEarthRadiusMeters * kDegToRad);
+        double dlon = dlat / std::max(0.01, std::cos(center.lat * kDegToRad));
+        for_each_in_box(center.lat - dlat, center.lon - dlon, center.lat + dlat, center.lon + dlon, [&](uint32_t i)
                         {
-                            next_page_token = root.get<std::string>("next_page_token");
-                            // There is a next page token, continue pagination
-                            has_more_results = true;
-                        }
-                        catch (pt::ptree_bad_path &)
+            if (distance_meters(center.lat, center.lon, store->lat[i], store->lon[i]) <= meters && matches_filter(*store, i, filter))
+                found.push_back(i); });
+        return found;
+    }
+
+    // Restaurants inside the box spanned by two corners
+    std::vector<uint32_t> within_box(LatLon southwest, LatLon northeast, const RestaurantFilter &filter = RestaurantFilter()) const
+    {
+        std::vector<uint32_t> found;
+        if (shape.rows == 0)
+            return found;
+
+        for_each_in_box(southwest.lat, southwest.lon, northeast.lat, northeast.lon, [&](uint32_t i)
                         {
-                            // No next page token, we're done
-                            has_more_results = false;
-                            next_page_token = "";
-                        }
-                    }
-                    else
+            if (store->lat[i] >= southwest.lat && store->lat[i] <= northeast.lat &&
+                store->lon[i] >= southwest.lon && store->lon[i] <= northeast.lon && matches_filter(*store, i, filter))
+                found.push_back(i); });
+        return found;
+    }
+
+    // Number of restaurants in the cells the box overlaps, without visiting them
+    size_t count_in_box(LatLon southwest, LatLon northeast) const
+    {
+        if (shape.rows == 0)
+            return 0;
+
+        size_t count = 0;
+        int c0 = col_of(southwest.lon), c1 = col_of(northeast.lon);
+        for (int r = row_of(southwest.lat); r <= row_of(northeast.lat); r++)
+        {
+            count += cell_start[static_cast<size_t>(r) * shape.cols + c1 + 1] - cell_start[static_cast<size_t>(r) * shape.cols + c0];
+        }
+        return count;
+    }
+
+    // Every restaurant in the cells the box overlaps, unchecked and unfiltered (a superset of within_box)
+    void candidates_in_box(LatLon southwest, LatLon northeast, std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        if (shape.rows == 0)
+            return;
+
+        for_each_in_box(southwest.lat, southwest.lon, northeast.lat, northeast.lon, [&](uint32_t i)
+                        { out.push_back(i); });
+    }
+
+    // The k closest restaurants matching the filter, nearest first.
+    // Searches rings of cells outward from the center and stops once no unvisited cell can beat the current k-th result.
+    std::vector<uint32_t> nearest(LatLon center, size_t k, const RestaurantFilter &filter = RestaurantFilter()) const
+    {
+        std::vector<std::pair<double, uint32_t>> best; // max-heap on distance, at most k entries
+        if (shape.rows == 0 || k == 0)
+            return {};
+
+        int center_row = row_of(center.lat);
+        int center_col = col_of(center.lon);
+        int max_ring = std::max(std::max(center_row, shape.rows - 1 - center_row), std::max(center_col, shape.cols - 1 - center_col));
+        for (int ring = 0; ring <= max_ring; ring++)
+        {
+            // Every point in this ring is at least (ring - 1) cells away from the center point
+            double ring_min_distance = (ring - 1) * std::min(shape.cell_height_m, shape.cell_width_m);
+            if (best.size() == k && ring_min_distance > best.front().first)
+                break;
+
+            for (int r = center_row - ring; r <= center_row + ring; r++)
+            {
+                if (r < 0 || r >= shape.rows)
+                    continue;
+                bool edge_row = r == center_row - ring || r == center_row + ring;
+                int step = edge_row ? 1 : 2 * ring; // interior rows only contribute their two edge cells
+                for (int c = center_col - ring; c <= center_col + ring; c += std::max(step, 1))
+                {
+                    if (c < 0 || c >= shape.cols)
+                        continue;
+                    size_t cell = static_cast<size_t>(r) * shape.cols + c;
+                    for (uint32_t e = cell_start[cell]; e < cell_start[cell + 1]; e++)
                     {
-                        std::string status = root.get<std::string>("status");
-                        std::cerr << "API Error: " << status << std::endl;
-                        try
+                        uint32_t i = entries[e];
+                        if (!matches_filter(*store, i, filter))
+                            continue;
+                        double d = distance_meters(center.lat, center.lon, store->lat[i], store->lon[i]);
+                        if (best.size() < k)
                         {
-                            std::string error_msg = root.get<std::string>("error_message");
-                            std::cerr << "Error message: " << error_msg << std::endl;
+                            best.emplace_back(d, i);
+                            std::push_heap(best.begin(), best.end());
                         }
-                        catch (pt::ptree_bad_path &)
+                        else if (d < best.front().first)
                         {
-                            // No error message available
+                            std::pop_heap(best.begin(), best.end());
+                            best.back() = std::make_pair(d, i);
+                            std::push_heap(best.begin(), best.end());
                         }
-                        has_more_results = false; // Stop on error
                     }
                 }
-                catch (pt::json_parser_error &e)
-                {
-                    std::cerr << "JSON parse error: " << e.what() << std::endl;
-                    has_more_results = false; // Stop on error
-                }
-                catch (pt::ptree_error &e)
-                {
-                    std::cerr << "Property tree error: " << e.what() << std::endl;
-                    has_more_results = false; // Stop on error
-                }
             }
+        }
 
-            // Clean up curl for this request
-            curl_easy_cleanup(curl);
+        std::sort_heap(best.begin(), best.end());
+        std::vector<uint32_t> found;
+        found.reserve(best.size());
+        for (const auto &entry : best)
+        {
+            found.push_back(entry.second);
         }
-        else
+        return found;
+    }
+
+private:
+    const Store *store = nullptr;
+    GridShape shape;
+    std::vector<uint32_t> built_cells; // storage behind the spans when the grid was built rather than adopted
+    std::vector<uint32_t> built_entries;
+    std::span<const uint32_t> cell_start; // entries of cell c are entries[cell_start[c] .. cell_start[c + 1])
+    std::span<const uint32_t> entries;
+
+    int row_of(double lat) const { return std::clamp(static_cast<int>((lat - shape.min_lat) / shape.cell_lat), 0, shape.rows - 1); }
+    int col_of(double lon) const { return std::clamp(static_cast<int>((lon - shape.min_lon) / shape.cell_lon), 0, shape.cols - 1); }
+
+    template <typename Visit>
+    void for_each_in_box(double south, double west, double north, double east, Visit visit) const
+    {
+        int r0 = row_of(south), r1 = row_of(north);
+        int c0 = col_of(west), c1 = col_of(east);
+        for (int r = r0; r <= r1; r++)
         {
-            // Failed to initialize curlrestaurant.rating
-            has_more_results = false;
+            size_t first = cell_start[static_cast<size_t>(r) * shape.cols + c0];
+            size_t last = cell_start[static_cast<size_t>(r) * shape.cols + c1 + 1]; // cells in a row are contiguous
+            for (size_t e = first; e < last; e++)
+            {
+                visit(entries[e]);
+            }
         }
     }
+};
 
-    return restaurants;
+typedef GridIndex<RestaurantStore> SpatialIndex;
+
+SpatialIndex restaurantSpatialIndex; // grid over restaurantStore, rebuilt after each load
+
+// Branch-free helpers for the ranking pass: a ?: on computed floats turns into a branch and std::sqrt into a libm
+// call for errno, and either keeps a loop scalar. These are plain arithmetic and bit operations, so the scoring loop
+// below vectorizes (GCC at -O3) and runs without branches either way.
+inline float select_float(bool take_first, float first, float second)
+{
+    uint32_t mask = 0u - static_cast<uint32_t>(take_first);
+    return std::bit_cast<float>((std::bit_cast<uint32_t>(first) & mask) | (std::bit_cast<uint32_t>(second) & ~mask));
 }
 
-// Example main function showing how to use the fetch_nearby_restaurants function
-// NOTE THIS FUNCTION NEEDS TO GET THE INTERSECITON COORDINATES (FROM MOUSE CLICK?) AND add an xy to the latlon to each restaurant; should be handled above tbh
-void generateRestaurantMaps(std::string location, std::string apiKey)
+// sqrt for x >= 0: a bit-level first guess of 1/sqrt(x) refined by three Newton steps (relative error < 1e-6)
+inline float sqrt_fast(float x)
 {
-    // Fetch nearby restaurants
-    int radius;
-    int limit;
-    std::cout << "Enter the radius: " << std::endl;
-    std::cin >> radius;
-    std::cout << "Enter the limit (60 locations max): " << std::endl;
-    s
-            std::cin >>
-        limit;
+    float y = std::bit_cast<float>(0x5f375a86u - (std::bit_cast<uint32_t>(x) >> 1));
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+    return x * y;
+}
 
-    std::vector<restaurant_data> restaurants = fetch_nearby_restaurants(location, radius, limit, apiKey);
+// How much each signal counts in a ranking score. Every signal is scaled to 0..1 first: rating / 5, closeness
+// (1 at the query point falling linearly to 0 at its radius), open and type match as 0 or 1.
+typedef struct RankWeights
+{
+    float rating = 1.0f;
+    float distance = 1.0f;
+    float open = 0.5f;
+    float type = 0.5f;
+} RankWeights;
 
-    // Get detailed information including opening hours for each restaurant
-    for (size_t i = 0; i < restaurants.size(); i++)
+typedef struct RankQuery
+{
+    LatLon center;
+    double radius_m = 2000.0;  // candidates farther away are not ranked
+    size_t k = 10;
+    std::string type;          // preferred google type: adds weights.type, unlike filter.type which excludes
+    int open_at = -1;          // minute of the week the open signal is checked at; -1 uses the stored open_now
+    RankWeights weights;
+    RestaurantFilter filter;   // hard constraints applied before scoring
+} RankQuery;
+
+typedef struct RankedRestaurant
+{
+    uint32_t index;
+    float score;
+    float distance_m;
+} RankedRestaurant;
+
+// Candidate columns for one ranking pass, kept per thread so a warm query allocates nothing but its result
+typedef struct RankScratch
+{
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> identity; // 0, 1, 2, ...: the candidates when the whole store is scanned
+    std::vector<float> lat;
+    std::vector<float> lon;
+    std::vector<float> rating;
+    std::vector<float> bonus; // weighted open and type signals; -1e30 for candidates the filter rejects
+    std::vector<float> score;
+    std::vector<float> distance;
+    std::vector<std::pair<float, uint32_t>> heap;
+} RankScratch;
+
+// Scores n candidates held in contiguous arrays. Distances are planar around the midpoint latitude (within 0.5 m of
+// the haversine distance up to the daemon's 20 km radius), and candidates outside the radius get a score no real
+// candidate can reach. GCC only vectorizes at -O2 when asked (other compilers ignore the attribute).
+[[gnu::optimize("tree-vectorize")]] void score_candidates(const float *__restrict lat, const float *__restrict lon, const float *__restrict rating, const float *__restrict bonus,
+                      size_t n, const RankQuery &query, float *__restrict score, float *__restrict distance)
+{
+    const float meters_per_degree = static_cast<float>(kEarthRadiusMeters * kDegToRad);
+    const float half_radians_per_degree = static_cast<float>(0.5 * kDegToRad);
+    const float center_lat = query.center.lat;
+    const float center_lon = query.center.lon;
+    const float center_cos = static_cast<float>(std::cos(query.center.lat * kDegToRad));
+    const float center_sin = static_cast<float>(std::sin(query.center.lat * kDegToRad));
+    const float radius = static_cast<float>(query.radius_m);
+    const float inverse_radius = 1.0f / radius;
+    const float rating_weight = query.weights.rating / 5.0f;
+    const float distance_weight = query.weights.distance;
+    for (size_t i = 0; i < n; i++)
     {
-        // Fetch additional details including opening hourswe actually need this to finish building the structs; im assuming that the structs are biult because the print_restaurant_info gives us smthin
-        fetch_place_details(restaurants[i], apiKey);
-        // Print information about the restaurant - DEBUGGING
-        // print_restaurant_info(restaurants[i], i);
+        float dlat = lat[i] - center_lat;
+        float half = dlat * half_radians_per_degree;
+        float mid_cos = center_cos * (1.0f - 0.5f * half * half) - center_sin * half; // cos(center + half), to second order
+        float north = dlat * meters_per_degree;
+        float east = (lon[i] - center_lon) * meters_per_degree * mid_cos;
+        float d = sqrt_fast(north * north + east * east);
+        float closeness = 1.0f - d * inverse_radius;
+        closeness = select_float(closeness > 0.0f, closeness, 0.0f);
+        distance[i] = d;
+        score[i] = select_float(d <= radius, rating_weight * rating[i] + distance_weight * closeness + bonus[i], -1e30f);
     }
+}
 
-    // this populates our map so it can be used elsewhere
-    for (size_t RestaurantIt = 0; RestaurantIt < restaurants.size(); RestaurantIt++)
+// The query.k best restaurants within query.radius_m of query.center, best first (ties go to the lower index).
+// When the radius reaches most of the grid the store's own columns are scored as they are; otherwise the grid cells
+// around the center are gathered into contiguous scratch columns first. Either way the scoring is one branch-free pass
+// and the best are kept in a k-entry min-heap, so a query costs a linear scan plus log k for each candidate that
+// beats the current k-th score.
+template <typename Store>
+std::vector<RankedRestaurant> rank_restaurants(const Store &store, const GridIndex<Store> &grid, const RankQuery &query)
+{
+    thread_local RankScratch scratch;
+    std::vector<RankedRestaurant> ranked;
+    if (query.k == 0 || query.radius_m <= 0.0 || store.size() == 0)
     {
-        const restaurant_data &restaurant = restaurants[RestaurantIt];
+        return ranked;
+    }
+
+    double dlat = query.radius_m / (kEarthRadiusMeters * kDegToRad);
+    double dlon = dlat / std::max(0.01, std::cos(query.center.lat * kDegToRad));
+    LatLon southwest(static_cast<float>(query.center.lat - dlat), static_cast<float>(query.center.lon - dlon));
+    LatLon northeast(static_cast<float>(query.center.lat + dlat), static_cast<float>(query.center.lon + dlon));
+    bool whole_store = grid.count_in_box(southwest, northeast) * 2 > store.size(); // gathering would cost more than scanning the rest
+    if (whole_store && scratch.identity.size() < store.size())
+    {
+        size_t known = scratch.identity.size();
+        scratch.identity.resize(store.size());
+        std::iota(scratch.identity.begin() + known, scratch.identity.end(), static_cast<uint32_t>(known));
+    }
+    else if (!whole_store)
+    {
+        grid.candidates_in_box(southwest, northeast, scratch.candidates);
+    }
+    const uint32_t *candidates = whole_store ? scratch.identity.data() : scratch.candidates.data();
+    size_t n = whole_store ? store.size() : scratch.candidates.size();
+    scratch.bonus.resize(n);
+    scratch.score.resize(n);
+    scratch.distance.resize(n);
+
+    const float *lat = &store.lat[0];
+    const float *lon = &store.lon[0];
+    const float *rating = &store.rating[0];
+    if (!whole_store)
+    {
+        scratch.lat.resize(n);
+        scratch.lon.resize(n);
+        scratch.rating.resize(n);
+        for (size_t c = 0; c < n; c++)
+        {
+            uint32_t index = candidates[c];
+            scratch.lat[c] = store.lat[index];
+            scratch.lon[c] = store.lon[index];
+            scratch.rating[c] = store.rating[index];
+        }
+        lat = scratch.lat.data();
+        lon = scratch.lon.data();
+        rating = scratch.rating.data();
+    }
+
+    const RestaurantFilter &filter = query.filter;
+    bool constrained = constrains(filter);
+    int type_id = query.type.empty() ? -1 : placeTypes.find(query.type);
+    bool by_hours = query.open_at >= 0;
+    bool type_bit = type_id >= 0 && type_id < kTypeBits;
+    float *bonus = scratch.bonus.data();
+    for (size_t c = 0; c < n; c++)
+    {
+        uint32_t index = candidates[c];
+        bool open = by_hours ? store.is_open_at(index, query.open_at) : (store.flags[index] & FLAG_OPEN_NOW) != 0;
+        bool type_match = type_bit ? store.types[index][type_id] : type_id >= kTypeBits && store.has_type(index, type_id);
+        bonus[c] = query.weights.open * static_cast<float>(open) + query.weights.type * static_cast<float>(type_match);
+    }
+    if (constrained)
+    {
+        for (size_t c = 0; c < n; c++)
+            bonus[c] = select_float(matches_filter(store, candidates[c], filter), bonus[c], -1e30f);
+    }
+    score_candidates(lat, lon, rating, scratch.bonus.data(), n, query, scratch.score.data(), scratch.distance.data());
+
+    // Min-heap of the best k so far by (score, lower index); its front is the candidate to beat
+    auto better = [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b)
+    { return a.first > b.first || (a.first == b.first && a.second < b.second); };
+    std::vector<std::pair<float, uint32_t>> &heap = scratch.heap;
+    heap.clear();
+    const float *score = scratch.score.data();
+    float threshold = -1e29f; // below this a candidate cannot enter the heap
+    for (size_t c = 0; c < n; c++)
+    {
+        if (score[c] < threshold)
+            continue;
+        std::pair<float, uint32_t> entry(score[c], candidates[c]);
+        if (heap.size() < query.k)
+        {
+            heap.push_back(entry);
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (better(entry, heap.front()))
+        {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = entry;
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+        if (heap.size() == query.k)
+            threshold = heap.front().first;
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    ranked.reserve(heap.size());
+    for (const auto &entry : heap)
+    {
+        uint32_t index = entry.second;
+        float d = distance_meters(query.center.lat, query.center.lon, store.lat[index], store.lon[index]);
+        ranked.push_back(RankedRestaurant{index, entry.first, d});
+    }
+    return ranked;
+}
+
+// Folds text for matching: ASCII is lowercased, Latin accents are dropped (é -> e, ß -> ss, œ -> oe), apostrophes
+// vanish so "joe's" matches "joes", and anything else that is neither a letter nor a digit separates words by a single
+// space. Other non-ASCII characters are kept byte for byte.
+void fold_text(std::string_view text, std::string &out)
+{
+    // U+00C0..U+00FF (UTF-8 C3 80..BF) without accents; the empty entries are the multiplication and division signs
+    static const char *const kLatin1[64] = {"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+                                            "d", "n", "o", "o", "o", "o", "o", "", "o", "u", "u", "u", "u", "y", "th", "ss",
+                                            "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+                                            "d", "n", "o", "o", "o", "o", "o", "", "o", "u", "u", "u", "u", "y", "th", "y"};
+    out.clear();
+    bool separated = false;
+    auto put = [&](std::string_view piece)
+    {
+        if (separated && !out.empty())
+            out.push_back(' ');
+        separated = false;
+        out.append(piece);
+    };
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        unsigned char next = i + 1 < text.size() ? static_cast<unsigned char>(text[i + 1]) : 0;
+        if (c < 0x80)
+        {
+            char lower = static_cast<char>(std::tolower(c));
+            if (std::isalnum(c))
+                put(std::string_view(&lower, 1));
+            else if (c != '\'')
+                separated = true;
+        }
+        else if (c == 0xC3 && next >= 0x80 && next <= 0xBF)
+        {
+            const char *plain = kLatin1[next - 0x80];
+            if (*plain)
+                put(plain);
+            else
+                separated = true;
+            i++;
+        }
+        else if (c == 0xC5 && (next == 0x92 || next == 0x93 || next == 0x81 || next == 0x82 || (next >= 0xA0 && next <= 0xA1) || (next >= 0xBD && next <= 0xBE)))
+        {
+            put(next >= 0xBD ? "z" : next >= 0xA0 ? "s" : next >= 0x92 ? "oe" : "l"); // ž, š, œ, ł
+            i++;
+        }
+        else if (c == 0xE2 && next == 0x80 && i + 2 < text.size())
+        {
+            unsigned char last = static_cast<unsigned char>(text[i + 2]);
+            separated = separated || (last != 0x98 && last != 0x99); // typographic apostrophes vanish, dashes and quotes separate
+            i += 2;
+        }
+        else
+        {
+            put(std::string_view(text.data() + i, 1));
+        }
+    }
+}
+
+// How loosely a folded query word matched, best first
+enum MatchKind
+{
+    MATCH_PREFIX,    // starts a word
+    MATCH_SUBSTRING, // occurs anywhere (words of 3+ characters)
+    MATCH_TYPO,      // within a typo or two of a word start (words of 4+ characters)
+    kMatchKinds
+};
+
+const char *const kMatchKindNames[] = {"prefix", "substring", "typo"};
+
+// Typos a query word may carry: none below 4 characters, 2 from 8 on
+int allowed_typos(size_t word_length)
+{
+    return word_length < 4 ? 0 : word_length < 8 ? 1 : 2;
+}
+
+// Fewest edits (insert, delete, substitute, swap neighbours) that turn word into a prefix of term, or limit + 1 once
+// it is certain to exceed limit
+int prefix_edit_distance(std::string_view word, std::string_view term, int limit)
+{
+    const size_t kMaxWord = 32;
+    size_t m = word.size();
+    if (m > kMaxWord)
+    {
+        return limit + 1;
+    }
+    int before[kMaxWord + 1], previous[kMaxWord + 1], current[kMaxWord + 1]; // rows j - 2, j - 1 and j of the table
+    for (size_t i = 0; i <= m; i++)
+    {
+        previous[i] = static_cast<int>(i);
+    }
+    int best = previous[m];
+    size_t columns = std::min(term.size(), m + limit);
+    for (size_t j = 1; j <= columns; j++)
+    {
+        current[0] = static_cast<int>(j);
+        int row_min = current[0];
+        for (size_t i = 1; i <= m; i++)
+        {
+            int edit = std::min(std::min(previous[i], current[i - 1]) + 1, previous[i - 1] + (word[i - 1] != term[j - 1]));
+            if (i > 1 && j > 1 && word[i - 1] == term[j - 2] && word[i - 2] == term[j - 1])
+                edit = std::min(edit, before[i - 2] + 1);
+            current[i] = edit;
+            row_min = std::min(row_min, edit);
+        }
+        best = std::min(best, current[m]);
+        if (row_min > limit)
+            break;
+        std::copy(previous, previous + m + 1, before);
+        std::copy(current, current + m + 1, previous);
+    }
+    return std::min(best, limit + 1);
+}
+
+// How a folded word matches a folded field (see MatchKind), kMatchKinds for not at all. This is the definition the
+// text index implements with its postings.
+int match_in_field(std::string_view field, std::string_view word, bool typos)
+{
+    int found = kMatchKinds;
+    int limit = typos ? allowed_typos(word.size()) : 0;
+    for (size_t start = 0; start < field.size() && found > MATCH_PREFIX;)
+    {
+        size_t end = std::min(field.find(' ', start), field.size());
+        std::string_view term = field.substr(start, end - start);
+        if (term.starts_with(word))
+            found = MATCH_PREFIX;
+        else if (limit > 0 && prefix_edit_distance(word, term, limit) <= limit)
+            found = std::min<int>(found, MATCH_TYPO);
+        start = end + 1;
+    }
+    if (found > MATCH_SUBSTRING && word.size() >= 3 && field.find(word) != std::string_view::npos)
+    {
+        found = MATCH_SUBSTRING;
+    }
+    return found;
+}
+
+inline uint32_t trigram_key(const char *text)
+{
+    return static_cast<uint32_t>(static_cast<uint8_t>(text[0])) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(text[1])) << 8 |
+           static_cast<uint8_t>(text[2]);
+}
+
+typedef struct TextQuery
+{
+    std::string text;        // every word must match the name or the address; the last one is usually unfinished
+    size_t limit = 10;
+    bool typos = true;       // fall back to near matches while exact ones are fewer than limit
+    RestaurantFilter filter;
+    LatLon center;           // with radius_m > 0, only places within radius_m of center
+    double radius_m = 0.0;
+} TextQuery;
+
+typedef struct TextHit
+{
+    uint32_t index;
+    uint8_t match;  // MatchKind of the loosest word
+    bool in_name;   // every word matched in the name
+} TextHit;
+
+// Name and address search over the store. Both are folded (fold_text) and indexed twice: every word in an ordered
+// dictionary whose ranges answer prefix queries, and every trigram of each field with the places containing it, for
+// substring queries. Typos are found through the trigrams of the dictionary words. Every posting list is kept in rank
+// order (rating, then index), so a query walks the best candidates first and stops as soon as none of the rest can
+// make its results. Places are added or re-indexed incrementally: a changed place's postings are removed and merged
+// back in at its new text and rating.
+typedef struct RestaurantTextIndex
+{
+    RestaurantTextIndex() {}
+    RestaurantTextIndex(const RestaurantTextIndex &) = delete;
+    RestaurantTextIndex &operator=(const RestaurantTextIndex &) = delete;
+
+    // Indexes store[first, end), read under a shared lock on store_mutex (if given)
+    template <typename Store>
+    void index_range(const Store &store, uint32_t first, uint32_t end, std::shared_mutex *store_mutex = nullptr)
+    {
+        std::vector<uint32_t> indices(end - first);
+        std::iota(indices.begin(), indices.end(), first);
+        update(store, indices, store_mutex);
+    }
+
+    // Indexes the given places again, e.g. after a refresh replaced their records; unchanged ones are skipped
+    template <typename Store>
+    void update(const Store &store, std::vector<uint32_t> indices, std::shared_mutex *store_mutex = nullptr)
+    {
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+        // Folding reads the store and needs no lock of ours; only the merge does
+        std::vector<std::tuple<uint32_t, std::string, float>> batch;
+        {
+            std::shared_lock<std::shared_mutex> lock;
+            if (store_mutex)
+            {
+                lock = std::shared_lock<std::shared_mutex>(*store_mutex);
+            }
+            std::string name, address;
+            for (uint32_t index : indices)
+            {
+                decltype(auto) restaurant = store[index];
+                fold_text(restaurant.name, name);
+                fold_text(restaurant.address, address);
+                batch.emplace_back(index, name + '\n' + address, store.rating[index]);
+            }
+        }
+        std::lock_guard<std::shared_mutex> lock(mutex);
+        for (auto &[index, text, rating] : batch)
+        {
+            if (index >= folded.size() || folded[index].empty())
+                insert(index, std::move(text), rating);
+            else if (rating_at[index] != rating)
+            {
+                remove(index); // every list holding it is ordered by its old rating
+                insert(index, std::move(text), rating);
+            }
+            else if (folded[index] != text)
+                replace(index, std::move(text));
+        }
+        merge_pending();
+    }
+
+    // Rebuilds the index over the whole store
+    template <typename Store>
+    void rebuild(const Store &store)
+    {
+        clear();
+        index_range(store, 0, static_cast<uint32_t>(store.size()));
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::shared_mutex> lock(mutex);
+        folded.clear();
+        rating_at.clear();
+        term_ids.clear();
+        term_text.clear();
+        name_postings.clear();
+        address_postings.clear();
+        term_grams.clear();
+        name_grams.clear();
+        address_grams.clear();
+    }
+
+    size_t terms() const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return term_text.size();
+    }
+
+    // The best query.limit places matching every word of query.text and the filters: prefix matches first, then
+    // substring and typo matches while there are too few, each ranked by whether they matched in the name, then rating.
+    // The store must be the one indexed and locked against writers by the caller.
+    template <typename Store>
+    size_t search(const Store &store, const TextQuery &query, std::vector<TextHit> &out) const
+    {
+        thread_local Scratch scratch;
+        out.clear();
+        std::string text;
+        fold_text(query.text, text);
+        std::vector<std::string_view> words;
+        for (size_t start = 0; start < text.size() && words.size() < 16;)
+        {
+            size_t end = std::min(text.find(' ', start), text.size());
+            words.push_back(std::string_view(text).substr(start, end - start));
+            start = end + 1;
+        }
+        if (words.empty() || query.limit == 0)
+        {
+            return 0;
+        }
+
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        scratch.reset(folded.size(), term_text.size());
+        bool constrained = constrains(query.filter);
+        int loosest = query.typos ? MATCH_TYPO : MATCH_SUBSTRING;
+        auto better = [&](const TextHit &a, const TextHit &b)
+        { return a.in_name != b.in_name ? a.in_name : ranks_before(a.index, b.index); };
+        for (int match = MATCH_PREFIX; match <= loosest && out.size() < query.limit; match++)
+        {
+            // The most selective word supplies the candidates, best ranked first; every word is then checked against
+            // each candidate's text. Candidates whose word is in the name come first, since only they can rank by it.
+            std::vector<size_t> postings(words.size());
+            size_t driver = 0;
+            for (size_t w = 0; w < words.size(); w++)
+            {
+                postings[w] = estimate(words[w], match);
+                driver = postings[w] < postings[driver] ? w : driver;
+            }
+            scratch.pass++;
+
+            // Words with postings not much longer than the driver's are stamped first, so most candidates missing one
+            // of them are dropped without looking at their text
+            uint32_t stamped = 0;
+            for (size_t w = 0; w < words.size(); w++)
+            {
+                if (w == driver || postings[w] > 8 * postings[driver])
+                    continue;
+                gather(words[w], match, scratch);
+                for (const auto &lists : scratch.lists)
+                {
+                    for (const std::vector<uint32_t> *list : lists)
+                    {
+                        for (uint32_t index : *list)
+                        {
+                            if (stamped == 0)
+                            {
+                                scratch.found[index] = scratch.pass;
+                                scratch.found_count[index] = 1;
+                            }
+                            else if (scratch.found[index] == scratch.pass && scratch.found_count[index] == stamped)
+                                scratch.found_count[index]++;
+                        }
+                    }
+                }
+                stamped++;
+            }
+            gather(words[driver], match, scratch);
+
+            // Best (limit - found) kept in a heap whose front is the one to beat
+            size_t wanted = query.limit - out.size();
+            std::vector<TextHit> &best = scratch.hits;
+            best.clear();
+            bool done = false;
+            for (int phase = 0; phase < 2 && !done; phase++)
+            {
+                std::vector<Cursor> &cursors = scratch.cursors;
+                cursors.clear();
+                for (const std::vector<uint32_t> *list : scratch.lists[phase])
+                {
+                    if (!list->empty())
+                        cursors.push_back(Cursor{list->data(), list->data() + list->size()});
+                }
+                // Heap of the lists' heads, best ranked on top
+                auto later = [&](const Cursor &a, const Cursor &b) { return ranks_before(*b.at, *a.at); };
+                std::make_heap(cursors.begin(), cursors.end(), later);
+                while (!cursors.empty())
+                {
+                    std::pop_heap(cursors.begin(), cursors.end(), later);
+                    uint32_t index = *cursors.back().at++;
+                    if (cursors.back().at == cursors.back().end)
+                        cursors.pop_back();
+                    else
+                        std::push_heap(cursors.begin(), cursors.end(), later);
+
+                    if (scratch.seen[index] == scratch.pass)
+                        continue;
+                    scratch.seen[index] = scratch.pass;
+                    if (best.size() == wanted && !better(TextHit{index, static_cast<uint8_t>(match), phase == 0}, best.front()))
+                    {
+                        done = true; // no later candidate can do better either
+                        break;
+                    }
+                    if (scratch.taken[index] == scratch.query || index >= store.size())
+                        continue;
+                    if (stamped > 0 && (scratch.found[index] != scratch.pass || scratch.found_count[index] != stamped))
+                        continue;
+                    if (constrained && !matches_filter(store, index, query.filter))
+                        continue;
+                    if (query.radius_m > 0.0 && distance_meters(query.center.lat, query.center.lon, store.lat[index], store.lon[index]) > query.radius_m)
+                        continue;
+                    TextHit hit{index, static_cast<uint8_t>(match), false};
+                    if (!matches(index, words, hit) || (best.size() == wanted && !better(hit, best.front())))
+                        continue;
+                    scratch.taken[index] = scratch.query;
+                    if (best.size() == wanted)
+                    {
+                        std::pop_heap(best.begin(), best.end(), better);
+                        best.pop_back();
+                    }
+                    best.push_back(hit);
+                    std::push_heap(best.begin(), best.end(), better);
+                }
+            }
+            std::sort_heap(best.begin(), best.end(), better);
+            out.insert(out.end(), best.begin(), best.end());
+        }
+        return out.size();
+    }
+
+private:
+    typedef struct Cursor
+    {
+        const uint32_t *at;
+        const uint32_t *end;
+    } Cursor;
+
+    // Per-thread state for one search, stamped so nothing is cleared between passes
+    typedef struct Scratch
+    {
+        std::vector<uint32_t> seen;        // by store index: pass that last saw it
+        std::vector<uint32_t> found;       // ... that stamped it with a word's postings
+        std::vector<uint32_t> found_count; // ... and how many of the stamped words it has
+        std::vector<uint32_t> taken;       // by store index: query it was already returned for
+        std::vector<uint32_t> term_stamp;  // by term id: typo lookup that last counted it
+        std::vector<uint32_t> term_count;  // ... and the word's trigrams it shares
+        std::vector<const std::vector<uint32_t> *> lists[2]; // candidate lists: word possibly in the name, in the address only
+        std::vector<Cursor> cursors;
+        std::vector<TextHit> hits;
+        uint32_t pass = 0;
+        uint32_t query = 0;
+        uint32_t lookup = 0;
+
+        void reset(size_t records, size_t terms)
+        {
+            if (pass > UINT32_MAX - 64 || lookup > UINT32_MAX - 64)
+            {
+                std::fill(seen.begin(), seen.end(), 0);
+                std::fill(found.begin(), found.end(), 0);
+                std::fill(term_stamp.begin(), term_stamp.end(), 0);
+                std::fill(taken.begin(), taken.end(), 0);
+                pass = 0;
+                query = 0;
+                lookup = 0;
+            }
+            seen.resize(records, 0);
+            found.resize(records, 0);
+            found_count.resize(records);
+            taken.resize(records, 0);
+            term_stamp.resize(terms, 0);
+            term_count.resize(terms);
+            query++;
+        }
+    } Scratch;
+
+    static inline const std::vector<uint32_t> kNoPostings;
+    mutable std::shared_mutex mutex;
+    std::vector<std::string> folded; // by store index: folded name, '\n', folded address; empty if never indexed
+    std::vector<float> rating_at;    // by store index: rating when indexed, which orders every posting list
+    std::map<std::string, uint32_t, std::less<>> term_ids; // every word of every field, ordered for prefix ranges
+    std::vector<const std::string *> term_text;             // by term id: its key in term_ids
+    std::deque<std::vector<uint32_t>> name_postings;        // by term id: places with the word in their name
+    std::deque<std::vector<uint32_t>> address_postings;     // ... in their address
+    std::unordered_map<uint32_t, std::vector<uint32_t>> term_grams;   // trigram of " " + term -> term ids, ascending
+    std::unordered_map<uint32_t, std::vector<uint32_t>> name_grams;    // trigram of a name -> places
+    std::unordered_map<uint32_t, std::vector<uint32_t>> address_grams; // ... of an address
+    std::unordered_map<std::vector<uint32_t> *, std::vector<uint32_t>> pending; // postings added by an update, merged at its end
+
+    // Rank order of the posting lists: higher rating first, then lower index
+    bool ranks_before(uint32_t a, uint32_t b) const
+    {
+        return rating_at[a] != rating_at[b] ? rating_at[a] > rating_at[b] : a < b;
+    }
+
+    uint32_t term_id(std::string_view term)
+    {
+        auto found = term_ids.find(term);
+        if (found != term_ids.end())
+        {
+            return found->second;
+        }
+        uint32_t id = static_cast<uint32_t>(term_text.size());
+        auto added = term_ids.emplace(std::string(term), id).first;
+        term_text.push_back(&added->first);
+        name_postings.emplace_back();
+        address_postings.emplace_back();
+        std::string padded = " " + added->first;
+        for (size_t g = 0; g + 3 <= padded.size(); g++)
+        {
+            std::vector<uint32_t> &terms = term_grams[trigram_key(padded.data() + g)];
+            if (terms.empty() || terms.back() != id)
+                terms.push_back(id);
+        }
+        return id;
+    }
+
+    // Calls visit with every posting list a folded text belongs in; its words must be in the dictionary unless add
+    template <typename Visit>
+    void for_each_list(std::string_view fields, bool add, Visit &&visit)
+    {
+        size_t split = fields.find('\n');
+        for (int in_name = 1; in_name >= 0; in_name--)
+        {
+            std::string_view field = in_name ? fields.substr(0, split) : fields.substr(split + 1);
+            for (size_t start = 0; start < field.size();)
+            {
+                size_t end = std::min(field.find(' ', start), field.size());
+                std::string_view term = field.substr(start, end - start);
+                uint32_t id = add ? term_id(term) : term_ids.find(term)->second;
+                visit((in_name ? name_postings : address_postings)[id]);
+                start = end + 1;
+            }
+            for (size_t g = 0; g + 3 <= field.size(); g++)
+            {
+                visit((in_name ? name_grams : address_grams)[trigram_key(field.data() + g)]);
+            }
+        }
+    }
+
+    void remove(uint32_t index)
+    {
+        auto by_rank = [this](uint32_t a, uint32_t b) { return ranks_before(a, b); };
+        for_each_list(folded[index], false, [&](std::vector<uint32_t> &list)
+                      {
+            auto found = std::equal_range(list.begin(), list.end(), index, by_rank);
+            list.erase(found.first, found.second); });
+        folded[index].clear();
+    }
+
+    // New text at the same rating: only the lists the place leaves or joins change, so a renamed place keeps its
+    // address postings untouched
+    void replace(uint32_t index, std::string &&text)
+    {
+        std::vector<std::vector<uint32_t> *> left, joined;
+        for_each_list(folded[index], false, [&](std::vector<uint32_t> &list) { left.push_back(&list); });
+        folded[index] = std::move(text);
+        for_each_list(folded[index], true, [&](std::vector<uint32_t> &list) { joined.push_back(&list); });
+        std::sort(left.begin(), left.end());
+        left.erase(std::unique(left.begin(), left.end()), left.end());
+        std::sort(joined.begin(), joined.end());
+        joined.erase(std::unique(joined.begin(), joined.end()), joined.end());
+        auto by_rank = [this](uint32_t a, uint32_t b) { return ranks_before(a, b); };
+        size_t j = 0;
+        for (std::vector<uint32_t> *list : left)
+        {
+            while (j < joined.size() && joined[j] < list)
+                pending[joined[j++]].push_back(index);
+            if (j < joined.size() && joined[j] == list)
+            {
+                j++;
+                continue;
+            }
+            auto found = std::equal_range(list->begin(), list->end(), index, by_rank);
+            list->erase(found.first, found.second);
+        }
+        for (; j < joined.size(); j++)
+        {
+            pending[joined[j]].push_back(index);
+        }
+    }
+
+    void insert(uint32_t index, std::string &&text, float rating)
+    {
+        if (index >= folded.size())
+        {
+            folded.resize(index + 1);
+            rating_at.resize(index + 1);
+        }
+        folded[index] = std::move(text);
+        rating_at[index] = rating;
+        for_each_list(folded[index], true, [&](std::vector<uint32_t> &list) { pending[&list].push_back(index); });
+    }
+
+    // Sorts each list's new postings into rank order and merges them in: one pass per list however many arrived
+    void merge_pending()
+    {
+        auto by_rank = [this](uint32_t a, uint32_t b) { return ranks_before(a, b); };
+        for (auto &[list, added] : pending)
+        {
+            std::sort(added.begin(), added.end(), by_rank);
+            added.erase(std::unique(added.begin(), added.end()), added.end()); // a trigram repeated in one field
+            size_t middle = list->size();
+            list->insert(list->end(), added.begin(), added.end());
+            std::inplace_merge(list->begin(), list->begin() + static_cast<std::ptrdiff_t>(middle), list->end(), by_rank);
+        }
+        pending.clear();
+    }
+
+    // The shortest posting list among the trigrams of word (3+ characters)
+    static const std::vector<uint32_t> *rarest_gram(const std::unordered_map<uint32_t, std::vector<uint32_t>> &grams, std::string_view word)
+    {
+        const std::vector<uint32_t> *rarest = nullptr;
+        for (size_t g = 0; g + 3 <= word.size(); g++)
+        {
+            auto found = grams.find(trigram_key(word.data() + g));
+            if (found == grams.end())
+                return &kNoPostings;
+            if (!rarest || found->second.size() < rarest->size())
+                rarest = &found->second;
+        }
+        return rarest;
+    }
+
+    // Fills scratch.lists with the posting lists holding every place word matches at the given looseness (or any
+    // stricter one): lists of names in scratch.lists[0], of addresses in scratch.lists[1]. Substring lists hold a
+    // superset.
+    void gather(std::string_view word, int match, Scratch &scratch) const
+    {
+        scratch.lists[0].clear();
+        scratch.lists[1].clear();
+        int typos = allowed_typos(word.size());
+        if (match >= MATCH_SUBSTRING && word.size() >= 3)
+        {
+            // The places holding the word's rarest trigram in each field, which covers its prefix matches as well;
+            // the few that hold that trigram but not the word fail the text check
+            scratch.lists[0].push_back(rarest_gram(name_grams, word));
+            scratch.lists[1].push_back(rarest_gram(address_grams, word));
+        }
+        else
+        {
+            for (auto term = term_ids.lower_bound(word); term != term_ids.end() && term->first.starts_with(word); ++term)
+            {
+                scratch.lists[0].push_back(&name_postings[term->second]);
+                scratch.lists[1].push_back(&address_postings[term->second]);
+            }
+        }
+
+        if (match >= MATCH_TYPO && typos > 0)
+        {
+            // A word within k edits of a term's start shares all but 4k of its distinct trigrams with it (a swap of
+            // neighbours touches 4); terms sharing fewer are skipped without computing the distance
+            std::string padded = " " + std::string(word);
+            std::vector<uint32_t> grams;
+            for (size_t g = 0; g + 3 <= padded.size(); g++)
+            {
+                grams.push_back(trigram_key(padded.data() + g));
+            }
+            std::sort(grams.begin(), grams.end());
+            grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+            uint32_t needed = static_cast<uint32_t>(std::max<int>(1, static_cast<int>(grams.size()) - 4 * typos));
+            scratch.lookup++;
+            for (uint32_t gram : grams)
+            {
+                auto found = term_grams.find(gram);
+                if (found == term_grams.end())
+                    continue;
+                for (uint32_t term : found->second)
+                {
+                    if (scratch.term_stamp[term] != scratch.lookup)
+                    {
+                        scratch.term_stamp[term] = scratch.lookup;
+                        scratch.term_count[term] = 0;
+                    }
+                    if (++scratch.term_count[term] != needed || prefix_edit_distance(word, *term_text[term], typos) > typos)
+                        continue;
+                    scratch.lists[0].push_back(&name_postings[term]);
+                    scratch.lists[1].push_back(&address_postings[term]);
+                }
+            }
+        }
+    }
+
+    // Whether every word matches the place's text at hit.match or stricter, recording if all of them did so in the name
+    bool matches(uint32_t index, const std::vector<std::string_view> &words, TextHit &hit) const
+    {
+        std::string_view fields(folded[index]);
+        size_t split = fields.find('\n');
+        bool typos = hit.match >= MATCH_TYPO;
+        hit.in_name = true;
+        for (std::string_view word : words)
+        {
+            int name_match = match_in_field(fields.substr(0, split), word, typos);
+            if (name_match > hit.match && match_in_field(fields.substr(split + 1), word, typos) > hit.match)
+                return false;
+            hit.in_name = hit.in_name && name_match <= hit.match;
+        }
+        return true;
+    }
+
+    // Upper bound on the places a word can match at a looseness, for picking the word to start from
+    size_t estimate(std::string_view word, int match) const
+    {
+        size_t postings = 0;
+        if (match >= MATCH_SUBSTRING && word.size() >= 3)
+        {
+            postings = rarest_gram(name_grams, word)->size() + rarest_gram(address_grams, word)->size();
+        }
+        else
+        {
+            for (auto term = term_ids.lower_bound(word); term != term_ids.end() && term->first.starts_with(word); ++term)
+            {
+                postings += name_postings[term->second].size() + address_postings[term->second].size();
+            }
+        }
+        if (match >= MATCH_TYPO && allowed_typos(word.size()) > 0)
+        {
+            postings += folded.size(); // unknown until the near terms are found, so typo words go last
+        }
+        return postings;
+    }
+} RestaurantTextIndex;
+
+RestaurantTextIndex restaurantText; // name and address search over restaurantStore
+
+// fetch api key
+std::string getAPIKey(const std::string &filename)
+{
+    std::ifstream file(filename);
+    std::string line;
+
+    if (file.is_open())
+    {
+        while (getline(file, line))
+        {
+            if (line.find("API_KEY=") == 0)
+            {
+                return line.substr(8); // Extract key after "API_KEY="
+            }
+        }
+        file.close();
+    }
+    return "";
+}
+static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *s)
+{
+    // use a string instead of c_style; doesnt require allocation when appending data and directly works with boost JSON stringstream parsing
+    size_t newLength = size * nmemb;
+    try
+    {
+        s->append((char *)contents, newLength);
+        return newLength;
+    }
+    catch (std::bad_alloc &e)
+    {
+        return 0;
+    }
+}
+
+// ---- Pipeline metrics ----
+// Every Places request and every processing stage is timed into fixed-bucket histograms. Recording is a bucket search
+// over a short table and two relaxed atomic increments, so the instrumentation stays on in production.
+
+// Upper bounds of the latency buckets in microseconds (the last, implicit bucket is +Inf)
+const int64_t kLatencyBucketsUs[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                     100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+const size_t kLatencyBucketCount = sizeof(kLatencyBucketsUs) / sizeof(kLatencyBucketsUs[0]) + 1;
+
+// Lock-free latency histogram; safe to record from any thread while another one exports it
+typedef struct LatencyHistogram
+{
+    std::atomic<uint64_t> counts[kLatencyBucketCount] = {};
+    std::atomic<uint64_t> sum_us{0};
+
+    void record_us(int64_t us)
+    {
+        us = std::max<int64_t>(us, 0);
+        size_t bucket = std::lower_bound(std::begin(kLatencyBucketsUs), std::end(kLatencyBucketsUs), us) - std::begin(kLatencyBucketsUs);
+        counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(static_cast<uint64_t>(us), std::memory_order_relaxed);
+    }
+
+    void record_since(std::chrono::steady_clock::time_point start)
+    {
+        record_us(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (const std::atomic<uint64_t> &bucket : counts)
+        {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Estimate of quantile q in microseconds, interpolated inside the bucket it falls in
+    double quantile_us(double q) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+        {
+            return 0.0;
+        }
+        double rank = q * static_cast<double>(total);
+        uint64_t below = 0;
+        for (size_t b = 0; b < kLatencyBucketCount; b++)
+        {
+            uint64_t in_bucket = counts[b].load(std::memory_order_relaxed);
+            if (in_bucket > 0 && static_cast<double>(below + in_bucket) >= rank)
+            {
+                double low = b == 0 ? 0.0 : static_cast<double>(kLatencyBucketsUs[b - 1]);
+                if (b == kLatencyBucketCount - 1)
+                {
+                    return low; // +Inf bucket: all we know is the lower bound
+                }
+                double high = static_cast<double>(kLatencyBucketsUs[b]);
+                return low + (high - low) * (rank - static_cast<double>(below)) / static_cast<double>(in_bucket);
+            }
+            below += in_bucket;
+        }
+        return static_cast<double>(kLatencyBucketsUs[kLatencyBucketCount - 2]);
+    }
+
+    // Prometheus text format: cumulative _bucket series in seconds, then _sum and _count
+    void write_prometheus(std::ostream &out, const std::string &name, const std::string &labels) const
+    {
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < kLatencyBucketCount; b++)
+        {
+            cumulative += counts[b].load(std::memory_order_relaxed);
+            out << name << "_bucket{" << prefix << "le=\"";
+            if (b < kLatencyBucketCount - 1)
+                out << static_cast<double>(kLatencyBucketsUs[b]) / 1e6;
+            else
+                out << "+Inf";
+            out << "\"} " << cumulative << "\n";
+        }
+        std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        out << name << "_sum" << braces << " " << static_cast<double>(sum_us.load(std::memory_order_relaxed)) / 1e6 << "\n";
+        out << name << "_count" << braces << " " << cumulative << "\n";
+    }
+} LatencyHistogram;
+
+// Endpoints the HTTP metrics are split by (picked from the request path)
+enum class MetricEndpoint
+{
+    Nearby = 0,
+    Details = 1,
+    Other = 2
+};
+const char *kMetricEndpointNames[] = {"nearbysearch", "details", "other"};
+const size_t kMetricEndpointCount = 3;
+
+// Traffic of the requests made by the current thread; per-query reports take the difference around a query
+typedef struct FetchTraffic
+{
+    uint64_t requests = 0;
+    uint64_t wire_bytes = 0; // response bodies as transferred (compressed when the server agreed to)
+    uint64_t body_bytes = 0; // response bodies after decoding, as the parser saw them
+} FetchTraffic;
+
+thread_local FetchTraffic threadTraffic;
+
+// Time budget of the lookup the current thread is working on. Places requests started under one get their timeouts
+// from what is left of it, and no new request (or retry) is started once it has run out.
+typedef struct Deadline
+{
+    std::chrono::steady_clock::time_point at = std::chrono::steady_clock::time_point::max();
+    std::shared_ptr<std::atomic<bool>> missed; // set by work dropped for lack of time, on whichever thread carried the deadline
+
+    // budget_ms after from; none for 0 or less
+    static Deadline after_ms(int64_t budget_ms, std::chrono::steady_clock::time_point from = std::chrono::steady_clock::now())
+    {
+        Deadline deadline;
+        if (budget_ms > 0)
+        {
+            deadline.at = from + std::chrono::milliseconds(budget_ms);
+            deadline.missed = std::make_shared<std::atomic<bool>>(false);
+        }
+        return deadline;
+    }
+
+    bool set() const { return at != std::chrono::steady_clock::time_point::max(); }
+    bool expired() const { return set() && std::chrono::steady_clock::now() >= at; }
+
+    // Records that a request, page or retry was dropped to stay within the deadline
+    void miss() const
+    {
+        if (missed)
+        {
+            missed->store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // Whether the work done under the deadline may be incomplete because of it
+    bool cut_short() const { return expired() || (missed && missed->load(std::memory_order_relaxed)); }
+
+    // Milliseconds left, 0 once expired and INT64_MAX without a deadline
+    int64_t remaining_ms() const
+    {
+        if (!set())
+        {
+            return INT64_MAX;
+        }
+        return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(at - std::chrono::steady_clock::now()).count());
+    }
+} Deadline;
+
+thread_local Deadline threadDeadline;
+
+// Puts the current thread under a deadline until the scope ends; inside another scope the earlier deadline wins.
+// Work handed to other threads carries threadDeadline along and opens its own scope there.
+typedef struct DeadlineScope
+{
+    explicit DeadlineScope(const Deadline &deadline) : outer(threadDeadline)
+    {
+        if (deadline.at < outer.at)
+        {
+            threadDeadline = deadline;
+        }
+    }
+    ~DeadlineScope() { threadDeadline = outer; }
+    DeadlineScope(const DeadlineScope &) = delete;
+    DeadlineScope &operator=(const DeadlineScope &) = delete;
+
+private:
+    Deadline outer;
+} DeadlineScope;
+
+// Request phases (from curl's transfer timings) and local processing stages of the fetch pipeline
+typedef struct PipelineMetrics
+{
+    // Per endpoint. dns/connect/tls are only recorded for requests that opened a new connection.
+    LatencyHistogram dns[kMetricEndpointCount];
+    LatencyHistogram connect[kMetricEndpointCount];    // TCP handshake
+    LatencyHistogram tls[kMetricEndpointCount];        // TLS handshake
+    LatencyHistogram first_byte[kMetricEndpointCount]; // request sent until the first response byte (server time)
+    LatencyHistogram total[kMetricEndpointCount];      // whole request
+    LatencyHistogram parse[kMetricEndpointCount];      // decoding the response body
+    std::atomic<uint64_t> requests[kMetricEndpointCount] = {};
+    std::atomic<uint64_t> new_connections[kMetricEndpointCount] = {};
+    std::atomic<uint64_t> bytes_received[kMetricEndpointCount] = {}; // on the wire
+    std::atomic<uint64_t> bytes_decoded[kMetricEndpointCount] = {};  // after content decoding
+
+    std::atomic<uint64_t> hedges[kMetricEndpointCount] = {};     // duplicates sent for a request still running at the hedge delay
+    std::atomic<uint64_t> hedge_wins[kMetricEndpointCount] = {}; // ... whose response came first
+    std::atomic<uint64_t> retries[kMetricEndpointCount] = {};    // requests repeated after a failure safe to repeat
+    std::atomic<uint64_t> timeouts[kMetricEndpointCount] = {};   // requests cut off by their connect or total timeout
+    std::atomic<uint64_t> abandoned[kMetricEndpointCount] = {};  // requests or retries not sent because the deadline had passed
+    LatencyHistogram first_attempt[kMetricEndpointCount]; // first request for each item until it answered or a hedge did; sets the hedge delay
+
+    LatencyHistogram enrich; // one fetch_place_details_concurrent batch
+    LatencyHistogram index;  // moving a batch into the store and maps, or rebuilding the spatial index
+
+    // Records a finished transfer; called by HttpClient::record_transfer for every request
+    void record_transfer(CURL *curl, bool new_connection)
+    {
+        const char *url = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+        size_t endpoint = static_cast<size_t>(endpoint_of(url));
+
+        curl_off_t name_lookup = 0, connected = 0, app_connected = 0, pretransfer = 0, start_transfer = 0, total_time = 0, downloaded = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connected);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app_connected);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start_transfer);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+
+        // curl's times are cumulative from the start of the request
+        if (new_connection)
+        {
+            new_connections[endpoint].fetch_add(1, std::memory_order_relaxed);
+            dns[endpoint].record_us(name_lookup);
+            connect[endpoint].record_us(connected - name_lookup);
+            if (app_connected > 0)
+            {
+                tls[endpoint].record_us(app_connected - connected);
+            }
+        }
+        if (start_transfer > 0)
+        {
+            first_byte[endpoint].record_us(start_transfer - pretransfer);
+        }
+        total[endpoint].record_us(total_time);
+        requests[endpoint].fetch_add(1, std::memory_order_relaxed);
+        bytes_received[endpoint].fetch_add(static_cast<uint64_t>(std::max<curl_off_t>(downloaded, 0)), std::memory_order_relaxed);
+        threadTraffic.requests++;
+        threadTraffic.wire_bytes += static_cast<uint64_t>(std::max<curl_off_t>(downloaded, 0));
+    }
+
+    // Records the decoding of one response body (parse time and decoded size, both charged by StreamWriteCallback)
+    void record_parse(MetricEndpoint endpoint, int64_t parse_ns, uint64_t body_bytes)
+    {
+        parse[static_cast<size_t>(endpoint)].record_us(parse_ns / 1000);
+        bytes_decoded[static_cast<size_t>(endpoint)].fetch_add(body_bytes, std::memory_order_relaxed);
+        threadTraffic.body_bytes += body_bytes;
+    }
+
+    static MetricEndpoint endpoint_of(const char *url)
+    {
+        if (url && std::strstr(url, "/nearbysearch/"))
+            return MetricEndpoint::Nearby;
+        if (url && std::strstr(url, "/details/"))
+            return MetricEndpoint::Details;
+        return MetricEndpoint::Other;
+    }
+
+    void write_prometheus(std::ostream &out) const
+    {
+        const struct
+        {
+            const char *name;
+            const char *help;
+            const LatencyHistogram *histograms;
+        } phases[] = {
+            {"places_http_dns_seconds", "DNS lookup time of requests that opened a connection", dns},
+            {"places_http_connect_seconds", "TCP connect time of requests that opened a connection", connect},
+            {"places_http_tls_seconds", "TLS handshake time of requests that opened a connection", tls},
+            {"places_http_first_byte_seconds", "Time from sending a request to its first response byte", first_byte},
+            {"places_http_request_seconds", "Total time of a Places request", total},
+            {"places_parse_seconds", "Time spent decoding a response body", parse},
+        };
+        for (const auto &phase : phases)
+        {
+            out << "# HELP " << phase.name << " " << phase.help << "\n# TYPE " << phase.name << " histogram\n";
+            for (size_t e = 0; e < kMetricEndpointCount; e++)
+            {
+                phase.histograms[e].write_prometheus(out, phase.name, std::string("endpoint=\"") + kMetricEndpointNames[e] + "\"");
+            }
+        }
+
+        const struct
+        {
+            const char *name;
+            const char *help;
+            const std::atomic<uint64_t> *values;
+        } counters[] = {
+            {"places_http_requests_total", "Places requests made", requests},
+            {"places_http_new_connections_total", "Places requests that opened a new connection", new_connections},
+            {"places_http_response_bytes_total", "Response body bytes received", bytes_received},
+            {"places_http_decoded_bytes_total", "Response body bytes after content decoding", bytes_decoded},
+            {"places_http_hedges_total", "Duplicate requests sent for a request slower than the hedge delay", hedges},
+            {"places_http_hedge_wins_total", "Hedged requests answered by the duplicate first", hedge_wins},
+            {"places_http_retries_total", "Requests repeated after a transport error, timeout or 5xx", retries},
+            {"places_http_timeouts_total", "Requests cut off by their connect or total timeout", timeouts},
+            {"places_http_abandoned_total", "Requests not sent because the lookup's deadline had passed", abandoned},
+        };
+        for (const auto &counter : counters)
+        {
+            out << "# HELP " << counter.name << " " << counter.help << "\n# TYPE " << counter.name << " counter\n";
+            for (size_t e = 0; e < kMetricEndpointCount; e++)
+            {
+                out << counter.name << "{endpoint=\"" << kMetricEndpointNames[e] << "\"} " << counter.values[e].load(std::memory_order_relaxed) << "\n";
+            }
+        }
+
+        out << "# HELP places_enrich_seconds Time to fetch details for one batch of restaurants\n# TYPE places_enrich_seconds histogram\n";
+        enrich.write_prometheus(out, "places_enrich_seconds", "");
+        out << "# HELP places_index_seconds Time to add a batch to the store and maps or rebuild the spatial index\n# TYPE places_index_seconds histogram\n";
+        index.write_prometheus(out, "places_index_seconds", "");
+    }
+
+    // Human-readable summary: count, mean and estimated p50/p99 per stage that saw any traffic
+    void print_summary(std::ostream &out) const
+    {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << "Pipeline timings (count, mean / p50 / p99 in ms):" << std::endl;
+        auto line = [&](const std::string &name, const LatencyHistogram &histogram)
+        {
+            uint64_t count = histogram.count();
+            if (count == 0)
+            {
+                return;
+            }
+            out << "  " << std::left << std::setw(24) << name << std::right << std::setw(7) << count << "  " << std::fixed << std::setprecision(2)
+                << static_cast<double>(histogram.sum_us.load(std::memory_order_relaxed)) / count / 1000.0 << " / "
+                << histogram.quantile_us(0.50) / 1000.0 << " / " << histogram.quantile_us(0.99) / 1000.0 << std::endl;
+            out.flags(flags);
+        };
+        for (size_t e = 0; e < kMetricEndpointCount; e++)
+        {
+            std::string endpoint = kMetricEndpointNames[e];
+            line(endpoint + " dns", dns[e]);
+            line(endpoint + " connect", connect[e]);
+            line(endpoint + " tls", tls[e]);
+            line(endpoint + " first byte", first_byte[e]);
+            line(endpoint + " request", total[e]);
+            line(endpoint + " parse", parse[e]);
+            if (requests[e].load() > 0)
+            {
+                out << "  " << endpoint << " bytes received: " << bytes_received[e].load() << " (" << bytes_decoded[e].load() << " decoded) over "
+                    << requests[e].load() << " requests" << std::endl;
+                out << "  " << endpoint << " tail: " << hedges[e].load() << " hedged (" << hedge_wins[e].load() << " won), " << retries[e].load()
+                    << " retried, " << timeouts[e].load() << " timed out, " << abandoned[e].load() << " abandoned at the deadline" << std::endl;
+            }
+        }
+        line("enrich batch", enrich);
+        line("store/index", index);
+        out.precision(precision);
+    }
+} PipelineMetrics;
+
+PipelineMetrics pipelineMetrics;
+std::string metricsPath; // PLACES_METRICS_FILE: Prometheus textfile rewritten by long-running modes and at exit
+
+// Writes the metrics to metricsPath (if set) through a temporary file, so a collector never reads a partial file
+void write_metrics_file()
+{
+    if (metricsPath.empty())
+    {
+        return;
+    }
+    std::string temporary = metricsPath + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        if (!out.is_open())
+        {
+            std::cerr << "Could not write " << temporary << std::endl;
+            return;
+        }
+        pipelineMetrics.write_prometheus(out);
+    }
+    std::rename(temporary.c_str(), metricsPath.c_str());
+}
+
+// Timeouts, retries and hedging of Places requests
+typedef struct RequestPolicy
+{
+    int64_t lookup_budget_ms = 30000; // deadline of one lookup (a batch row, a daemon fetch, an interactive search); 0 for none
+    int64_t connect_timeout_ms = 3000; // TCP and TLS handshake; at most half of what is left of the deadline
+    int64_t request_timeout_ms = 10000; // one whole request; at most what is left of the deadline
+    int max_retries = 2;               // repeats of a request after a failure safe to repeat (see is_retryable)
+    int retry_base_ms = 100;           // backoff ceiling before the first retry, doubled for each one after it
+    double hedge_percentile = 95.0;    // details requests still running at this percentile of past ones are sent again; 0 is off
+    int hedge_min_delay_ms = 10;       // ... but never sooner than this
+    double hedge_budget = 0.1;         // hedges per request sent so far, at most; bounds what hedging adds to the API bill
+
+    // Backoff before the attempt-th retry (from 0): uniform in the upper half of a doubling ceiling, so concurrent
+    // failures do not come back in lockstep
+    int retry_backoff_ms(int attempt) const
+    {
+        static thread_local std::mt19937 rng(std::random_device{}());
+        int ceiling = std::max(2, std::min(5000, retry_base_ms << std::min(attempt, 6)));
+        return std::uniform_int_distribution<int>(ceiling / 2, ceiling)(rng);
+    }
+
+    // How long a request to endpoint may run before a hedge is sent, or -1 while there are too few samples to tell
+    int64_t hedge_delay_ms(MetricEndpoint endpoint) const
+    {
+        const LatencyHistogram &latency = pipelineMetrics.first_attempt[static_cast<size_t>(endpoint)];
+        if (hedge_percentile <= 0.0 || latency.count() < 20)
+        {
+            return -1;
+        }
+        return std::max<int64_t>(hedge_min_delay_ms, static_cast<int64_t>(latency.quantile_us(hedge_percentile / 100.0) / 1000.0));
+    }
+
+    // Whether one more hedge to endpoint stays within hedge_budget
+    bool hedge_allowed(MetricEndpoint endpoint) const
+    {
+        size_t e = static_cast<size_t>(endpoint);
+        return static_cast<double>(pipelineMetrics.hedges[e].load() + 1) <= hedge_budget * static_cast<double>(pipelineMetrics.requests[e].load());
+    }
+} RequestPolicy;
+
+RequestPolicy requestPolicy; // PLACES_DEADLINE_MS and PLACES_HEDGE_PERCENTILE override its defaults
+
+// Connect and total timeouts of a request about to start, from requestPolicy capped by the thread's deadline
+void apply_timeouts(CURL *curl)
+{
+    int64_t total = std::max<int64_t>(1, std::min(requestPolicy.request_timeout_ms, threadDeadline.remaining_ms()));
+    int64_t connect = std::min(requestPolicy.connect_timeout_ms, threadDeadline.set() ? std::max<int64_t>(1, total / 2) : total);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(total));
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(connect));
+}
+
+// Shared HTTP client for every Places call.
+// Easy and multi handles are pooled per thread instead of being created per request, and all of them are attached to
+// one CURLSH share so DNS lookups and TLS sessions are reused across threads. Open connections are not shared: libcurl
+// does not support one connection cache used by concurrently running threads, so each connection stays in the cache
+// of the handle (blocking requests) or multi handle (concurrent requests) that opened it, and is reused by later
+// requests on the same thread.
+typedef struct HttpClient
+{
+    bool http2 = true;                  // negotiate HTTP/2 so concurrent requests multiplex over one connection
+    long max_host_connections = 4;      // cap on parallel connections per host for multi transfers
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> connections_opened{0};
+    std::atomic<uint64_t> connections_reused{0};
+
+    HttpClient()
+    {
+        share = curl_share_init();
+        if (share)
+        {
+            curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+            curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+            curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+
+    ~HttpClient()
+    {
+        // the pools of finished threads are gone and the main thread's are destroyed before statics, so no handle
+        // still points at the share
+        if (share)
+        {
+            curl_share_cleanup(share);
+        }
+    }
+
+    HttpClient(const HttpClient &) = delete;
+    HttpClient &operator=(const HttpClient &) = delete;
+
+    // Checks a configured easy handle out of the calling thread's pool, creating one if the pool is empty
+    CURL *acquire_handle()
+    {
+        HandlePool &pool = thread_pool();
+        if (!pool.idle_handles.empty())
+        {
+            CURL *curl = pool.idle_handles.back();
+            pool.idle_handles.pop_back();
+            return curl;
+        }
+
+        CURL *curl = curl_easy_init();
+        if (curl)
+        {
+            if (share)
+            {
+                curl_easy_setopt(curl, CURLOPT_SHARE, share);
+            }
+            curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, http2 ? CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_1_1);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L); // prefer multiplexing on an existing connection over opening a new one
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // required when handles are used from worker threads
+            curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // offer every encoding this libcurl decodes (gzip, br, zstd)
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        }
+        return curl;
+    }
+
+    // Returns a handle to the calling thread's pool; a connection it opened on its own stays open in its cache
+    void release_handle(CURL *curl)
+    {
+        if (!curl)
+        {
+            return;
+        }
+        thread_pool().idle_handles.push_back(curl);
+    }
+
+    // Points a pooled handle at a url and response buffer
+    void prepare(CURL *curl, const std::string &url, std::string *readBuffer)
+    {
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, readBuffer);
+    }
+
+    // Blocking request on a pooled handle
+    CURLcode perform(CURL *curl)
+    {
+        CURLcode res = curl_easy_perform(curl);
+        record_transfer(curl);
+        return res;
+    }
+
+    // Updates the reuse counters and pipeline metrics once a transfer has finished (also called by multi-driven transfers)
+    void record_transfer(CURL *curl)
+    {
+        long new_connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connects);
+        requests++;
+        pipelineMetrics.record_transfer(curl, new_connects > 0);
+        if (new_connects == 0)
+        {
+            connections_reused++;
+        }
+        else
+        {
+            connections_opened += static_cast<uint64_t>(new_connects);
+        }
+    }
+
+    // Checks a multi handle out of the calling thread's pool, creating one tuned to multiplex its transfers if the
+    // pool is empty. Its connection cache outlives the batch, so the thread's next batch reuses the connections.
+    CURLM *acquire_multi()
+    {
+        HandlePool &pool = thread_pool();
+        if (!pool.idle_multis.empty())
+        {
+            CURLM *multi = pool.idle_multis.back();
+            pool.idle_multis.pop_back();
+            return multi;
+        }
+        CURLM *multi = curl_multi_init();
+        if (multi)
+        {
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+            curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+        }
+        return multi;
+    }
+
+    // Returns a multi handle, with every transfer removed from it, to the calling thread's pool
+    void release_multi(CURLM *multi)
+    {
+        if (multi)
+        {
+            thread_pool().idle_multis.push_back(multi);
+        }
+    }
+
+    void print_stats(std::ostream &out) const
+    {
+        out << "HTTP requests: " << requests.load() << " (connections opened: " << connections_opened.load()
+            << ", reused: " << connections_reused.load() << ")" << std::endl;
+    }
+
+private:
+    // Idle handles of one thread, cleaned up when the thread exits
+    typedef struct HandlePool
+    {
+        std::vector<CURL *> idle_handles;
+        std::vector<CURLM *> idle_multis;
+
+        HandlePool() {}
+        HandlePool(const HandlePool &) = delete;
+        HandlePool &operator=(const HandlePool &) = delete;
+        ~HandlePool()
+        {
+            for (CURL *curl : idle_handles)
+            {
+                curl_easy_cleanup(curl);
+            }
+            for (CURLM *multi : idle_multis)
+            {
+                curl_multi_cleanup(multi);
+            }
+        }
+    } HandlePool;
+
+    static HandlePool &thread_pool()
+    {
+        thread_local HandlePool pool;
+        return pool;
+    }
+
+    CURLSH *share = nullptr;
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+    static void lock_share(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+    {
+        static_cast<HttpClient *>(userptr)->share_locks[data].lock();
+    }
+
+    static void unlock_share(CURL *, curl_lock_data data, void *userptr)
+    {
+        static_cast<HttpClient *>(userptr)->share_locks[data].unlock();
+    }
+} HttpClient;
+
+// Process-wide client used by every Places request; created on first use (after curl_global_init in main)
+HttpClient &places_http_client()
+{
+    static HttpClient client;
+    return client;
+}
+
+// Places endpoints the scheduler meters separately; lower values are served first
+enum class PlacesEndpoint
+{
+    Nearby = 0,
+    Details = 1
+};
+const int kEndpointCount = 2;
+
+// How a request ended, as far as quota management is concerned
+enum class RequestOutcome
+{
+    Ok,
+    Throttled, // HTTP 429 or OVER_QUERY_LIMIT
+    Failed     // anything else; does not change the concurrency limit
+};
+
+// Central gate every Places request passes through.
+// Each endpoint has a token bucket (requests per second with a burst allowance), nearbysearch always goes ahead of
+// waiting details requests, and the number of requests in flight follows AIMD: +1 per window of successes, halved
+// (plus a short cool-down) whenever the API throttles us.
+typedef struct RequestScheduler
+{
+    RequestScheduler()
+    {
+        configure(PlacesEndpoint::Nearby, 10.0, 10.0);
+        configure(PlacesEndpoint::Details, 50.0, 50.0);
+    }
+
+    RequestScheduler(const RequestScheduler &) = delete;
+    RequestScheduler &operator=(const RequestScheduler &) = delete;
+
+    void configure(PlacesEndpoint endpoint, double requests_per_second, double burst)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Bucket &bucket = buckets[static_cast<int>(endpoint)];
+        bucket.rate = requests_per_second;
+        bucket.burst = burst;
+        bucket.tokens = burst;
+        bucket.refilled = std::chrono::steady_clock::now();
+    }
+
+    void set_concurrency_bounds(double minimum, double maximum)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        min_limit = minimum;
+        max_limit = maximum;
+        limit = std::clamp(limit, min_limit, max_limit);
+    }
+
+    // Blocks until a request to endpoint may be sent
+    void acquire(PlacesEndpoint endpoint)
+    {
+        int e = static_cast<int>(endpoint);
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting[e]++;
+        max_queue_depth[e] = std::max(max_queue_depth[e], waiting[e]);
+
+        std::chrono::steady_clock::duration retry_after;
+        while (!admit_locked(endpoint, retry_after))
+        {
+            wake.wait_for(lock, retry_after);
+        }
+
+        waiting[e]--;
+        record_wait_locked(e, std::chrono::steady_clock::now() - start);
+    }
+
+    // Non-blocking variant for event loops; on refusal retry_after says when trying again may succeed
+    bool try_acquire(PlacesEndpoint endpoint, std::chrono::milliseconds &retry_after)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::chrono::steady_clock::duration wait;
+        if (!admit_locked(endpoint, wait))
+        {
+            retry_after = std::max(std::chrono::milliseconds(1), std::chrono::duration_cast<std::chrono::milliseconds>(wait));
+            deferred[static_cast<int>(endpoint)]++;
+            return false;
+        }
+        record_wait_locked(static_cast<int>(endpoint), std::chrono::steady_clock::duration::zero());
+        return true;
+    }
+
+    // Returns the slot taken by acquire and feeds the outcome into the concurrency limit
+    void release(PlacesEndpoint endpoint, RequestOutcome outcome)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight--;
+        if (outcome == RequestOutcome::Throttled)
+        {
+            throttled[static_cast<int>(endpoint)]++;
+            limit = std::max(min_limit, limit / 2.0);
+            cooldown_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff_ms(consecutive_throttles++));
+        }
+        else if (outcome == RequestOutcome::Ok)
+        {
+            consecutive_throttles = 0;
+            limit = std::min(max_limit, limit + 1.0 / limit);
+        }
+        wake.notify_all();
+    }
+
+    // Exponential backoff with full jitter for the attempt-th retry, capped at 8 s
+    int backoff_ms(int attempt)
+    {
+        static thread_local std::mt19937 rng(std::random_device{}());
+        int ceiling = std::min(8000, 250 << std::min(attempt, 5));
+        return std::uniform_int_distribution<int>(ceiling / 2, ceiling)(rng);
+    }
+
+    void print_stats(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const char *names[kEndpointCount] = {"nearbysearch", "details"};
+        out << "Scheduler: concurrency limit " << limit << std::endl;
+        for (int e = 0; e < kEndpointCount; e++)
+        {
+            double average_wait = granted[e] ? total_wait_ms[e] / granted[e] : 0.0;
+            out << "  " << names[e] << ": " << granted[e] << " sent, " << throttled[e] << " throttled, queue depth "
+                << waiting[e] << " (max " << max_queue_depth[e] << "), wait avg " << average_wait << " ms / max "
+                << max_wait_ms[e] << " ms, " << deferred[e] << " deferred polls" << std::endl;
+        }
+    }
+
+private:
+    typedef struct Bucket
+    {
+        double rate = 1.0;
+        double burst = 1.0;
+        double tokens = 1.0;
+        std::chrono::steady_clock::time_point refilled;
+    } Bucket;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    Bucket buckets[kEndpointCount];
+    double limit = 16.0;
+    double min_limit = 1.0;
+    double max_limit = 64.0;
+    int in_flight = 0;
+    int consecutive_throttles = 0;
+    std::chrono::steady_clock::time_point cooldown_until;
+    int waiting[kEndpointCount] = {};
+    int max_queue_depth[kEndpointCount] = {};
+    uint64_t granted[kEndpointCount] = {};
+    uint64_t throttled[kEndpointCount] = {};
+    uint64_t deferred[kEndpointCount] = {};
+    double total_wait_ms[kEndpointCount] = {};
+    double max_wait_ms[kEndpointCount] = {};
+
+    // Takes a token and a slot if the endpoint may go now; otherwise sets how long to wait before checking again
+    bool admit_locked(PlacesEndpoint endpoint, std::chrono::steady_clock::duration &retry_after)
+    {
+        int e = static_cast<int>(endpoint);
+        auto now = std::chrono::steady_clock::now();
+        Bucket &bucket = buckets[e];
+        bucket.tokens = std::min(bucket.burst, bucket.tokens + bucket.rate * std::chrono::duration<double>(now - bucket.refilled).count());
+        bucket.refilled = now;
+
+        retry_after = std::chrono::milliseconds(50); // re-check interval when waiting on other requests
+        if (now < cooldown_until)
+        {
+            retry_after = cooldown_until - now;
+            return false;
+        }
+        for (int higher = 0; higher < e; higher++)
+        {
+            if (waiting[higher] > 0)
+                return false;
+        }
+        if (in_flight >= static_cast<int>(limit))
+        {
+            return false;
+        }
+        if (bucket.tokens < 1.0)
+        {
+            retry_after = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>((1.0 - bucket.tokens) / bucket.rate));
+            return false;
+        }
+
+        bucket.tokens -= 1.0;
+        in_flight++;
+        return true;
+    }
+
+    void record_wait_locked(int e, std::chrono::steady_clock::duration waited)
+    {
+        double ms = std::chrono::duration<double, std::milli>(waited).count();
+        granted[e]++;
+        total_wait_ms[e] += ms;
+        max_wait_ms[e] = std::max(max_wait_ms[e], ms);
+    }
+} RequestScheduler;
+
+RequestScheduler placesScheduler; // every Places request is admitted through this
+
+// Classifies a finished transfer for the scheduler from its HTTP code and the API status field
+RequestOutcome classify_outcome(CURL *curl, CURLcode res, const std::string &api_status)
+{
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 429 || api_status == "OVER_QUERY_LIMIT")
+    {
+        return RequestOutcome::Throttled;
+    }
+    if (res != CURLE_OK || http_code >= 500)
+    {
+        return RequestOutcome::Failed;
+    }
+    return RequestOutcome::Ok;
+}
+
+const int kMaxThrottleRetries = 5; // retries of a single request that keeps getting throttled
+
+// Whether a failed request may simply be sent again: the connection failed or broke, it timed out, or the server
+// answered 5xx. Every Places request is a GET, so a repeat cannot do anything twice; what is excluded are failures a
+// repeat would only reproduce (4xx, API errors, unparseable bodies) and throttling, which the scheduler paces.
+bool is_retryable(CURL *curl, CURLcode res)
+{
+    switch (res)
+    {
+    case CURLE_OK:
+    {
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        return http_code == 500 || http_code == 502 || http_code == 503 || http_code == 504;
+    }
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+    case CURLE_SSL_CONNECT_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Counts a finished request that a timeout cut off
+void record_timeout(MetricEndpoint endpoint, CURLcode res)
+{
+    if (res == CURLE_OPERATION_TIMEDOUT)
+    {
+        pipelineMetrics.timeouts[static_cast<size_t>(endpoint)].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Counts a request not sent because the thread's deadline left no time for it, and marks the deadline as missed
+void record_abandoned(MetricEndpoint endpoint)
+{
+    pipelineMetrics.abandoned[static_cast<size_t>(endpoint)].fetch_add(1, std::memory_order_relaxed);
+    threadDeadline.miss();
+}
+
+// Function to get current day and time for determining if a restaurant is open
+std::string get_current_day_of_week()
+{
+    std::string days[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+    auto now = std::chrono::system_clock::now();
+    std::time_t now_time = std::chrono::system_clock::to_time_t(now);
+    std::tm local_tm = *std::localtime(&now_time);
+    return days[local_tm.tm_wday];
+}
+
+// formats unix time to return a string for human time
+std::string get_current_time_string()
+{
+    auto now = std::chrono::system_clock::now();
+    std::time_t now_time = std::chrono::system_clock::to_time_t(now);
+    std::tm local_tm = *std::localtime(&now_time);
+
+    std::stringstream ss;
+    // setfill ensures leading zeros (i.e. 3:04 instead of 3:4)
+    // setw ensures digit wide (i.e. hours 0-23 or minutes 0-59)
+    ss << std::setfill('0') << std::setw(2) << local_tm.tm_hour << ":"
+       << std::setfill('0') << std::setw(2) << local_tm.tm_min;
+    return ss.str();
+}
+
+const char *kDetailsFields = "url,website,opening_hours,permanently_closed"; // everything the decoder reads (name comes from nearbysearch)
+const char *kVolatileDetailsFields = "opening_hours,permanently_closed";    // open_now and operational status
+
+// Builds the Place Details request URL for a single place_id
+std::string build_place_details_url(const std::string &place_id, const std::string &api_key, const std::string &fields = kDetailsFields)
+{
+    return placesApiBase + "/details/json?"
+                           "place_id=" +
+           place_id +
+           "&fields=" + fields +
+           "&key=" + api_key;
+}
+
+// One page of nearbysearch results
+typedef struct NearbyPage
+{
+    std::string status;
+    std::string error_message;
+    std::string next_page_token;
+    std::vector<restaurant_data> restaurants;
+} NearbyPage;
+
+// Determine cuisine type based on types (first type that isn't a generic google category)
+void derive_cuisine(restaurant_data &restaurant)
+{
+    restaurant.cuisine = "Not specified";
+    for (const auto &type_str : restaurant.types)
+    {
+        // Look for food-related types; whether a type is generic is decided once per type when it is interned
+        if (!placeTypes.is_generic(placeTypes.intern(type_str)))
+        {
+            restaurant.cuisine = type_str;
+
+            // Replace underscores with spaces and capitalize
+            std::replace(restaurant.cuisine.begin(), restaurant.cuisine.end(), '_', ' ');
+            if (!restaurant.cuisine.empty())
+            {
+                restaurant.cuisine[0] = std::toupper(restaurant.cuisine[0]);
+            }
+            break;
+        }
+    }
+}
+
+// Week minute at which compiled hours next open (or, if open at now, next close); -1 if that never happens
+int next_hours_change(const std::vector<WeekInterval> &week, int now, bool open)
+{
+    if (week.empty())
+    {
+        return -1;
+    }
+    for (const WeekInterval &interval : week)
+    {
+        if (!open && interval.open > now)
+            return interval.open;
+        if (open && now >= interval.open && now < interval.close)
+        {
+            if (interval.close < kMinutesPerWeek || week.front().open > 0)
+                return interval.close % kMinutesPerWeek;
+            // runs into Sunday 00:00, where the first interval carries on
+            return week.front().close < kMinutesPerWeek ? week.front().close : -1;
+        }
+    }
+    return open ? -1 : week.front().open;
+}
+
+// "22:00" for later today, "Tuesday 11:00" otherwise
+std::string describe_week_minute(int minute, int now)
+{
+    static const char *days[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+    std::stringstream ss;
+    if (minute / kMinutesPerDay != now / kMinutesPerDay || minute < now)
+    {
+        ss << days[minute / kMinutesPerDay] << " ";
+    }
+    ss << std::setfill('0') << std::setw(2) << (minute % kMinutesPerDay) / 60 << ":"
+       << std::setfill('0') << std::setw(2) << minute % 60;
+    return ss.str();
+}
+
+// Determine current status from the operational flag, open_now and the compiled hours, falling back to today's
+// weekday_text line for records without periods
+void update_current_status(restaurant_data &restaurant)
+{
+    const std::string dash = "\u2013"; // weekday_text separates open and close times with an en dash
+    if (!restaurant.is_operational)
+    {
+        restaurant.current_status = "Permanently closed";
+    }
+    else if (!restaurant.hours.week.empty())
+    {
+        // open_now from the API still decides open vs closed; the compiled hours only say until when
+        int now = current_week_minute();
+        bool open = restaurant.hours.open_now;
+        restaurant.current_status = open ? "Currently open" : "Currently closed";
+        const std::vector<WeekInterval> &week = restaurant.hours.week;
+        int change = next_hours_change(week, now, open);
+        if (open && week.size() == 1 && week[0].open == 0 && week[0].close == kMinutesPerWeek)
+        {
+            restaurant.current_status += " (Open 24 hours)";
+        }
+        else if (change >= 0)
+        {
+            restaurant.current_status += (open ? " (Closes " : " (Opens ") + describe_week_minute(change, now) + ")";
+        }
+    }
+    else if (restaurant.hours.open_now)
+    {
+        restaurant.current_status = "Currently open";
+
+        // Try to find when it closes
+        std::string current_day = get_current_day_of_week();
+        for (const auto &text : restaurant.hours.weekday_text)
+        {
+            if (text.find(current_day) != std::string::npos)
+            {
+                size_t close_pos = text.find(dash);
+                if (close_pos != std::string::npos)
+                {
+                    size_t time_pos = text.find_first_not_of(' ', close_pos + dash.size());
+                    restaurant.current_status += " (Closes " + text.substr(std::min(time_pos, text.size())) + ")";
+                }
+                break;
+            }
+        }
+    }
+    else
+    {
+        restaurant.current_status = "Currently closed";
+
+        // Try to find when it opens next
+        std::string current_day = get_current_day_of_week();
+        bool found_today = false;
+
+        for (const auto &text : restaurant.hours.weekday_text)
+        {
+            if (text.find(current_day) != std::string::npos)
+            {
+                found_today = true;
+                if (text.find("Closed") != std::string::npos)
+                {
+                    restaurant.current_status += " (Closed today)";
+                }
+                else
+                {
+                    size_t open_pos = text.find(": ");
+                    if (open_pos != std::string::npos)
+                    {
+                        size_t close_pos = text.find(dash, open_pos);
+                        if (close_pos != std::string::npos)
+                        {
+                            restaurant.current_status += " (Opens " + text.substr(open_pos + 2, close_pos - open_pos - 3) + ")";
+                        }
+                    }
+                }
+                break;
+            }
+        }
+
+        if (!found_today)
+        {
+            restaurant.current_status += " (Hours unknown)";
+        }
+    }
+}
+
+// Kind of scalar reported by the streaming JSON parser
+enum class JsonValueType
+{
+    String,
+    Number,
+    Bool,
+    Null
+};
+
+// Keys from the document root down to the current value; array elements appear as "#"
+typedef struct JsonPath
+{
+    const std::string *keys = nullptr;
+    size_t size = 0;
+
+    bool is(std::initializer_list<const char *> expected) const
+    {
+        if (expected.size() != size)
+        {
+            return false;
+        }
+        size_t i = 0;
+        for (const char *key : expected)
+        {
+            if (keys[i++] != key)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+} JsonPath;
+
+// Receives SAX-style events from JsonStreamParser. Views passed to on_value are only valid during the call.
+typedef struct JsonHandler
+{
+    int64_t parse_ns = 0;    // time spent decoding the current response, charged by StreamWriteCallback
+    uint64_t body_bytes = 0; // decoded size of the current response, likewise
+    virtual ~JsonHandler() {}
+    virtual void on_begin(const JsonPath &, bool /*is_array*/) {}
+    virtual void on_end(const JsonPath &, bool /*is_array*/) {}
+    virtual void on_value(const JsonPath &path, JsonValueType type, std::string_view text) = 0;
+} JsonHandler;
+
+// Incremental JSON parser that can be fed a response in arbitrary chunks (e.g. straight from WriteCallback).
+// Strings and numbers that sit entirely inside one chunk without escapes are handed out as views into that chunk;
+// only tokens that straddle a chunk boundary or contain escapes are copied into a reusable scratch buffer.
+typedef struct JsonStreamParser
+{
+    explicit JsonStreamParser(JsonHandler &handler) : handler(handler) {}
+
+    // Parses the next chunk; returns false once the input is known to be malformed
+    bool feed(const char *data, size_t length)
+    {
+        size_t i = 0;
+        size_t span_start = 0; // start of the unspilled part of the current string/scalar in this chunk
+
+        while (i < length && state != State::Error)
+        {
+            char c = data[i];
+            switch (state)
+            {
+            case State::String:
+            {
+                size_t j = i;
+                while (j < length && data[j] != '"' && data[j] != '\\')
+                {
+                    j++;
+                }
+                if (j == length)
+                {
+                    i = j;
+                    break;
+                }
+                if (data[j] == '\\')
+                {
+                    token.append(data + span_start, j - span_start);
+                    state = State::Escape;
+                    i = j + 1;
+                    break;
+                }
+                if (token.empty())
+                {
+                    end_string(std::string_view(data + span_start, j - span_start));
+                }
+                else
+                {
+                    token.append(data + span_start, j - span_start);
+                    end_string(std::string_view(token));
+                    token.clear();
+                }
+                i = j + 1;
+                break;
+            }
+            case State::Escape:
+                switch (c)
+                {
+                case 'b':
+                    token.push_back('\b');
+                    break;
+                case 'f':
+                    token.push_back('\f');
+                    break;
+                case 'n':
+                    token.push_back('\n');
+                    break;
+                case 'r':
+                    token.push_back('\r');
+                    break;
+                case 't':
+                    token.push_back('\t');
+                    break;
+                case 'u':
+                    unicode_value = 0;
+                    unicode_digits = 0;
+                    break;
+                default:
+                    token.push_back(c); // \" \\ \/
+                    break;
+                }
+                state = c == 'u' ? State::Unicode : State::String;
+                span_start = ++i;
+                break;
+            case State::Unicode:
+            {
+                int digit = hex_digit(c);
+                if (digit < 0)
+                {
+                    fail("invalid \\u escape");
+                    break;
+                }
+                unicode_value = (unicode_value << 4) | static_cast<uint32_t>(digit);
+                if (++unicode_digits == 4)
+                {
+                    append_code_unit(unicode_value);
+                    state = State::String;
+                }
+                span_start = ++i;
+                break;
+            }
+            case State::Scalar:
+                if (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '+' || c == '.')
+                {
+                    i++;
+                    break;
+                }
+                if (token.empty())
+                {
+                    end_scalar(std::string_view(data + span_start, i - span_start));
+                }
+                else
+                {
+                    token.append(data + span_start, i - span_start);
+                    end_scalar(std::string_view(token));
+                    token.clear();
+                }
+                break; // the terminator is handled by the state end_scalar moved to
+            default:
+                if (c == ' ' || c == '\n' || c == '\r' || c == '\t')
+                {
+                    i++;
+                    break;
+                }
+                structural(c);
+                if (state == State::String)
+                {
+                    span_start = i + 1; // content starts after the opening quote
+                }
+                else if (state == State::Scalar)
+                {
+                    span_start = i; // the scalar includes this character
+                }
+                i++;
+                break;
+            }
+        }
+
+        // Keep the unfinished part of a string or scalar for the next chunk
+        if ((state == State::String || state == State::Scalar) && span_start < length)
+        {
+            token.append(data + span_start, length - span_start);
+        }
+        consumed += length;
+        return state != State::Error;
+    }
+
+    // Signals the end of input; returns true if exactly one complete document was parsed
+    bool finish()
+    {
+        if (state == State::Scalar && depth == 0)
+        {
+            end_scalar(std::string_view(token));
+            token.clear();
+        }
+        if (state != State::Done && state != State::Error)
+        {
+            fail("unexpected end of input");
+        }
+        return state == State::Done;
+    }
+
+    bool failed() const { return state == State::Error; }
+    const std::string &error() const { return error_message; }
+
+private:
+    enum class State
+    {
+        Value,      // expecting any value
+        FirstValue, // expecting a value or ']' right after '['
+        FirstKey,   // expecting a key or '}' right after '{'
+        Key,        // expecting a key after ','
+        Colon,
+        CommaOrEnd,
+        String,
+        Escape,
+        Unicode,
+        Scalar,
+        Done,
+        Error
+    };
+
+    JsonHandler &handler;
+    State state = State::Value;
+    std::vector<bool> frame_is_array;
+    std::vector<std::string> keys; // reused across values so steady-state parsing does not allocate
+    size_t depth = 0;
+    bool string_is_key = false;
+    std::string token;
+    uint32_t unicode_value = 0;
+    int unicode_digits = 0;
+    uint32_t high_surrogate = 0;
+    size_t consumed = 0;
+    std::string error_message;
+
+    JsonPath path() const { return JsonPath{keys.data(), depth}; }
+
+    void fail(const std::string &what)
+    {
+        if (state != State::Error)
+        {
+            error_message = what + " near byte " + std::to_string(consumed);
+            state = State::Error;
+        }
+    }
+
+    static int hex_digit(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Encodes a \u escape as UTF-8, pairing surrogates
+    void append_code_unit(uint32_t unit)
+    {
+        if (unit >= 0xD800 && unit <= 0xDBFF)
+        {
+            high_surrogate = unit;
+            return;
+        }
+        uint32_t cp = unit;
+        if (unit >= 0xDC00 && unit <= 0xDFFF && high_surrogate)
+        {
+            cp = 0x10000 + ((high_surrogate - 0xD800) << 10) + (unit - 0xDC00);
+        }
+        high_surrogate = 0;
+
+        if (cp < 0x80)
+        {
+            token.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800)
+        {
+            token.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000)
+        {
+            token.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            token.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            token.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    void after_value()
+    {
+        state = depth == 0 ? State::Done : State::CommaOrEnd;
+    }
+
+    void begin_container(bool is_array)
+    {
+        handler.on_begin(path(), is_array);
+        if (keys.size() <= depth)
+        {
+            keys.resize(depth + 1);
+        }
+        frame_is_array.resize(depth + 1);
+        frame_is_array[depth] = is_array;
+        depth++;
+        if (is_array)
+        {
+            keys[depth - 1].assign("#");
+        }
+        state = is_array ? State::FirstValue : State::FirstKey;
+    }
+
+    void end_container(bool is_array)
+    {
+        if (depth == 0 || frame_is_array[depth - 1] != is_array)
+        {
+            fail(is_array ? "unexpected ']'" : "unexpected '}'");
+            return;
+        }
+        depth--;
+        handler.on_end(path(), is_array);
+        after_value();
+    }
+
+    void end_string(std::string_view text)
+    {
+        if (string_is_key)
+        {
+            keys[depth - 1].assign(text.data(), text.size());
+            state = State::Colon;
+        }
+        else
+        {
+            handler.on_value(path(), JsonValueType::String, text);
+            after_value();
+        }
+    }
+
+    void end_scalar(std::string_view text)
+    {
+        if (text == "true" || text == "false")
+        {
+            handler.on_value(path(), JsonValueType::Bool, text);
+        }
+        else if (text == "null")
+        {
+            handler.on_value(path(), JsonValueType::Null, text);
+        }
+        else if (!text.empty() && (text[0] == '-' || (text[0] >= '0' && text[0] <= '9')))
+        {
+            handler.on_value(path(), JsonValueType::Number, text);
+        }
+        else
+        {
+            fail("invalid literal");
+            return;
+        }
+        after_value();
+    }
+
+    // Handles a non-whitespace character outside of strings and scalars
+    void structural(char c)
+    {
+        switch (state)
+        {
+        case State::Value:
+        case State::FirstValue:
+            if (c == ']' && state == State::FirstValue)
+                end_container(true);
+            else if (c == '{')
+                begin_container(false);
+            else if (c == '[')
+                begin_container(true);
+            else if (c == '"')
+            {
+                string_is_key = false;
+                state = State::String;
+            }
+            else if (c == '-' || std::isalnum(static_cast<unsigned char>(c)))
+                state = State::Scalar;
+            else
+                fail(std::string("unexpected '") + c + "'");
+            break;
+        case State::FirstKey:
+        case State::Key:
+            if (c == '}' && state == State::FirstKey)
+                end_container(false);
+            else if (c == '"')
+            {
+                string_is_key = true;
+                state = State::String;
+            }
+            else
+                fail("expected object key");
+            break;
+        case State::Colon:
+            if (c == ':')
+                state = State::Value;
+            else
+                fail("expected ':'");
+            break;
+        case State::CommaOrEnd:
+            if (c == ',')
+                state = frame_is_array[depth - 1] ? State::Value : State::Key;
+            else if (c == ']' || c == '}')
+                end_container(c == ']');
+            else
+                fail("expected ',' or end of container");
+            break;
+        default:
+            fail("trailing characters after document");
+            break;
+        }
+    }
+} JsonStreamParser;
+
+// Parses a JSON number view without throwing; leaves value untouched on failure
+bool parse_json_number(std::string_view text, double &value)
+{
+    double parsed = 0.0;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), parsed);
+    if (result.ec != std::errc())
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Streaming decoder for a nearbysearch page; each result is built field by field and appended when its object closes
+typedef struct NearbyPageDecoder : public JsonHandler
+{
+    NearbyPage page;
+    JsonStreamParser parser{*this};
+
+    bool feed(const char *data, size_t length) { return parser.feed(data, length); }
+    bool finish() { return parser.finish(); }
+    size_t results() const { return page.restaurants.size(); }
+    void keep_first(size_t count) { page.restaurants.resize(std::min(count, page.restaurants.size())); }
+
+    void on_begin(const JsonPath &path, bool is_array) override
+    {
+        if (!is_array && path.is({"results", "#"}))
+        {
+            current = restaurant_data();
+            current.address = "Address not available";
+            saw_types = false;
+            saw_open_now = false;
+        }
+        else if (is_array && path.is({"results", "#", "types"}))
+        {
+            saw_types = true;
+        }
+    }
+
+    void on_end(const JsonPath &path, bool is_array) override
+    {
+        if (is_array || !path.is({"results", "#"}))
+        {
+            return;
+        }
+        if (!saw_types)
+        {
+            current.types.push_back("No types available");
+        }
+        derive_cuisine(current);
+        current.current_status = saw_open_now ? (current.hours.open_now ? "Currently open" : "Currently closed") : "Hours not available";
+        current.url = "Not available"; // Website would require a second API call
+        page.restaurants.push_back(std::move(current));
+    }
+
+    void on_value(const JsonPath &path, JsonValueType type, std::string_view text) override
+    {
+        if (path.size == 1)
+        {
+            const std::string &key = path.keys[0];
+            if (key == "status")
+                page.status.assign(text.data(), text.size());
+            else if (key == "next_page_token")
+                page.next_page_token.assign(text.data(), text.size());
+            else if (key == "error_message")
+                page.error_message.assign(text.data(), text.size());
+            return;
+        }
+        if (path.size < 3 || path.keys[0] != "results")
+        {
+            return;
+        }
+
+        const std::string &field = path.keys[2];
+        if (path.size == 3)
+        {
+            if (field == "name")
+                current.name.assign(text.data(), text.size());
+            else if (field == "vicinity")
+                current.address.assign(text.data(), text.size());
+            else if (field == "place_id")
+                current.place_id.assign(text.data(), text.size());
+            else if (field == "rating" && type == JsonValueType::Number)
+                parse_json_number(text, current.rating);
+            else if (field == "business_status")
+                current.is_operational = text != "CLOSED_PERMANENTLY"; // so operational-only queries need no details call
+        }
+        else if (path.is({"results", "#", "types", "#"}))
+        {
+            current.types.emplace_back(text.data(), text.size());
+        }
+        else if (path.is({"results", "#", "geometry", "location", "lat"}) || path.is({"results", "#", "geometry", "location", "lng"}))
+        {
+            double coordinate = 0.0;
+            if (parse_json_number(text, coordinate))
+            {
+                (path.keys[4] == "lat" ? current.location.lat : current.location.lon) = static_cast<float>(coordinate);
+            }
+        }
+        else if (path.is({"results", "#", "opening_hours", "open_now"}) && type == JsonValueType::Bool)
+        {
+            current.hours.open_now = text == "true";
+            saw_open_now = true;
+        }
+    }
+
+private:
+    restaurant_data current;
+    bool saw_types = false;
+    bool saw_open_now = false;
+} NearbyPageDecoder;
+
+// Nearby result whose strings live in an IngestArena instead of owning their own allocations
+typedef struct RestaurantView
+{
+    std::string_view name;
+    std::string_view address = "Address not available";
+    std::string_view place_id;
+    LatLon location;
+    float rating = 0.0f;
+    bool open_now = false;
+    bool saw_open_now = false;
+    uint32_t type_first = 0; // this result's types are arena.types[type_first, type_first + type_count)
+    uint32_t type_count = 0;
+    TypeSet type_bits;
+} RestaurantView;
+
+// Per-query storage for arena-backed ingest. Response bodies are copied into large blocks as they arrive and
+// results point into them, so a whole query costs a few block allocations rather than one per string.
+// Views stay valid until the arena is cleared or destroyed.
+typedef struct IngestArena
+{
+    std::vector<RestaurantView> restaurants;
+    std::vector<std::string_view> types;
+
+    explicit IngestArena(size_t block_size = 128 * 1024) : block_size(block_size)
+    {
+        restaurants.reserve(60); // one full nearbysearch query
+        types.reserve(60 * 6);
+    }
+    IngestArena(const IngestArena &) = delete;
+    IngestArena &operator=(const IngestArena &) = delete;
+
+    // Copies bytes into the arena and returns a view that stays put
+    std::string_view keep(const char *data, size_t length)
+    {
+        if (blocks.empty() || used + length > capacity)
+        {
+            capacity = std::max(block_size, length);
+            blocks.emplace_back(new char[capacity]);
+            used = 0;
+        }
+        char *target = blocks.back().get() + used;
+        std::copy(data, data + length, target);
+        used += length;
+        return std::string_view(target, length);
+    }
+
+    // Forgets every result but keeps the first block, so a reused arena does not allocate again
+    void clear()
+    {
+        restaurants.clear();
+        types.clear();
+        if (blocks.size() > 1)
+        {
+            blocks.resize(1);
+            capacity = block_size;
+        }
+        used = 0;
+    }
+
+private:
+    size_t block_size;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = 0;
+    size_t capacity = 0;
+} IngestArena;
+
+// Streaming nearbysearch decoder for arena-backed ingest. Each chunk is copied into the arena before it is parsed,
+// so plain strings are used as views straight into the copy; only strings that had escapes or crossed a chunk
+// boundary (decoded into the parser's scratch buffer) are copied again.
+typedef struct ArenaNearbyDecoder : public JsonHandler
+{
+    NearbyPage page; // status fields only; results go to the arena
+    JsonStreamParser parser{*this};
+
+    explicit ArenaNearbyDecoder(IngestArena &arena) : arena(arena), first_result(arena.restaurants.size()) {}
+
+    bool feed(const char *data, size_t length)
+    {
+        chunk = arena.keep(data, length);
+        return parser.feed(chunk.data(), chunk.size());
+    }
+    bool finish() { return parser.finish(); }
+    size_t results() const { return arena.restaurants.size() - first_result; }
+    void keep_first(size_t count) { arena.restaurants.resize(first_result + std::min(count, results())); }
+
+    void on_begin(const JsonPath &path, bool is_array) override
+    {
+        if (!is_array && path.is({"results", "#"}))
+        {
+            current = RestaurantView();
+            current.type_first = static_cast<uint32_t>(arena.types.size());
+        }
+    }
+
+    void on_end(const JsonPath &path, bool is_array) override
+    {
+        if (is_array || !path.is({"results", "#"}))
+        {
+            return;
+        }
+        current.type_count = static_cast<uint32_t>(arena.types.size()) - current.type_first;
+        if (current.type_count == 0)
+        {
+            arena.types.push_back("No types available");
+            current.type_count = 1;
+        }
+        arena.restaurants.push_back(current);
+    }
+
+    void on_value(const JsonPath &path, JsonValueType type, std::string_view text) override
+    {
+        if (path.size == 1)
+        {
+            const std::string &key = path.keys[0];
+            if (key == "status")
+                page.status.assign(text.data(), text.size());
+            else if (key == "next_page_token")
+                page.next_page_token.assign(text.data(), text.size());
+            else if (key == "error_message")
+                page.error_message.assign(text.data(), text.size());
+            return;
+        }
+        if (path.size < 3 || path.keys[0] != "results")
+        {
+            return;
+        }
+
+        const std::string &field = path.keys[2];
+        if (path.size == 3)
+        {
+            if (field == "name")
+                current.name = stable(text);
+            else if (field == "vicinity")
+                current.address = stable(text);
+            else if (field == "place_id")
+                current.place_id = stable(text);
+            else if (field == "rating" && type == JsonValueType::Number)
+            {
+                double rating = 0.0;
+                if (parse_json_number(text, rating))
+                    current.rating = static_cast<float>(rating);
+            }
+        }
+        else if (path.is({"results", "#", "types", "#"}))
+        {
+            arena.types.push_back(stable(text));
+            int id = placeTypes.intern(text);
+            if (id < kTypeBits)
+                current.type_bits.set(id);
+        }
+        else if (path.is({"results", "#", "geometry", "location", "lat"}) || path.is({"results", "#", "geometry", "location", "lng"}))
+        {
+            double coordinate = 0.0;
+            if (parse_json_number(text, coordinate))
+            {
+                (path.keys[4] == "lat" ? current.location.lat : current.location.lon) = static_cast<float>(coordinate);
+            }
+        }
+        else if (path.is({"results", "#", "opening_hours", "open_now"}) && type == JsonValueType::Bool)
+        {
+            current.open_now = text == "true";
+            current.saw_open_now = true;
+        }
+    }
+
+private:
+    IngestArena &arena;
+    size_t first_result;
+    std::string_view chunk; // arena copy of the chunk being parsed
+    RestaurantView current;
+
+    // text itself if it points into the arena copy of the current chunk, otherwise a fresh arena copy
+    std::string_view stable(std::string_view text)
+    {
+        if (text.data() >= chunk.data() && text.data() + text.size() <= chunk.data() + chunk.size())
+        {
+            return text;
+        }
+        return arena.keep(text.data(), text.size());
+    }
+} ArenaNearbyDecoder;
+
+// Copies an arena result into a standalone restaurant_data, filled in the same way NearbyPageDecoder does
+restaurant_data to_restaurant_data(const RestaurantView &view, const IngestArena &arena)
+{
+    restaurant_data restaurant;
+    restaurant.name = std::string(view.name);
+    restaurant.address = std::string(view.address);
+    restaurant.place_id = std::string(view.place_id);
+    restaurant.location = view.location;
+    restaurant.rating = view.rating;
+    restaurant.hours.open_now = view.open_now;
+    for (uint32_t t = view.type_first; t < view.type_first + view.type_count; t++)
+    {
+        restaurant.types.emplace_back(arena.types[t]);
+    }
+    derive_cuisine(restaurant);
+    restaurant.current_status = view.saw_open_now ? (view.open_now ? "Currently open" : "Currently closed") : "Hours not available";
+    restaurant.url = "Not available"; // Website would require a second API call
+    return restaurant;
+}
+
+// Streaming decoder for a Place Details response; fields are written straight into the target restaurant
+typedef struct PlaceDetailsDecoder : public JsonHandler
+{
+    // fields is the mask the request asked for; only what it covers is written back, so a narrow request does not
+    // reset the website or status the restaurant already has
+    explicit PlaceDetailsDecoder(restaurant_data &restaurant, const std::string &fields = kDetailsFields)
+        : restaurant(restaurant),
+          asked_url(fields.find("url") != std::string::npos || fields.find("website") != std::string::npos),
+          asked_hours(fields.find("opening_hours") != std::string::npos),
+          asked_status(fields.find("permanently_closed") != std::string::npos) {}
+
+    JsonStreamParser parser{*this};
+
+    bool feed(const char *data, size_t length) { return parser.feed(data, length); }
+
+    // status field of the response, available once the body has been fed
+    const std::string &api_status() const { return status; }
+
+    // Finishes the document and applies the same defaults as the ptree path; returns false on API or parse errors
+    bool finish()
+    {
+        if (!parser.finish())
+        {
+            std::cerr << "JSON parse error: " << parser.error() << std::endl;
+            return false;
+        }
+        if (status != "OK")
+        {
+            std::cerr << "API Error: " << status << std::endl;
+            if (!error_message.empty())
+            {
+                std::cerr << "Error message: " << error_message << std::endl;
+            }
+            return false;
+        }
+
+        if (asked_url)
+        {
+            restaurant.url = saw_website ? website : (saw_url ? url : "Not available");
+        }
+        if (asked_status)
+        {
+            restaurant.is_operational = !permanently_closed;
+        }
+        if (saw_hours)
+        {
+            update_current_status(restaurant);
+        }
+        else if (asked_hours)
+        {
+            restaurant.current_status = "Hours not available";
+        }
+        return true;
+    }
+
+    void on_begin(const JsonPath &path, bool is_array) override
+    {
+        if (!is_array && path.is({"result", "opening_hours"}))
+        {
+            saw_hours = true;
+            restaurant.hours.open_now = false;
+        }
+        else if (!is_array && path.is({"result", "opening_hours", "periods", "#"}))
+        {
+            open_time.clear();
+            close_time = "24:00"; // Open 24 hours unless a close time follows
+            open_day = -1;
+            close_day = -1;
+        }
+    }
+
+    void on_end(const JsonPath &path, bool is_array) override
+    {
+        if (!is_array && path.is({"result", "opening_hours", "periods", "#"}) && !open_time.empty())
+        {
+            restaurant.hours.periods.push_back(std::make_pair(open_time, close_time));
+            add_week_interval(restaurant.hours, open_day, open_time, close_day, close_time);
+        }
+    }
+
+    void on_value(const JsonPath &path, JsonValueType type, std::string_view text) override
+    {
+        if (path.size == 1)
+        {
+            if (path.keys[0] == "status")
+                status.assign(text.data(), text.size());
+            else if (path.keys[0] == "error_message")
+                error_message.assign(text.data(), text.size());
+            return;
+        }
+        if (path.size < 2 || path.keys[0] != "result")
+        {
+            return;
+        }
+
+        if (path.size == 2)
+        {
+            const std::string &field = path.keys[1];
+            if (field == "website")
+            {
+                website.assign(text.data(), text.size());
+                saw_website = true;
+            }
+            else if (field == "url")
+            {
+                url.assign(text.data(), text.size());
+                saw_url = true;
+            }
+            else if (field == "permanently_closed" && type == JsonValueType::Bool)
+            {
+                permanently_closed = text == "true";
+            }
+        }
+        else if (path.is({"result", "opening_hours", "open_now"}) && type == JsonValueType::Bool)
+        {
+            restaurant.hours.open_now = text == "true";
+        }
+        else if (path.is({"result", "opening_hours", "weekday_text", "#"}))
+        {
+            restaurant.hours.weekday_text.emplace_back(text.data(), text.size());
+        }
+        else if (path.is({"result", "opening_hours", "periods", "#", "open", "time"}))
+        {
+            open_time.assign(text.data(), text.size());
+        }
+        else if (path.is({"result", "opening_hours", "periods", "#", "close", "time"}))
+        {
+            close_time.assign(text.data(), text.size());
+        }
+        else if (path.is({"result", "opening_hours", "periods", "#", "open", "day"}) && type == JsonValueType::Number)
+        {
+            double day = -1;
+            open_day = parse_json_number(text, day) ? static_cast<int>(day) : -1;
+        }
+        else if (path.is({"result", "opening_hours", "periods", "#", "close", "day"}) && type == JsonValueType::Number)
+        {
+            double day = -1;
+            close_day = parse_json_number(text, day) ? static_cast<int>(day) : -1;
+        }
+    }
+
+private:
+    restaurant_data &restaurant;
+    std::string status;
+    std::string error_message;
+    std::string website;
+    std::string url;
+    std::string open_time;
+    std::string close_time;
+    int open_day = -1;
+    int close_day = -1;
+    bool saw_website = false;
+    bool saw_url = false;
+    bool saw_hours = false;
+    bool permanently_closed = false;
+    bool asked_url = true;
+    bool asked_hours = true;
+    bool asked_status = true;
+} PlaceDetailsDecoder;
+
+// curl write callback that feeds each chunk straight into a streaming decoder instead of buffering the body
+template <typename Decoder>
+static size_t StreamWriteCallback(void *contents, size_t size, size_t nmemb, Decoder *decoder)
+{
+    size_t newLength = size * nmemb;
+    auto start = std::chrono::steady_clock::now();
+    decoder->feed(static_cast<const char *>(contents), newLength); // errors are reported by finish()
+    decoder->parse_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    decoder->body_bytes += newLength;
+    return newLength;
+}
+
+// DOM-based Place Details parser kept as the reference path for --bench-json; returns false on API or parse errors
+bool parse_place_details_ptree(const std::string &readBuffer, restaurant_data &restaurant)
+{
+    try
+    {
+        // Parse JSON response using Boost property_tree
+        pt::ptree root;
+        std::stringstream ss(readBuffer);
+        pt::read_json(ss, root);
+
+        // Check if the request was successful
+        if (root.get<std::string>("status") == "OK")
+        {
+            const pt::ptree &result = root.get_child("result");
+
+            // Get website URL if available
+            try
+            {
+                restaurant.url = result.get<std::string>("website");
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                try
+                {
+                    restaurant.url = result.get<std::string>("url");
+                }
+                catch (pt::ptree_bad_path &)
+                {
+                    restaurant.url = "Not available";
+                }
+            }
+
+            // Check if place is permanently closed
+            try
+            {
+                restaurant.is_operational = !result.get<bool>("permanently_closed");
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.is_operational = true; // Assume operational if not specified
+            }
+
+            // Get opening hours
+            try
+            {
+                const pt::ptree &opening_hours = result.get_child("opening_hours");
+
+                // Check if open now
+                try
+                {
+                    restaurant.hours.open_now = opening_hours.get<bool>("open_now");
+                }
+                catch (pt::ptree_bad_path &)
+                {
+                    restaurant.hours.open_now = false;
+                }
+
+                // Get weekday text (formatted opening hours)
+                try
+                {
+                    const pt::ptree &weekday_text = opening_hours.get_child("weekday_text");
+                    for (const auto &text_pair : weekday_text)
+                    {
+                        restaurant.hours.weekday_text.push_back(text_pair.second.get_value<std::string>());
+                    }
+                }
+                catch (pt::ptree_bad_path &)
+                {
+                    // No weekday text available
+                }
+
+                // Get detailed period information
+                try
+                {
+                    const pt::ptree &periods = opening_hours.get_child("periods");
+                    for (const auto &period_pair : periods)
+                    {
+                        const pt::ptree &period = period_pair.second;
+
+                        std::string open_time = period.get_child("open").get<std::string>("time");
+                        int open_day = period.get_child("open").get<int>("day", -1);
+
+                        std::string close_time;
+                        int close_day = -1;
+                        try
+                        {
+                            close_time = period.get_child("close").get<std::string>("time");
+                            close_day = period.get_child("close").get<int>("day", -1);
+                        }
+                        catch (pt::ptree_bad_path &)
+                        {
+                            close_time = "24:00"; // Open 24 hours
+                        }
+
+                        restaurant.hours.periods.push_back(std::make_pair(open_time, close_time));
+                        add_week_interval(restaurant.hours, open_day, open_time, close_day, close_time);
+                    }
+                }
+                catch (pt::ptree_bad_path &)
+                {
+                    // No periods available
+                }
+
+                // Determine current status
+                update_current_status(restaurant);
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.current_status = "Hours not available";
+            }
+        }
+        else
+        {
+            std::string status = root.get<std::string>("status");
+            std::cerr << "API Error: " << status << std::endl;
+            try
+            {
+                std::string error_msg = root.get<std::string>("error_message");
+                std::cerr << "Error message: " << error_msg << std::endl;
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                // No error message available
+            }
+            return false;
+        }
+    }
+    catch (pt::json_parser_error &e)
+    {
+        std::cerr << "JSON parse error: " << e.what() << std::endl;
+        return false;
+    }
+    catch (pt::ptree_error &e)
+    {
+        std::cerr << "Property tree error: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+// DOM-based nearbysearch parser kept as the reference path for --bench-json; returns false on parse errors
+bool parse_nearby_page_ptree(const std::string &readBuffer, NearbyPage &page)
+{
+    try
+    {
+        // Parse JSON response using Boost property_tree
+        pt::ptree root;
+        std::stringstream ss(readBuffer);
+        pt::read_json(ss, root);
+
+        page.status = root.get<std::string>("status");
+        page.error_message = root.get<std::string>("error_message", "");
+        page.next_page_token = root.get<std::string>("next_page_token", "");
+        if (page.status != "OK")
+        {
+            return true;
+        }
+
+        // Process each restaurant result
+        for (const auto &pair : root.get_child("results"))
+        {
+            const pt::ptree &place = pair.second;
+
+            // Create a restaurant_data struct for the current restaurant
+            restaurant_data restaurant;
+
+            // Restaurant name
+            restaurant.name = place.get<std::string>("name");
+
+            // Rating (if available)
+            try
+            {
+                restaurant.rating = place.get<double>("rating");
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.rating = 0.0; // Rating not available
+            }
+
+            // Address
+            try
+            {
+                restaurant.address = place.get<std::string>("vicinity");
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.address = "Address not available";
+            }
+
+            // Extract latitude and longitude
+            restaurant.location = LatLon(static_cast<float>(place.get_child("geometry").get_child("location").get<double>("lat")), static_cast<float>(place.get_child("geometry").get_child("location").get<double>("lng")));
+            // Store all types in the restaurant.types vector
+            try
+            {
+                const pt::ptree &type_array = place.get_child("types");
+                for (const auto &type_pair : type_array)
+                {
+                    std::string type_str = type_pair.second.get_value<std::string>();
+                    restaurant.types.push_back(type_str);
+                }
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.types.push_back("No types available");
+            }
+
+            derive_cuisine(restaurant);
+
+            // Check for open_now information in the nearby search results
+            try
+            {
+                const pt::ptree &hours = place.get_child("opening_hours");
+                restaurant.hours.open_now = hours.get<bool>("open_now");
+                restaurant.current_status = restaurant.hours.open_now ? "Currently open" : "Currently closed";
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.current_status = "Hours not available";
+            }
+
+            // Place ID for getting more details
+            try
+            {
+                restaurant.place_id = place.get<std::string>("place_id");
+            }
+            catch (pt::ptree_bad_path &)
+            {
+                restaurant.place_id = "";
+            }
+
+            // Website would require a second API call
+            restaurant.url = "Not available";
+
+            page.restaurants.push_back(restaurant);
+        }
+    }
+    catch (pt::json_parser_error &e)
+    {
+        std::cerr << "JSON parse error: " << e.what() << std::endl;
+        return false;
+    }
+    catch (pt::ptree_error &e)
+    {
+        std::cerr << "Property tree error: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Points a pooled handle at a url whose body is decoded while it downloads
+template <typename Decoder>
+void prepare_streaming(CURL *curl, const std::string &url, Decoder *decoder)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, StreamWriteCallback<Decoder>);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, decoder);
+    apply_timeouts(curl);
+}
+
+// Persistent cache of Place Details results keyed by place_id.
+// Entries carry the unix time they were fetched and are ignored (and evicted) once older than ttl_seconds.
+// The file is a flat binary dump that is rewritten atomically through a temporary file.
+typedef struct DetailsCache
+{
+    int64_t ttl_seconds = 7 * 24 * 3600; // hours and websites rarely change
+    size_t max_entries = 200000;          // oldest entries are evicted beyond this
+    bool enabled = true;                  // benchmarks switch the cache off to measure the network path
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+
+    // Loads the cache file; a missing file just means an empty cache
+    bool load(const std::string &filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        char magic[4] = {};
+        uint32_t version = 0;
+        uint32_t count = 0;
+        file.read(magic, sizeof(magic));
+        read_pod(file, version);
+        read_pod(file, count);
+        if (!file || std::string(magic, 4) != kMagic || version != kVersion)
+        {
+            std::cerr << "Ignoring incompatible details cache " << filename << std::endl;
+            return false;
+        }
+
+        int64_t now = unix_now();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t n = 0; n < count && file; n++)
+        {
+            std::string place_id;
+            Entry entry;
+            uint8_t bits = 0;
+            uint32_t periods = 0;
+            uint32_t lines = 0;
+            uint32_t intervals = 0;
+            read_string(file, place_id);
+            read_pod(file, entry.fetched_at);
+            read_string(file, entry.url);
+            read_pod(file, bits);
+            entry.is_operational = bits & 1;
+            entry.has_hours = bits & 2;
+            read_pod(file, periods);
+            for (uint32_t p = 0; p < periods && file; p++)
+            {
+                std::pair<std::string, std::string> period;
+                read_string(file, period.first);
+                read_string(file, period.second);
+                entry.periods.push_back(std::move(period));
+            }
+            read_pod(file, lines);
+            for (uint32_t l = 0; l < lines && file; l++)
+            {
+                std::string text;
+                read_string(file, text);
+                entry.weekday_text.push_back(std::move(text));
+            }
+            read_pod(file, intervals);
+            if (intervals > 64)
+            {
+                file.setstate(std::ios::failbit); // a week holds at most a few dozen intervals
+            }
+            for (uint32_t i = 0; i < intervals && file; i++)
+            {
+                WeekInterval interval;
+                read_pod(file, interval);
+                entry.week.push_back(interval);
+            }
+
+            if (!file)
+            {
+                std::cerr << "Details cache " << filename << " is truncated; keeping " << entries.size() << " entries" << std::endl;
+                break;
+            }
+            if (now - entry.fetched_at > ttl_seconds)
+            {
+                evictions++;
+                continue;
+            }
+            entries[place_id] = std::move(entry);
+        }
+        return true;
+    }
+
+    // Writes every live entry to filename via a temporary file and rename, so a crash never leaves a torn cache
+    bool save(const std::string &filename)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        evict_oldest_locked();
+
+        std::string temp_name = filename + ".tmp";
+        {
+            std::ofstream file(temp_name, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+            {
+                std::cerr << "Could not write details cache " << temp_name << std::endl;
+                return false;
+            }
+            uint32_t count = static_cast<uint32_t>(entries.size());
+            file.write(kMagic, 4);
+            write_pod(file, kVersion);
+            write_pod(file, count);
+            for (const auto &pair : entries)
+            {
+                const Entry &entry = pair.second;
+                write_string(file, pair.first);
+                write_pod(file, entry.fetched_at);
+                write_string(file, entry.url);
+                write_pod(file, static_cast<uint8_t>((entry.is_operational ? 1 : 0) | (entry.has_hours ? 2 : 0)));
+                write_pod(file, static_cast<uint32_t>(entry.periods.size()));
+                for (const auto &period : entry.periods)
+                {
+                    write_string(file, period.first);
+                    write_string(file, period.second);
+                }
+                write_pod(file, static_cast<uint32_t>(entry.weekday_text.size()));
+                for (const std::string &text : entry.weekday_text)
+                {
+                    write_string(file, text);
+                }
+                write_pod(file, static_cast<uint32_t>(entry.week.size()));
+                for (const WeekInterval &interval : entry.week)
+                {
+                    write_pod(file, interval);
+                }
+            }
+            if (!file)
+            {
+                std::cerr << "Could not write details cache " << temp_name << std::endl;
+                return false;
+            }
+        }
+        return std::rename(temp_name.c_str(), filename.c_str()) == 0;
+    }
+
+    // Fills the detail fields of a restaurant from a fresh entry; returns false on a miss or an expired entry.
+    // open_now is left as reported by nearbysearch since a cached value would be stale.
+    bool lookup(restaurant_data &restaurant)
+    {
+        if (!enabled)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        auto found = entries.find(restaurant.place_id);
+        if (found == entries.end())
+        {
+            misses++;
+            return false;
+        }
+        if (unix_now() - found->second.fetched_at > ttl_seconds)
+        {
+            entries.erase(found);
+            evictions++;
+            misses++;
+            return false;
+        }
+
+        const Entry &entry = found->second;
+        restaurant.url = entry.url;
+        restaurant.is_operational = entry.is_operational;
+        restaurant.hours.periods = entry.periods;
+        restaurant.hours.weekday_text = entry.weekday_text;
+        restaurant.hours.week = entry.week;
+        bool has_hours = entry.has_hours;
+        lock.unlock();
+        hits++;
+
+        if (has_hours)
+        {
+            update_current_status(restaurant);
+        }
+        else
+        {
+            restaurant.current_status = restaurant.is_operational ? "Hours not available" : "Permanently closed";
+        }
+        return true;
+    }
+
+    // Records freshly fetched details for a restaurant
+    void store(const restaurant_data &restaurant)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        Entry entry;
+        entry.fetched_at = unix_now();
+        entry.url = restaurant.url;
+        entry.is_operational = restaurant.is_operational;
+        entry.has_hours = !restaurant.hours.periods.empty() || !restaurant.hours.weekday_text.empty(); // as FLAG_HAS_HOURS
+        entry.periods = restaurant.hours.periods;
+        entry.weekday_text = restaurant.hours.weekday_text;
+        entry.week = restaurant.hours.week;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[restaurant.place_id] = std::move(entry);
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    void print_stats(std::ostream &out) const
+    {
+        out << "Details cache: " << hits.load() << " hits, " << misses.load() << " misses, " << evictions.load() << " evictions" << std::endl;
+    }
+
+private:
+    typedef struct Entry
+    {
+        int64_t fetched_at = 0;
+        std::string url;
+        bool is_operational = true;
+        bool has_hours = false;
+        std::vector<std::pair<std::string, std::string>> periods;
+        std::vector<std::string> weekday_text;
+        std::vector<WeekInterval> week;
+    } Entry;
+
+    static constexpr const char *kMagic = "RFDC";
+    static constexpr uint32_t kVersion = 2; // 2: compiled weekly hours
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+
+    static int64_t unix_now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void evict_oldest_locked()
+    {
+        if (entries.size() <= max_entries)
+        {
+            return;
+        }
+        std::vector<std::pair<int64_t, std::string>> by_age;
+        for (const auto &pair : entries)
+        {
+            by_age.emplace_back(pair.second.fetched_at, pair.first);
+        }
+        size_t excess = entries.size() - max_entries;
+        std::nth_element(by_age.begin(), by_age.begin() + excess, by_age.end());
+        for (size_t i = 0; i < excess; i++)
+        {
+            entries.erase(by_age[i].second);
+            evictions++;
+        }
+    }
+
+    template <typename T>
+    static void write_pod(std::ofstream &file, const T &value) { file.write(reinterpret_cast<const char *>(&value), sizeof(T)); }
+    template <typename T>
+    static void read_pod(std::ifstream &file, T &value) { file.read(reinterpret_cast<char *>(&value), sizeof(T)); }
+
+    static void write_string(std::ofstream &file, const std::string &text)
+    {
+        write_pod(file, static_cast<uint32_t>(text.size()));
+        file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    static void read_string(std::ifstream &file, std::string &text)
+    {
+        uint32_t length = 0;
+        read_pod(file, length);
+        if (!file || length > (1u << 20))
+        {
+            file.setstate(std::ios::failbit);
+            return;
+        }
+        text.resize(length);
+        file.read(&text[0], length);
+    }
+} DetailsCache;
+
+DetailsCache placeDetailsCache;                    // consulted before every details request
+std::string detailsCachePath = ".details_cache"; // next to .env
+
+// Coalesces concurrent identical requests: the first caller for a key becomes its leader and makes the request, callers
+// that arrive while it is in flight wait for the leader's result instead of sending their own. A key is forgotten as
+// soon as its result is published, so this only merges requests that overlap in time (the caches handle the rest).
+template <typename Result>
+struct SingleflightGroup
+{
+    typedef std::shared_future<Result> Waiter;
+
+    std::atomic<uint64_t> leaders{0}; // requests actually made
+    std::atomic<uint64_t> saved{0};   // requests answered by another caller's in-flight request
+
+    // True if the caller now leads key and must call finish(key, ...) exactly once; otherwise waiter is set to the
+    // in-flight request to wait on
+    bool begin(const std::string &key, Waiter &waiter)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = flights.find(key);
+        if (found != flights.end())
+        {
+            saved++;
+            waiter = found->second.waiter;
+            return false;
+        }
+        Flight &flight = flights[key];
+        flight.waiter = flight.result.get_future().share();
+        leaders++;
+        return true;
+    }
+
+    // Publishes the leader's result to every waiter and retires the key
+    void finish(const std::string &key, Result result)
+    {
+        std::promise<Result> promise;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = flights.find(key);
+            if (found == flights.end())
+            {
+                return;
+            }
+            promise = std::move(found->second.result);
+            flights.erase(found);
+        }
+        promise.set_value(std::move(result));
+    }
+
+    // Leadership of one key for the scope of a request. If the leader leaves without publishing (its request threw,
+    // or it returned early) the key is finished with an empty Result, which waiters read as a failure, so no waiter
+    // is left blocked on a leader that is gone.
+    typedef struct Lead
+    {
+        explicit Lead(SingleflightGroup &group) : group(group) {}
+        ~Lead()
+        {
+            if (leading)
+            {
+                group.finish(key, Result());
+            }
+        }
+        Lead(const Lead &) = delete;
+        Lead &operator=(const Lead &) = delete;
+
+        // As SingleflightGroup::begin; true if this now leads flight_key
+        bool begin(const std::string &flight_key, Waiter &waiter)
+        {
+            key = flight_key;
+            leading = group.begin(key, waiter);
+            return leading;
+        }
+
+        // Hands result to the waiters; does nothing unless this leads a key
+        void publish(Result result)
+        {
+            if (leading)
+            {
+                leading = false;
+                group.finish(key, std::move(result));
+            }
+        }
+
+    private:
+        SingleflightGroup &group;
+        std::string key;
+        bool leading = false;
+    } Lead;
+
+    // Runs request under key, or waits for the identical request already running
+    Result run(const std::string &key, const std::function<Result()> &request)
+    {
+        Lead lead(*this);
+        Waiter waiter;
+        if (!lead.begin(key, waiter))
+        {
+            return waiter.get();
+        }
+        Result result = request();
+        lead.publish(result);
+        return result;
+    }
+
+    void print_stats(std::ostream &out, const char *name) const
+    {
+        out << name << " coalescing: " << leaders.load() << " requests made, " << saved.load() << " saved by joining one in flight" << std::endl;
+    }
+
+private:
+    typedef struct Flight
+    {
+        std::promise<Result> result;
+        Waiter waiter;
+    } Flight;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Flight> flights;
+};
+
+// Result of a coalesced details request: the enriched copy of the restaurant, or null if the request failed
+typedef std::shared_ptr<const restaurant_data> DetailsResult;
+SingleflightGroup<DetailsResult> detailsFlights;
+
+// Coalescing key of a details request: the place and the field set asked for
+std::string details_flight_key(const std::string &place_id, const std::string &fields)
+{
+    return place_id + "|" + fields;
+}
+
+// Copies the fields a details response fills (as listed in kDetailsFields) from one record to another
+void copy_details(const restaurant_data &from, restaurant_data &to)
+{
+    to.url = from.url;
+    to.is_operational = from.is_operational;
+    to.hours = from.hours;
+    to.current_status = from.current_status;
+}
+
+// Copy of restaurant for one details response to decode into. The decoder appends to the hours, so a request asking
+// for them starts from empty ones (open_now kept); the copy only replaces the original once its response succeeded.
+restaurant_data details_scratch(const restaurant_data &restaurant, const std::string &fields)
+{
+    restaurant_data scratch = restaurant;
+    if (fields.find("opening_hours") != std::string::npos)
+    {
+        scratch.hours = OpeningHours();
+        scratch.hours.open_now = restaurant.hours.open_now;
+    }
+    return scratch;
+}
+
+// Sends one details request for restaurant (no cache, no coalescing)
+bool request_place_details(restaurant_data &restaurant, const std::string &api_key)
+{
+    // Borrow a pooled handle so the connection to the API is reused
+    HttpClient &client = places_http_client();
+    CURL *curl = client.acquire_handle();
+
+    if (curl)
+    {
+        std::string url = build_place_details_url(restaurant.place_id, api_key);
+
+        int retries = 0;
+        for (int attempt = 0;; attempt++)
+        {
+            if (threadDeadline.expired())
+            {
+                record_abandoned(MetricEndpoint::Details);
+                client.release_handle(curl);
+                return false;
+            }
+            restaurant_data result = details_scratch(restaurant, kDetailsFields);
+            PlaceDetailsDecoder decoder(result);
+            prepare_streaming(curl, url, &decoder);
+
+            // Perform the request once the scheduler admits it
+            placesScheduler.acquire(PlacesEndpoint::Details);
+            CURLcode res = client.perform(curl);
+            pipelineMetrics.record_parse(MetricEndpoint::Details, decoder.parse_ns, decoder.body_bytes);
+            record_timeout(MetricEndpoint::Details, res);
+            RequestOutcome outcome = classify_outcome(curl, res, decoder.api_status());
+            placesScheduler.release(PlacesEndpoint::Details, outcome);
+            if (outcome == RequestOutcome::Throttled && attempt < kMaxThrottleRetries)
+            {
+                continue; // the scheduler holds the retry back until its cool-down has passed
+            }
+            int backoff = requestPolicy.retry_backoff_ms(retries);
+            if (outcome != RequestOutcome::Throttled && is_retryable(curl, res) && retries < requestPolicy.max_retries &&
+                backoff < threadDeadline.remaining_ms())
+            {
+                retries++;
+                pipelineMetrics.retries[static_cast<size_t>(MetricEndpoint::Details)].fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+                continue;
+            }
+            client.release_handle(curl);
+
+            // Check for errors
+            if (res != CURLE_OK)
+            {
+                std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+                return false;
+            }
+
+            if (!decoder.finish())
+            {
+                return false;
+            }
+            copy_details(result, restaurant);
+            placeDetailsCache.store(restaurant);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Function to fetch details for a specific place including opening hours
+bool fetch_place_details(restaurant_data &restaurant, const std::string &api_key)
+{
+    if (restaurant.place_id.empty())
+    {
+        return false;
+    }
+
+    // A fresh cache entry answers without touching the network
+    if (placeDetailsCache.lookup(restaurant))
+    {
+        return true;
+    }
+
+    // So does an identical request another caller already has in flight
+    SingleflightGroup<DetailsResult>::Lead lead(detailsFlights);
+    SingleflightGroup<DetailsResult>::Waiter waiter;
+    if (!lead.begin(details_flight_key(restaurant.place_id, kDetailsFields), waiter))
+    {
+        DetailsResult shared = waiter.get();
+        if (shared)
+        {
+            copy_details(*shared, restaurant);
+        }
+        return shared != nullptr;
+    }
+    bool enriched = request_place_details(restaurant, api_key);
+    lead.publish(enriched ? std::make_shared<const restaurant_data>(restaurant) : nullptr);
+    return enriched;
+}
+
+// One request of the concurrent details engine. A slow request gets a hedge, a second request for the same place, so
+// each decodes into its own copy of the restaurant and only the one answering first is copied back.
+typedef struct DetailsTransfer
+{
+    CURL *curl = nullptr;
+    size_t index = 0; // index of the restaurant being enriched
+    bool hedge = false;
+    std::chrono::steady_clock::time_point started;
+    std::string url;
+    restaurant_data result;
+    std::unique_ptr<PlaceDetailsDecoder> decoder; // fills result while the response streams in
+} DetailsTransfer;
+
+// Requests of one restaurant in fetch_place_details_concurrent: the current one, its hedge, and what is left to retry
+typedef struct DetailsProgress
+{
+    std::unique_ptr<DetailsTransfer> first;
+    std::unique_ptr<DetailsTransfer> hedge;
+    int throttle_retries = 0;
+    int retries = 0;
+    std::chrono::steady_clock::time_point due; // earliest start of the next retry
+} DetailsProgress;
+
+// How fetch_place_details_concurrent treats the details cache and which fields it asks for
+typedef struct DetailsFetchOptions
+{
+    bool use_cache = true;      // answer from fresh cache entries; refreshes turn this off to force a request
+    bool store_results = true;  // write responses back to the cache (only sensible for the full field list)
+    std::string fields = kDetailsFields;
+    std::vector<uint8_t> *enriched = nullptr; // if set, resized to the batch and 1 marks each restaurant that was filled
+} DetailsFetchOptions;
+
+// Fetches details for every restaurant over one curl multi handle with at most max_in_flight requests running at once.
+// Each restaurant is filled as soon as its own response arrives; a failed request is reported and does not cancel the rest.
+// Requests are admitted by placesScheduler, and throttled ones are put back in the queue. A place another caller (or an
+// earlier entry of the same batch) is already fetching with the same fields joins that request instead of sending its own.
+// Under requestPolicy, a request still running at the hedge delay is sent a second time and the first answer wins, a
+// failure safe to repeat is retried after a jittered backoff, and nothing new is sent once the thread's deadline passes.
+// Returns the number of restaurants that were successfully enriched.
+int fetch_place_details_concurrent(std::vector<restaurant_data> &restaurants, const std::string &api_key, int max_in_flight,
+                                   const DetailsFetchOptions &options = DetailsFetchOptions())
+{
+    if (max_in_flight < 1)
+    {
+        max_in_flight = 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    const size_t details = static_cast<size_t>(MetricEndpoint::Details);
+
+    HttpClient &client = places_http_client();
+    CURLM *multi = client.acquire_multi();
+    if (!multi)
+    {
+        std::cerr << "curl_multi_init() failed" << std::endl;
+        return 0;
+    }
+
+    // transfers live behind unique_ptrs so WRITEDATA/PRIVATE pointers stay valid until their request is removed
+    std::vector<DetailsProgress> progress(restaurants.size());
+    std::deque<size_t> queue;       // restaurants waiting for a request
+    std::vector<size_t> backing_off; // restaurants waiting out a retry backoff
+    std::deque<std::pair<size_t, std::chrono::steady_clock::time_point>> unhedged; // first requests by start time
+    int in_flight = 0;
+    int requested = 0;
+    int hedged = 0;
+    int retried = 0;
+    int cached = 0;
+    int succeeded = 0;
+    int joined = 0;
+    if (options.enriched)
+    {
+        options.enriched->assign(restaurants.size(), 0);
+    }
+    std::vector<SingleflightGroup<DetailsResult>::Waiter> waiters(restaurants.size());
+    // set while this call owes detailsFlights a result for restaurant i; failure is published if we unwind first
+    std::vector<std::unique_ptr<SingleflightGroup<DetailsResult>::Lead>> leads(restaurants.size());
+    auto publish = [&](size_t i, bool enriched)
+    {
+        leads[i]->publish(enriched ? std::make_shared<const restaurant_data>(restaurants[i]) : nullptr);
+        leads[i].reset();
+    };
+
+    for (size_t i = 0; i < restaurants.size(); i++)
+    {
+        if (restaurants[i].place_id.empty())
+        {
+            continue;
+        }
+        if (options.use_cache && placeDetailsCache.lookup(restaurants[i]))
+        {
+            if (options.enriched)
+            {
+                (*options.enriched)[i] = 1;
+            }
+            cached++;
+            succeeded++;
+            continue;
+        }
+        std::unique_ptr<SingleflightGroup<DetailsResult>::Lead> lead(new SingleflightGroup<DetailsResult>::Lead(detailsFlights));
+        if (!lead->begin(details_flight_key(restaurants[i].place_id, options.fields), waiters[i]))
+        {
+            continue; // collected after our own requests are done
+        }
+        leads[i] = std::move(lead);
+        queue.push_back(i);
+    }
+
+    // Starts a request for restaurant i once the scheduler has admitted it; false (with the slot released) if no handle
+    auto start_transfer = [&](size_t i, bool hedge) -> bool
+    {
+        std::unique_ptr<DetailsTransfer> transfer(new DetailsTransfer());
+        transfer->curl = client.acquire_handle();
+        if (!transfer->curl)
+        {
+            std::cerr << "curl_easy_init() failed for " << restaurants[i].name << std::endl;
+            placesScheduler.release(PlacesEndpoint::Details, RequestOutcome::Failed);
+            return false;
+        }
+        transfer->index = i;
+        transfer->hedge = hedge;
+        transfer->url = build_place_details_url(restaurants[i].place_id, api_key, options.fields);
+        transfer->result = details_scratch(restaurants[i], options.fields);
+        transfer->decoder.reset(new PlaceDetailsDecoder(transfer->result, options.fields));
+        prepare_streaming(transfer->curl, transfer->url, transfer->decoder.get());
+        curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer.get());
+        curl_multi_add_handle(multi, transfer->curl);
+        transfer->started = std::chrono::steady_clock::now();
+        in_flight++;
+        if (hedge)
+        {
+            progress[i].hedge = std::move(transfer);
+        }
+        else
+        {
+            unhedged.emplace_back(i, transfer->started);
+            progress[i].first = std::move(transfer);
+        }
+        return true;
+    };
+
+    // Takes a request out of the multi handle, finished or not, and frees its scheduler slot
+    auto remove_transfer = [&](std::unique_ptr<DetailsTransfer> &transfer, RequestOutcome outcome)
+    {
+        curl_multi_remove_handle(multi, transfer->curl);
+        client.release_handle(transfer->curl);
+        placesScheduler.release(PlacesEndpoint::Details, outcome);
+        transfer.reset();
+        in_flight--;
+    };
+
+    while (!queue.empty() || !backing_off.empty() || in_flight > 0)
+    {
+        auto now = std::chrono::steady_clock::now();
+        long poll_ms = 1000;
+
+        // Past the deadline nothing new is sent; what is running ends by its own timeout
+        if (threadDeadline.expired())
+        {
+            queue.insert(queue.end(), backing_off.begin(), backing_off.end());
+            backing_off.clear();
+            for (size_t i : queue)
+            {
+                record_abandoned(MetricEndpoint::Details);
+                publish(i, false);
+            }
+            queue.clear();
+        }
+
+        // Retries whose backoff is over go back in the queue
+        for (size_t b = 0; b < backing_off.size();)
+        {
+            size_t i = backing_off[b];
+            if (progress[i].due <= now)
+            {
+                queue.push_back(i);
+                backing_off[b] = backing_off.back();
+                backing_off.pop_back();
+                continue;
+            }
+            poll_ms = std::min<long>(poll_ms, std::chrono::ceil<std::chrono::milliseconds>(progress[i].due - now).count());
+            b++;
+        }
+
+        // Top up the window of in-flight requests as far as the scheduler allows
+        bool admitted = true;
+        while (in_flight < max_in_flight && !queue.empty())
+        {
+            std::chrono::milliseconds retry_after(0);
+            if (!placesScheduler.try_acquire(PlacesEndpoint::Details, retry_after))
+            {
+                poll_ms = std::min<long>(poll_ms, static_cast<long>(retry_after.count()));
+                admitted = false;
+                break;
+            }
+            size_t i = queue.front();
+            queue.pop_front();
+            if (!start_transfer(i, false))
+            {
+                publish(i, false);
+                continue;
+            }
+            requested++;
+        }
+
+        // Hedge the oldest first requests that have run past the hedge delay, with whatever room the window has left
+        int64_t hedge_delay = requestPolicy.hedge_delay_ms(MetricEndpoint::Details);
+        while (hedge_delay >= 0 && !unhedged.empty())
+        {
+            auto [i, started] = unhedged.front();
+            if (!progress[i].first || progress[i].first->started != started || progress[i].hedge)
+            {
+                unhedged.pop_front(); // answered, retried or hedged since
+                continue;
+            }
+            auto hedge_at = started + std::chrono::milliseconds(hedge_delay);
+            if (hedge_at > now)
+            {
+                poll_ms = std::min<long>(poll_ms, std::chrono::ceil<std::chrono::milliseconds>(hedge_at - now).count());
+                break;
+            }
+            if (!requestPolicy.hedge_allowed(MetricEndpoint::Details) || !admitted || in_flight >= max_in_flight || threadDeadline.expired())
+            {
+                break;
+            }
+            std::chrono::milliseconds retry_after(0);
+            if (!placesScheduler.try_acquire(PlacesEndpoint::Details, retry_after))
+            {
+                poll_ms = std::min<long>(poll_ms, static_cast<long>(retry_after.count()));
+                break;
+            }
+            unhedged.pop_front();
+            if (start_transfer(i, true))
+            {
+                hedged++;
+                pipelineMetrics.hedges[details].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (threadDeadline.set())
+        {
+            poll_ms = std::min<long>(poll_ms, static_cast<long>(threadDeadline.remaining_ms()) + 1);
+        }
+        poll_ms = std::max<long>(poll_ms, 1);
+
+        if (in_flight == 0)
+        {
+            // Everything left is waiting on the scheduler or a backoff
+            std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+            continue;
+        }
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK)
+        {
+            std::cerr << "curl_multi_perform() failed: " << curl_multi_strerror(mc) << std::endl;
+            break;
+        }
+
+        // Fill in every restaurant whose response has completed
+        CURLMsg *msg;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi, &msgs_left)))
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+
+            DetailsTransfer *transfer = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            size_t i = transfer->index;
+            DetailsProgress &state = progress[i];
+            bool was_hedge = transfer->hedge;
+            std::unique_ptr<DetailsTransfer> &finished = was_hedge ? state.hedge : state.first;
+            std::unique_ptr<DetailsTransfer> &sibling = was_hedge ? state.first : state.hedge;
+            CURLcode res = msg->data.result;
+
+            pipelineMetrics.record_parse(MetricEndpoint::Details, transfer->decoder->parse_ns, transfer->decoder->body_bytes);
+            client.record_transfer(transfer->curl);
+            record_timeout(MetricEndpoint::Details, res);
+            RequestOutcome outcome = classify_outcome(transfer->curl, res, transfer->decoder->api_status());
+            bool throttled = outcome == RequestOutcome::Throttled;
+            bool retryable = !throttled && is_retryable(transfer->curl, res);
+            std::string failure; // set when the body is not worth decoding
+            if (res != CURLE_OK)
+            {
+                failure = curl_easy_strerror(res);
+            }
+            else if (throttled || retryable)
+            {
+                long http_code = 0;
+                curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &http_code);
+                failure = throttled ? "throttled" : "HTTP " + std::to_string(http_code);
+            }
+            bool enriched = failure.empty() && transfer->decoder->finish();
+            if (enriched)
+            {
+                copy_details(transfer->result, restaurants[i]);
+                if (!was_hedge)
+                {
+                    pipelineMetrics.first_attempt[details].record_since(transfer->started);
+                }
+            }
+            remove_transfer(finished, outcome);
+
+            if (enriched)
+            {
+                if (sibling && !sibling->hedge)
+                {
+                    // The first request lost to its hedge: it took at least this long, which the hedge delay must see
+                    pipelineMetrics.first_attempt[details].record_since(sibling->started);
+                }
+                if (sibling)
+                {
+                    remove_transfer(sibling, RequestOutcome::Failed);
+                }
+                if (was_hedge)
+                {
+                    pipelineMetrics.hedge_wins[details].fetch_add(1, std::memory_order_relaxed);
+                }
+                if (options.store_results)
+                {
+                    placeDetailsCache.store(restaurants[i]);
+                }
+                if (options.enriched)
+                {
+                    (*options.enriched)[i] = 1;
+                }
+                succeeded++;
+                publish(i, true);
+                continue;
+            }
+            if (sibling)
+            {
+                continue; // the other request may still answer
+            }
+
+            int backoff = retryable ? requestPolicy.retry_backoff_ms(state.retries) : 0;
+            if (throttled && state.throttle_retries < kMaxThrottleRetries)
+            {
+                state.throttle_retries++;
+                queue.push_back(i); // try again once the scheduler lets us
+            }
+            else if (retryable && state.retries < requestPolicy.max_retries && backoff < threadDeadline.remaining_ms())
+            {
+                state.retries++;
+                state.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+                backing_off.push_back(i);
+                retried++;
+                pipelineMetrics.retries[details].fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                if (retryable && state.retries < requestPolicy.max_retries)
+                {
+                    threadDeadline.miss(); // a retry was left, but not the time for it
+                }
+                if (!failure.empty())
+                {
+                    std::cerr << "Details request failed for " << restaurants[i].name << ": " << failure << std::endl;
+                }
+                publish(i, false);
+            }
+        }
+
+        if (in_flight > 0)
+        {
+            curl_multi_poll(multi, nullptr, 0, static_cast<int>(poll_ms), nullptr);
+        }
+    }
+
+    // Clean up anything left behind if the loop was aborted
+    for (DetailsProgress &state : progress)
+    {
+        for (std::unique_ptr<DetailsTransfer> *transfer : {&state.first, &state.hedge})
+        {
+            if (*transfer)
+            {
+                remove_transfer(*transfer, RequestOutcome::Failed);
+            }
+        }
+    }
+    client.release_multi(multi);
+
+    // Release our waiters before waiting on anyone else's requests, so two batches joining each other cannot deadlock
+    for (size_t i = 0; i < restaurants.size(); i++)
+    {
+        if (leads[i])
+        {
+            publish(i, false);
+        }
+    }
+    for (size_t i = 0; i < restaurants.size(); i++)
+    {
+        DetailsResult shared = waiters[i].valid() ? waiters[i].get() : nullptr;
+        if (shared)
+        {
+            copy_details(*shared, restaurants[i]);
+            if (options.enriched)
+            {
+                (*options.enriched)[i] = 1;
+            }
+            joined++;
+            succeeded++;
+        }
+    }
+
+    pipelineMetrics.enrich.record_since(start);
+    std::cout << "Fetched details for " << succeeded - cached - joined << "/" << requested << " requests (" << cached << " from cache, "
+              << joined << " joined in flight";
+    if (hedged > 0 || retried > 0)
+    {
+        std::cout << ", " << hedged << " hedged, " << retried << " retried";
+    }
+    std::cout << ")" << std::endl;
+    return succeeded;
+}
+
+
+// Page tokens only become usable a short, variable time after they are issued. This is the current estimate of that
+// delay; it shrinks while tokens keep working on the first try and grows to whatever the last retry needed.
+std::atomic<int> pageTokenDelayMs{1500};
+int pageTokenMinDelayMs = 500; // floor for the estimate; lowered by the local benchmark
+const int kPageTokenRetryMs = 250;
+const int kPageTokenMaxWaitMs = 6000;
+
+// Pagination loop shared by the nearbysearch front ends. make_decoder supplies a fresh decoder per request and
+// on_page receives each successful page (already cut down to limit) while the next page token matures.
+// Returns the number of results delivered.
+template <typename Decoder>
+size_t fetch_nearby_pages(const std::string &location,
+                          int radius, int limit, // -1 for unlimited
+                          const std::string &api_key,
+                          int *api_calls, // incremented once per page requested
+                          bool *complete, // if set, whether the search reached its last page (or limit) with no error or deadline stopping it
+                          const std::function<std::unique_ptr<Decoder>()> &make_decoder,
+                          const std::function<void(Decoder &)> &on_page)
+{
+    size_t total = 0;
+    bool failed = false;
+
+    // Flag to control pagination
+    bool has_more_results = true;
+    std::string next_page_token = "";
+    std::chrono::steady_clock::time_point token_issued;
+    int token_attempts = 0;
+    int throttle_retries = 0;
+    int retries = 0;
+
+    // Keep fetching while there are more results and we haven't hit the limit
+    while (has_more_results && (limit < 0 || total < static_cast<size_t>(limit)))
+    {
+        // Whatever is left of the lookup's time is not enough for another page
+        int wait_ms = next_page_token.empty() ? 0 : pageTokenDelayMs.load() + token_attempts * kPageTokenRetryMs;
+        if (threadDeadline.expired() || (!next_page_token.empty() && token_issued + std::chrono::milliseconds(wait_ms) >= threadDeadline.at))
+        {
+            std::cerr << "Deadline reached; stopping after " << total << " results" << std::endl;
+            record_abandoned(MetricEndpoint::Nearby);
+            failed = true;
+            break;
+        }
+
+        // Borrow a pooled handle for this request
+        HttpClient &client = places_http_client();
+        CURL *curl = client.acquire_handle();
+
+        if (curl)
+        {
+            // Type of place to search for
+            std::string type = "restaurant";
+
+            // Build the URL - either initial request or pagination request
+            std::string url;
+            if (next_page_token.empty())
+            {
+                // Initial request
+                url = placesApiBase + "/nearbysearch/json?"
+                                      "location=" +
+                      location +
+                      "&radius=" + std::to_string(radius) +
+                      "&type=" + type +
+                      "&key=" + api_key;
+            }
+            else
+            {
+                // Pagination request using the next page token
+                url = placesApiBase + "/nearbysearch/json?"
+                                      "pagetoken=" +
+                      next_page_token +
+                      "&key=" + api_key;
+
+                // The token is not usable straight away. Wait out the estimated delay counted from when the token
+                // arrived (so time spent handling the previous page is not wasted), then poll in short steps.
+                std::cout << "Getting next page of results with token..." << std::endl;
+                std::this_thread::sleep_until(token_issued + std::chrono::milliseconds(wait_ms));
+            }
+
+            std::unique_ptr<Decoder> decoder = make_decoder();
+            prepare_streaming(curl, url, decoder.get());
+
+            // Perform the request once the scheduler admits it; the body is decoded as it arrives
+            placesScheduler.acquire(PlacesEndpoint::Nearby);
+            CURLcode res = client.perform(curl);
+            pipelineMetrics.record_parse(MetricEndpoint::Nearby, decoder->parse_ns, decoder->body_bytes);
+            record_timeout(MetricEndpoint::Nearby, res);
+            RequestOutcome outcome = classify_outcome(curl, res, decoder->page.status);
+            placesScheduler.release(PlacesEndpoint::Nearby, outcome);
+            if (api_calls)
+            {
+                (*api_calls)++;
+            }
+
+            // Check for errors
+            int backoff = requestPolicy.retry_backoff_ms(retries);
+            if (outcome == RequestOutcome::Throttled && throttle_retries < kMaxThrottleRetries)
+            {
+                // Over quota: send the same request again after the scheduler's cool-down
+                throttle_retries++;
+                client.release_handle(curl);
+                continue;
+            }
+            else if (outcome != RequestOutcome::Throttled && is_retryable(curl, res) && retries < requestPolicy.max_retries &&
+                     backoff < threadDeadline.remaining_ms())
+            {
+                // Dropped connection, timeout or 5xx: the same GET again after a jittered pause
+                std::cerr << "Nearby search failed (" << (res != CURLE_OK ? curl_easy_strerror(res) : "server error") << "), retrying" << std::endl;
+                retries++;
+                pipelineMetrics.retries[static_cast<size_t>(MetricEndpoint::Nearby)].fetch_add(1, std::memory_order_relaxed);
+                client.release_handle(curl);
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+                continue;
+            }
+            else if (res != CURLE_OK)
+            {
+                std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+                if (is_retryable(curl, res) && retries < requestPolicy.max_retries)
+                {
+                    threadDeadline.miss(); // a retry was left, but not the time for it
+                }
+                client.release_handle(curl);
+                failed = true;
+                break; // Exit the pagination loop on error
+            }
+            else if (!decoder->finish())
+            {
+                std::cerr << "JSON parse error: " << decoder->parser.error() << std::endl;
+                failed = true;
+                has_more_results = false; // Stop on error
+            }
+            else if (!next_page_token.empty() && decoder->page.status == "INVALID_REQUEST" &&
+                     pageTokenDelayMs.load() + (token_attempts + 1) * kPageTokenRetryMs <= kPageTokenMaxWaitMs)
+            {
+                // Token not active yet; poll again shortly
+                token_attempts++;
+                client.release_handle(curl);
+                continue;
+            }
+            else if (decoder->page.status == "OK")
+            {
+                throttle_retries = 0;
+                retries = 0;
+                if (!next_page_token.empty())
+                {
+                    // Adapt the token delay estimate to what this token actually needed
+                    int needed = pageTokenDelayMs.load() + token_attempts * kPageTokenRetryMs;
+                    pageTokenDelayMs = token_attempts == 0 ? std::max(pageTokenMinDelayMs, needed - 100) : needed;
+                    token_attempts = 0;
+                }
+
+                // Keep at most the number of results the caller asked for
+                if (limit > 0 && total + decoder->results() > static_cast<size_t>(limit))
+                {
+                    decoder->keep_first(static_cast<size_t>(limit) - total);
+                }
+                total += decoder->results();
+                std::cout << "Retrieved " << decoder->results() << " restaurants (total: " << total << ")" << std::endl;
+
+                // Continue pagination only if there is a next page token
+                next_page_token = decoder->page.next_page_token;
+                token_issued = std::chrono::steady_clock::now();
+                has_more_results = !next_page_token.empty();
+
+                on_page(*decoder);
+            }
+            else if (decoder->page.status == "ZERO_RESULTS")
+            {
+                has_more_results = false; // nothing (more) there, which is a complete answer
+            }
+            else
+            {
+                std::cerr << "API Error: " << decoder->page.status << std::endl;
+                if (!decoder->page.error_message.empty())
+                {
+                    std::cerr << "Error message: " << decoder->page.error_message << std::endl;
+                }
+                failed = true;
+                has_more_results = false; // Stop on error
+            }
+
+            // Return the handle so the next page reuses its connection
+            client.release_handle(curl);
+        }
+        else
+        {
+            // Failed to initialize curl
+            failed = true;
+            has_more_results = false;
+        }
+    }
+
+    if (complete)
+    {
+        *complete = !failed;
+    }
+    return total;
+}
+
+// Result of a coalesced nearby search: every restaurant it returned, and whether it reached its last page. A search an
+// error or its leader's deadline stopped early is no answer for callers that joined it; they search again.
+typedef struct NearbySearch
+{
+    std::vector<restaurant_data> restaurants;
+    bool complete = false;
+} NearbySearch;
+typedef std::shared_ptr<const NearbySearch> NearbyResult;
+SingleflightGroup<NearbyResult> nearbyFlights;
+
+// Coalescing key of a nearby search: the location rounded to ~1 m, the radius, the place type and the limit
+std::string nearby_flight_key(const std::string &location, int radius, int limit)
+{
+    double lat = std::strtod(location.c_str(), nullptr);
+    size_t comma = location.find(',');
+    double lon = comma == std::string::npos ? 0.0 : std::strtod(location.c_str() + comma + 1, nullptr);
+    char key[96];
+    std::snprintf(key, sizeof(key), "%.5f,%.5f|%d|restaurant|%d", lat, lon, radius, limit);
+    return key;
+}
+
+// Function to fetch nearby restaurants and return them as a vector of restaurant_data structs.
+// If on_page is given, each page is handed to it as soon as it is parsed (while the next page token is still
+// maturing) instead of being collected into the returned vector. A search identical to one already in flight waits
+// for it and gets a copy of its results (handed to on_page as a single page) without any request of its own, unless
+// that search failed or was cut short, in which case this one runs again. complete, if set, reports whether the
+// results are the whole answer (see fetch_nearby_pages).
+std::vector<restaurant_data> fetch_nearby_restaurants(const std::string &location,
+                                                      int radius, int limit, // -1 for unlimited
+                                                      const std::string &api_key,
+                                                      int *api_calls = nullptr, // incremented once per page requested
+                                                      const std::function<void(std::vector<restaurant_data> &)> &on_page = nullptr,
+                                                      bool *complete = nullptr)
+{
+    std::string key = nearby_flight_key(location, radius, limit);
+    SingleflightGroup<NearbyResult>::Lead lead(nearbyFlights);
+    for (int joined = 0; joined < 2; joined++) // after two incomplete answers, search without coalescing
+    {
+        SingleflightGroup<NearbyResult>::Waiter waiter;
+        if (lead.begin(key, waiter))
+        {
+            break;
+        }
+        NearbyResult shared = waiter.get();
+        if (shared && shared->complete)
+        {
+            if (complete)
+            {
+                *complete = true;
+            }
+            std::vector<restaurant_data> restaurants = shared->restaurants;
+            if (on_page && !restaurants.empty())
+            {
+                on_page(restaurants);
+                restaurants.clear();
+            }
+            return restaurants;
+        }
+    }
+
+    std::vector<restaurant_data> restaurants;
+    std::vector<restaurant_data> streamed; // what on_page consumed, kept for callers that joined this search
+    bool reached_end = false;
+    fetch_nearby_pages<NearbyPageDecoder>(
+        location, radius, limit, api_key, api_calls, &reached_end,
+        []()
+        { return std::make_unique<NearbyPageDecoder>(); },
+        [&](NearbyPageDecoder &decoder)
+        {
+            std::vector<restaurant_data> &page = decoder.page.restaurants;
+            if (on_page)
+            {
+                streamed.insert(streamed.end(), page.begin(), page.end());
+                on_page(page);
+            }
+            else
+            {
+                // Move each parsed restaurant into our vector
+                for (restaurant_data &restaurant : page)
+                {
+                    restaurants.push_back(std::move(restaurant));
+                }
+            }
+        });
+    if (complete)
+    {
+        *complete = reached_end;
+    }
+    std::shared_ptr<NearbySearch> search = std::make_shared<NearbySearch>();
+    search->restaurants = on_page ? std::move(streamed) : restaurants;
+    search->complete = reached_end;
+    lead.publish(search);
+    return restaurants;
+}
+
+// Arena-backed variant of fetch_nearby_restaurants: every page's body is kept in the arena and the results are
+// appended to arena.restaurants as views into it. Returns the number of results added.
+size_t fetch_nearby_into_arena(const std::string &location, int radius, int limit, const std::string &api_key,
+                               IngestArena &arena, int *api_calls = nullptr)
+{
+    size_t committed = arena.restaurants.size();
+    fetch_nearby_pages<ArenaNearbyDecoder>(
+        location, radius, limit, api_key, api_calls, nullptr,
+        [&]()
+        {
+            arena.restaurants.resize(committed); // a retried page starts over
+            return std::make_unique<ArenaNearbyDecoder>(arena);
+        },
+        [&](ArenaNearbyDecoder &)
+        { committed = arena.restaurants.size(); });
+    arena.restaurants.resize(committed); // drops anything a failed page left behind
+    return committed;
+}
+
+// Non-blocking event loop for coroutine producers: one curl multi handle drives every transfer started on it from a
+// single thread. Transfers are owned by whoever started them; destroying one takes it off the loop.
+typedef struct FetchLoop
+{
+    typedef struct Transfer
+    {
+        FetchLoop *loop = nullptr;
+        CURL *curl = nullptr;
+        PlacesEndpoint endpoint = PlacesEndpoint::Details;
+        std::string url;
+        bool done = false;
+        CURLcode result = CURLE_OK;
+
+        ~Transfer()
+        {
+            if (curl)
+            {
+                loop->detach(*this); // cancelled while in flight
+                placesScheduler.release(endpoint, RequestOutcome::Failed);
+            }
+        }
+    } Transfer;
+
+    FetchLoop() : multi(places_http_client().acquire_multi()) {}
+    ~FetchLoop() { places_http_client().release_multi(multi); }
+    FetchLoop(const FetchLoop &) = delete;
+    FetchLoop &operator=(const FetchLoop &) = delete;
+
+    // Starts a request if the scheduler admits one right now; otherwise returns null and sets retry_after
+    template <typename Decoder>
+    std::unique_ptr<Transfer> start(PlacesEndpoint endpoint, const std::string &url, Decoder *decoder, std::chrono::milliseconds &retry_after)
+    {
+        if (!multi || !placesScheduler.try_acquire(endpoint, retry_after))
+        {
+            return nullptr;
+        }
+        std::unique_ptr<Transfer> transfer(new Transfer());
+        transfer->loop = this;
+        transfer->endpoint = endpoint;
+        transfer->url = url;
+        transfer->curl = places_http_client().acquire_handle();
+        if (!transfer->curl)
+        {
+            placesScheduler.release(endpoint, RequestOutcome::Failed);
+            retry_after = std::chrono::milliseconds(100);
+            return nullptr;
+        }
+        prepare_streaming(transfer->curl, transfer->url, decoder);
+        curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer.get());
+        curl_multi_add_handle(multi, transfer->curl);
+        return transfer;
+    }
+
+    // Whether a completed transfer (not yet finished) failed in a way worth sending again; throttling is left to the scheduler
+    bool retryable(const Transfer &transfer, const std::string &api_status) const
+    {
+        return classify_outcome(transfer.curl, transfer.result, api_status) != RequestOutcome::Throttled && is_retryable(transfer.curl, transfer.result);
+    }
+
+    // Ends a completed transfer: reports it to the scheduler and hands the handle back to the pool
+    void finish(Transfer &transfer, const std::string &api_status)
+    {
+        RequestOutcome outcome = classify_outcome(transfer.curl, transfer.result, api_status);
+        placesScheduler.release(transfer.endpoint, outcome);
+        places_http_client().record_transfer(transfer.curl);
+        places_http_client().release_handle(transfer.curl);
+        transfer.curl = nullptr;
+    }
+
+    // Moves every transfer along without blocking (decoders see the new bytes) and marks the completed ones done
+    void perform()
+    {
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi, &msgs_left)))
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            Transfer *transfer = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            transfer->done = true;
+            transfer->result = msg->data.result;
+            curl_multi_remove_handle(multi, transfer->curl);
+        }
+    }
+
+    // Blocks until a transfer has activity or timeout_ms has passed
+    void wait(int timeout_ms)
+    {
+        curl_multi_poll(multi, nullptr, 0, std::max(0, timeout_ms), nullptr);
+    }
+
+private:
+    CURLM *multi = nullptr;
+
+    void detach(Transfer &transfer)
+    {
+        if (!transfer.done)
+        {
+            curl_multi_remove_handle(multi, transfer.curl);
+        }
+        places_http_client().release_handle(transfer.curl);
+        transfer.curl = nullptr;
+    }
+} FetchLoop;
+
+// Lazily evaluated stream of restaurants produced by a coroutine running on a FetchLoop.
+// The consumer pulls: poll() resumes the producer once and never blocks on the network, next() waits on the loop
+// until a restaurant arrives. Destroying the stream (or cancel()) stops the producer and aborts its transfers.
+typedef struct RestaurantStream
+{
+    enum class State
+    {
+        Ready,   // a restaurant was handed out
+        Pending, // waiting for the network; call again after FetchLoop::wait
+        Done     // the producer has finished
+    };
+
+    struct promise_type
+    {
+        restaurant_data *current = nullptr; // the value at the producer's co_yield, valid until it is resumed
+        FetchLoop *waiting_on = nullptr;    // set while the producer is suspended on I/O
+        int wait_ms = 0;                    // how long the producer is prepared to wait before it must run again
+
+        RestaurantStream get_return_object() { return RestaurantStream(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(restaurant_data &value) noexcept
+        {
+            current = &value;
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    // co_await-ed by producers to give control back to the consumer until the loop has made progress
+    typedef struct IoWait
+    {
+        FetchLoop &loop;
+        int timeout_ms;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+        {
+            handle.promise().waiting_on = &loop;
+            handle.promise().wait_ms = timeout_ms;
+        }
+        void await_resume() const noexcept { loop.perform(); }
+    } IoWait;
+
+    RestaurantStream() {}
+    explicit RestaurantStream(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    RestaurantStream(RestaurantStream &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    RestaurantStream &operator=(RestaurantStream &&other) noexcept
+    {
+        cancel();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+    ~RestaurantStream() { cancel(); }
+
+    // Resumes the producer once; on Ready the restaurant is moved into out
+    State poll(restaurant_data &out)
+    {
+        if (!handle || handle.done())
+        {
+            return State::Done;
+        }
+        handle.promise().current = nullptr;
+        handle.promise().waiting_on = nullptr;
+        handle.resume();
+        if (handle.done())
+        {
+            return State::Done;
+        }
+        if (handle.promise().current)
+        {
+            out = std::move(*handle.promise().current);
+            return State::Ready;
+        }
+        return State::Pending;
+    }
+
+    // Waits for the next restaurant; false once the stream is exhausted
+    bool next(restaurant_data &out)
+    {
+        State state;
+        while ((state = poll(out)) == State::Pending)
+        {
+            handle.promise().waiting_on->wait(handle.promise().wait_ms);
+        }
+        return state == State::Ready;
+    }
+
+    // Stops the producer where it is suspended; its in-flight transfers are aborted as its frame unwinds
+    void cancel()
+    {
+        if (handle)
+        {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+} RestaurantStream;
+
+// Streams nearby restaurants (and optionally their details) as they are parsed: each result is handed out as soon as
+// its object closes in the nearbysearch response, so the first one arrives with the first bytes of the first page,
+// not after every page. With details, the details requests for a page start while the page is still downloading and
+// each restaurant is handed out when its own details response has been decoded (cache hits go out at once).
+// Everything runs on loop in the consumer's thread; parameters are taken by value because the frame outlives the call.
+// Failures safe to repeat are retried after a backoff, and nothing is sent past the consumer thread's deadline (places
+// still waiting for details are then handed out without them).
+RestaurantStream stream_restaurants(FetchLoop &loop, std::string location, int radius, int limit, std::string api_key,
+                                    bool with_details, int max_details_in_flight = 8)
+{
+    typedef struct DetailsJob
+    {
+        restaurant_data restaurant; // the nearby record, only changed by a details response that succeeded
+        restaurant_data result;     // what the current attempt decodes into (see details_scratch)
+        std::unique_ptr<PlaceDetailsDecoder> decoder;
+        std::unique_ptr<FetchLoop::Transfer> transfer;
+        int throttle_retries = 0;
+        int retries = 0;
+        std::chrono::steady_clock::time_point due; // earliest start of the next retry
+    } DetailsJob;
+
+    size_t handed_out = 0;
+    size_t accepted = 0; // nearby results taken from pages, limit counts these
+    std::deque<std::unique_ptr<DetailsJob>> queued;
+    std::vector<std::unique_ptr<DetailsJob>> backing_off;
+    std::vector<std::unique_ptr<DetailsJob>> in_flight;
+
+    std::unique_ptr<NearbyPageDecoder> page_decoder;
+    std::unique_ptr<FetchLoop::Transfer> page;
+    size_t page_taken = 0;
+    size_t page_handled = 0; // results of next_url already taken by an attempt that then failed; its retry skips them
+    std::string next_url = placesApiBase + "/nearbysearch/json?location=" + location + "&radius=" + std::to_string(radius) +
+                           "&type=restaurant&key=" + api_key;
+    bool paging_token = false;
+    auto page_due = std::chrono::steady_clock::now();
+    int token_attempts = 0;
+    int throttle_retries = 0;
+    int retries = 0;
+
+    while (true)
+    {
+        int wait_ms = 1000;
+        auto now = std::chrono::steady_clock::now();
+
+        // Past the deadline no page or details request is started; waiting places go out as they are
+        if (threadDeadline.expired() || (!page && !next_url.empty() && page_due >= threadDeadline.at))
+        {
+            if (!page && !next_url.empty())
+            {
+                std::cerr << "Deadline reached; no more pages" << std::endl;
+                record_abandoned(MetricEndpoint::Nearby);
+                next_url.clear();
+            }
+            if (threadDeadline.expired())
+            {
+                for (std::unique_ptr<DetailsJob> &job : backing_off)
+                {
+                    queued.push_back(std::move(job));
+                }
+                backing_off.clear();
+                while (!queued.empty())
+                {
+                    std::unique_ptr<DetailsJob> skipped = std::move(queued.front());
+                    queued.pop_front();
+                    record_abandoned(MetricEndpoint::Details);
+                    handed_out++;
+                    co_yield skipped->restaurant;
+                }
+            }
+        }
+
+        // Start the next page once it is due
+        if (!page && !next_url.empty() && now >= page_due)
+        {
+            std::chrono::milliseconds retry_after(0);
+            page_decoder.reset(new NearbyPageDecoder());
+            page = loop.start(PlacesEndpoint::Nearby, next_url, page_decoder.get(), retry_after);
+            page_taken = 0;
+            if (!page)
+            {
+                page_due = now + retry_after;
+            }
+        }
+        if (!page && !next_url.empty())
+        {
+            wait_ms = std::min<int>(wait_ms, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(page_due - now).count()) + 1);
+        }
+
+        // Hand out (or send for details) every result the page decoder has closed so far
+        if (page)
+        {
+            for (; page_taken < page_decoder->results(); page_taken++)
+            {
+                if (page_taken < page_handled)
+                {
+                    continue; // handed out before the previous attempt at this page broke off (the API repeats a page's order)
+                }
+                if (limit >= 0 && accepted >= static_cast<size_t>(limit))
+                {
+                    continue;
+                }
+                accepted++;
+                restaurant_data &restaurant = page_decoder->page.restaurants[page_taken];
+                if (with_details && !restaurant.place_id.empty() && !placeDetailsCache.lookup(restaurant))
+                {
+                    std::unique_ptr<DetailsJob> job(new DetailsJob());
+                    job->restaurant = std::move(restaurant);
+                    queued.push_back(std::move(job));
+                    continue;
+                }
+                restaurant_data ready = std::move(restaurant);
+                handed_out++;
+                co_yield ready;
+            }
+
+            if (page->done)
+            {
+                record_timeout(MetricEndpoint::Nearby, page->result);
+                bool retryable = loop.retryable(*page, page_decoder->page.status);
+                loop.finish(*page, page_decoder->page.status);
+                bool parsed = page_decoder->finish();
+                pipelineMetrics.record_parse(MetricEndpoint::Nearby, page_decoder->parse_ns, page_decoder->body_bytes);
+                const std::string &status = page_decoder->page.status;
+                page_handled = std::max(page_handled, page_taken); // a body cut off after some results still delivered them
+                if (page->result == CURLE_OK && parsed && status == "OK")
+                {
+                    page_handled = 0;
+                    next_url = page_decoder->page.next_page_token.empty() || (limit >= 0 && accepted >= static_cast<size_t>(limit))
+                                   ? ""
+                                   : placesApiBase + "/nearbysearch/json?pagetoken=" + page_decoder->page.next_page_token + "&key=" + api_key;
+                    paging_token = !next_url.empty();
+                    page_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(pageTokenDelayMs.load());
+                    token_attempts = 0;
+                    throttle_retries = 0;
+                    retries = 0;
+                }
+                else if (status == "OVER_QUERY_LIMIT" && throttle_retries < kMaxThrottleRetries)
+                {
+                    throttle_retries++; // same url again once the scheduler lets us
+                }
+                else if (retryable && retries < requestPolicy.max_retries)
+                {
+                    // same url again after a jittered pause; the deadline check above drops it if that is too late
+                    page_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(requestPolicy.retry_backoff_ms(retries++));
+                    pipelineMetrics.retries[static_cast<size_t>(MetricEndpoint::Nearby)].fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (paging_token && status == "INVALID_REQUEST" &&
+                         pageTokenDelayMs.load() + (token_attempts + 1) * kPageTokenRetryMs <= kPageTokenMaxWaitMs)
+                {
+                    token_attempts++; // token not active yet
+                    page_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(kPageTokenRetryMs);
+                }
+                else
+                {
+                    std::cerr << "Nearby search failed: " << (page->result != CURLE_OK ? curl_easy_strerror(page->result) : status) << std::endl;
+                    next_url.clear();
+                }
+                page.reset();
+                continue; // pick up the next page straight away if it is due
+            }
+        }
+
+        // Retries whose backoff is over rejoin the queue
+        for (size_t n = 0; n < backing_off.size();)
+        {
+            if (backing_off[n]->due <= now)
+            {
+                queued.push_back(std::move(backing_off[n]));
+                backing_off.erase(backing_off.begin() + static_cast<std::ptrdiff_t>(n));
+                continue;
+            }
+            wait_ms = std::min<int>(wait_ms, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(backing_off[n]->due - now).count()) + 1);
+            n++;
+        }
+
+        // Keep the details window full
+        while (static_cast<int>(in_flight.size()) < max_details_in_flight && !queued.empty())
+        {
+            DetailsJob &job = *queued.front();
+            std::chrono::milliseconds retry_after(0);
+            job.result = details_scratch(job.restaurant, kDetailsFields);
+            job.decoder.reset(new PlaceDetailsDecoder(job.result));
+            job.transfer = loop.start(PlacesEndpoint::Details, build_place_details_url(job.restaurant.place_id, api_key), job.decoder.get(), retry_after);
+            if (!job.transfer)
+            {
+                wait_ms = std::min<int>(wait_ms, static_cast<int>(retry_after.count()) + 1);
+                break;
+            }
+            in_flight.push_back(std::move(queued.front()));
+            queued.pop_front();
+        }
+
+        // Hand out restaurants whose details have arrived
+        for (size_t n = 0; n < in_flight.size();)
+        {
+            DetailsJob &job = *in_flight[n];
+            if (!job.transfer->done)
+            {
+                n++;
+                continue;
+            }
+            record_timeout(MetricEndpoint::Details, job.transfer->result);
+            bool retryable = loop.retryable(*job.transfer, job.decoder->api_status());
+            loop.finish(*job.transfer, job.decoder->api_status());
+            pipelineMetrics.record_parse(MetricEndpoint::Details, job.decoder->parse_ns, job.decoder->body_bytes);
+            std::unique_ptr<DetailsJob> finished = std::move(in_flight[n]);
+            in_flight.erase(in_flight.begin() + static_cast<std::ptrdiff_t>(n));
+            if (finished->decoder->api_status() == "OVER_QUERY_LIMIT" && finished->throttle_retries < kMaxThrottleRetries)
+            {
+                finished->throttle_retries++;
+                finished->transfer.reset();
+                queued.push_back(std::move(finished));
+                continue;
+            }
+            int backoff = requestPolicy.retry_backoff_ms(finished->retries);
+            if (retryable && finished->retries < requestPolicy.max_retries && backoff < threadDeadline.remaining_ms())
+            {
+                finished->retries++;
+                finished->due = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+                finished->transfer.reset();
+                pipelineMetrics.retries[static_cast<size_t>(MetricEndpoint::Details)].fetch_add(1, std::memory_order_relaxed);
+                backing_off.push_back(std::move(finished));
+                continue;
+            }
+            if (finished->transfer->result == CURLE_OK && finished->decoder->finish())
+            {
+                copy_details(finished->result, finished->restaurant);
+                placeDetailsCache.store(finished->restaurant);
+            }
+            handed_out++;
+            co_yield finished->restaurant; // the nearby record as it came if every attempt failed
+        }
+
+        if (!page && next_url.empty() && queued.empty() && backing_off.empty() && in_flight.empty())
+        {
+            break;
+        }
+        if (threadDeadline.set())
+        {
+            wait_ms = static_cast<int>(std::min<int64_t>(wait_ms, threadDeadline.remaining_ms() + 1));
+        }
+        co_await RestaurantStream::IoWait{loop, wait_ms};
+    }
+}
+
+// Reads a whole file (used for recorded API payloads)
+std::string read_file(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+// Runs parse() iterations times and returns the average wall time of one call in microseconds
+template <typename ParseFn>
+double time_per_call_us(int iterations, ParseFn parse)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        parse();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// Feeds a payload to a decoder in curl-sized chunks, like StreamWriteCallback does during a transfer
+template <typename Decoder>
+void feed_in_chunks(Decoder &decoder, const std::string &payload, size_t chunk_size)
+{
+    for (size_t offset = 0; offset < payload.size(); offset += chunk_size)
+    {
+        decoder.feed(payload.data() + offset, std::min(chunk_size, payload.size() - offset));
+    }
+}
+
+// Microbenchmark of the ptree DOM path against the streaming decoders on recorded payloads
+int run_json_benchmark(const std::string &nearby_file, const std::string &details_file, int iterations)
+{
+    const size_t chunk_size = 16384; // CURL_MAX_WRITE_SIZE
+    std::string nearby_payload = read_file(nearby_file);
+    std::string details_payload = details_file.empty() ? "" : read_file(details_file);
+    if (nearby_payload.empty())
+    {
+        std::cerr << "Could not read " << nearby_file << std::endl;
+        return 1;
+    }
+
+    // Both paths must agree before their timings mean anything
+    NearbyPage reference;
+    NearbyPageDecoder check;
+    feed_in_chunks(check, nearby_payload, 7); // tiny chunks exercise tokens split across boundaries
+    if (!parse_nearby_page_ptree(nearby_payload, reference) || !check.finish() ||
+        reference.restaurants.size() != check.page.restaurants.size())
+    {
+        std::cerr << "Streaming and ptree results differ for " << nearby_file << std::endl;
+        return 1;
+    }
+
+    size_t sink = 0;
+    double ptree_us = time_per_call_us(iterations, [&]()
+                                       {
+        NearbyPage page;
+        parse_nearby_page_ptree(nearby_payload, page);
+        sink += page.restaurants.size(); });
+    double stream_us = time_per_call_us(iterations, [&]()
+                                        {
+        NearbyPageDecoder decoder;
+        feed_in_chunks(decoder, nearby_payload, chunk_size);
+        decoder.finish();
+        sink += decoder.page.restaurants.size(); });
+
+    std::cout << "nearbysearch (" << nearby_payload.size() << " bytes, " << reference.restaurants.size() << " results, " << iterations << " iterations)" << std::endl;
+    std::cout << "  ptree:     " << ptree_us << " us/parse" << std::endl;
+    std::cout << "  streaming: " << stream_us << " us/parse (" << ptree_us / stream_us << "x)" << std::endl;
+
+    if (!details_payload.empty())
+    {
+        double details_ptree_us = time_per_call_us(iterations, [&]()
+                                                   {
+            restaurant_data restaurant;
+            parse_place_details_ptree(details_payload, restaurant);
+            sink += restaurant.hours.weekday_text.size(); });
+        double details_stream_us = time_per_call_us(iterations, [&]()
+                                                    {
+            restaurant_data restaurant;
+            PlaceDetailsDecoder decoder(restaurant);
+            feed_in_chunks(decoder, details_payload, chunk_size);
+            decoder.finish();
+            sink += restaurant.hours.weekday_text.size(); });
+
+        std::cout << "details (" << details_payload.size() << " bytes)" << std::endl;
+        std::cout << "  ptree:     " << details_ptree_us << " us/parse" << std::endl;
+        std::cout << "  streaming: " << details_stream_us << " us/parse (" << details_ptree_us / details_stream_us << "x)" << std::endl;
+    }
+
+    return sink == 0 ? 1 : 0;
+}
+
+// "h:mm AM" as written in weekday_text
+std::string format_12h(int minutes)
+{
+    int hour = (minutes / 60) % 24;
+    std::stringstream ss;
+    ss << (hour % 12 == 0 ? 12 : hour % 12) << ":" << std::setfill('0') << std::setw(2) << minutes % 60 << (hour < 12 ? " AM" : " PM");
+    return ss.str();
+}
+
+// Gives a synthetic restaurant plausible hours: one in twenty open around the clock, the rest open mid-morning to
+// evening with a closed day now and then. Periods, weekday_text and the compiled week are filled consistently.
+void add_synthetic_hours(OpeningHours &hours, std::mt19937 &rng)
+{
+    static const char *days[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+    if (rng() % 20 == 0)
+    {
+        hours.periods.push_back(std::make_pair("0000", "24:00"));
+        add_week_interval(hours, 0, "0000", -1, "");
+        for (const char *day : days)
+            hours.weekday_text.push_back(std::string(day) + ": Open 24 hours");
+        return;
+    }
+    int open = (6 + static_cast<int>(rng() % 7)) * 60 + (rng() % 2 ? 30 : 0);
+    int close = (17 + static_cast<int>(rng() % 7)) * 60 + (rng() % 2 ? 30 : 0);
+    for (int day = 0; day < 7; day++)
+    {
+        if (rng() % 7 == 0)
+        {
+            hours.weekday_text.push_back(std::string(days[day]) + ": Closed");
+            continue;
+        }
+        char open_time[8], close_time[8];
+        std::snprintf(open_time, sizeof(open_time), "%02d%02d", open / 60, open % 60);
+        std::snprintf(close_time, sizeof(close_time), "%02d%02d", close / 60, close % 60);
+        hours.periods.push_back(std::make_pair(open_time, close_time));
+        add_week_interval(hours, day, open_time, day, close_time);
+        hours.weekday_text.push_back(std::string(days[day]) + ": " + format_12h(open) + " \u2013 " + format_12h(close));
+    }
+}
+
+// Fills a store with count synthetic restaurants spread over a ~20 km square around downtown Toronto
+void fill_synthetic_store(RestaurantStore &store, size_t count, unsigned seed)
+{
+    static const char *kSyntheticTypes[] = {"sushi_restaurant", "pizza_restaurant", "cafe", "bar", "vegan_restaurant",
+                                            "thai_restaurant", "bakery", "fast_food_restaurant"};
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> lat(43.60f, 43.78f);
+    std::uniform_real_distribution<float> lon(-79.52f, -79.27f);
+    std::uniform_int_distribution<int> rating_tenths(0, 50);
+    std::uniform_int_distribution<int> type_pick(0, 7);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        restaurant_data restaurant;
+        restaurant.name = "Synthetic " + std::to_string(i);
+        restaurant.place_id = "synthetic-" + std::to_string(i);
+        restaurant.location = LatLon(lat(rng), lon(rng));
+        restaurant.rating = rating_tenths(rng) / 10.0;
+        restaurant.types = {kSyntheticTypes[type_pick(rng)], "restaurant", "food"};
+        if (rng() % 4 == 0)
+        {
+            restaurant.types.push_back(kSyntheticTypes[type_pick(rng)]);
+        }
+        restaurant.hours.open_now = rng() % 2 == 0;
+        restaurant.is_operational = rng() % 20 != 0;
+        add_synthetic_hours(restaurant.hours, rng);
+        store.add(std::move(restaurant));
+    }
+}
+
+// Benchmark of the grid index on synthetic points: build time plus radius, box and k-nearest query latency,
+// with results checked against a linear scan
+int run_spatial_benchmark(size_t count)
+{
+    RestaurantStore store;
+    fill_synthetic_store(store, count, 42);
+
+    SpatialIndex index;
+    auto build_start = std::chrono::steady_clock::now();
+    index.build(store);
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> lat(43.62f, 43.76f);
+    std::uniform_real_distribution<float> lon(-79.50f, -79.29f);
+    const int queries = 10000;
+    std::vector<LatLon> centers;
+    for (int q = 0; q < queries; q++)
+    {
+        centers.push_back(LatLon(lat(rng), lon(rng)));
+    }
+
+    RestaurantFilter sushi_open;
+    sushi_open.require_type("sushi_restaurant");
+    sushi_open.open_now_only = true;
+
+    // Validate a sample of queries against brute force before timing anything
+    for (int q = 0; q < 50; q++)
+    {
+        size_t brute_radius = 0;
+        std::vector<std::pair<double, uint32_t>> brute_nearest;
+        for (uint32_t i = 0; i < store.size(); i++)
+        {
+            double d = distance_meters(centers[q].lat, centers[q].lon, store.lat[i], store.lon[i]);
+            if (d <= 300.0)
+                brute_radius++;
+            if (matches_filter(store, i, sushi_open))
+                brute_nearest.emplace_back(d, i);
+        }
+        std::sort(brute_nearest.begin(), brute_nearest.end());
+        std::vector<uint32_t> nearest = index.nearest(centers[q], 5, sushi_open);
+        bool nearest_ok = nearest.size() == std::min<size_t>(5, brute_nearest.size());
+        for (size_t n = 0; nearest_ok && n < nearest.size(); n++)
+        {
+            nearest_ok = nearest[n] == brute_nearest[n].second;
+        }
+        if (index.within_radius(centers[q], 300.0).size() != brute_radius || !nearest_ok)
+        {
+            std::cerr << "Spatial index disagrees with linear scan on query " << q << std::endl;
+            return 1;
+        }
+    }
+
+    size_t sink = 0;
+    double radius_us = time_per_call_us(queries, [&, q = 0]() mutable
+                                        { sink += index.within_radius(centers[q++], 300.0).size(); });
+    double box_us = time_per_call_us(queries, [&, q = 0]() mutable
+                                     {
+        LatLon c = centers[q++];
+        sink += index.within_box(LatLon(c.lat - 0.0025f, c.lon - 0.0035f), LatLon(c.lat + 0.0025f, c.lon + 0.0035f)).size(); });
+    double nearest_us = time_per_call_us(queries, [&, q = 0]() mutable
+                                         { sink += index.nearest(centers[q++], 5, sushi_open).size(); });
+    double scan_us = time_per_call_us(100, [&, q = 0]() mutable
+                                      {
+        LatLon c = centers[q++];
+        for (uint32_t i = 0; i < store.size(); i++)
+            sink += distance_meters(c.lat, c.lon, store.lat[i], store.lon[i]) <= 300.0; });
+
+    // "vegan AND bar" over the whole store: type bitsets against comparing the type strings
+    auto has_type = [&](uint32_t i, const char *type)
+    {
+        const std::vector<std::string> &types = store[i].types;
+        return std::find(types.begin(), types.end(), type) != types.end();
+    };
+    TypeSet vegan_bar = type_set({"vegan_restaurant", "bar"});
+    std::vector<uint32_t> matches;
+    size_t string_matches = 0;
+    for (uint32_t i = 0; i < store.size(); i++)
+        string_matches += has_type(i, "vegan_restaurant") && has_type(i, "bar");
+    if (restaurants_with_types(store, vegan_bar, matches) != string_matches)
+    {
+        std::cerr << "Type bitsets disagree with the type strings" << std::endl;
+        return 1;
+    }
+    double bits_us = time_per_call_us(100, [&]()
+                                      { sink += restaurants_with_types(store, vegan_bar, matches); });
+    double strings_us = time_per_call_us(20, [&]()
+                                         {
+        for (uint32_t i = 0; i < store.size(); i++)
+            sink += has_type(i, "vegan_restaurant") && has_type(i, "bar"); });
+
+    std::cout << "spatial index over " << count << " synthetic restaurants (build " << build_ms << " ms)" << std::endl;
+    std::cout << "  radius 300 m:              " << radius_us << " us/query" << std::endl;
+    std::cout << "  ~550 m box:                " << box_us << " us/query" << std::endl;
+    std::cout << "  5 nearest open sushi:      " << nearest_us << " us/query" << std::endl;
+    std::cout << "  linear scan radius 300 m:  " << scan_us << " us/query" << std::endl;
+    std::cout << "  vegan AND bar, bitsets:    " << bits_us << " us/query (" << matches.size() << " matches)" << std::endl;
+    std::cout << "  vegan AND bar, strings:    " << strings_us << " us/query" << std::endl;
+    return sink == 0 ? 1 : 0;
+}
+
+// "open at" answered the way the status code used to: find the day's weekday_text line and parse its times.
+// Only handles the single-span lines add_synthetic_hours writes; used as the baseline in run_hours_benchmark.
+bool open_at_from_weekday_text(const OpeningHours &hours, int week_minute)
+{
+    static const char *days[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+    std::string day = days[week_minute / kMinutesPerDay];
+    int minute = week_minute % kMinutesPerDay;
+    for (const std::string &text : hours.weekday_text)
+    {
+        if (text.compare(0, day.size(), day) != 0)
+            continue;
+        if (text.find("Closed") != std::string::npos)
+            return false;
+        if (text.find("Open 24 hours") != std::string::npos)
+            return true;
+        size_t dash = text.find("\u2013");
+        if (dash == std::string::npos)
+            return false;
+        int times[2];
+        size_t starts[2] = {day.size() + 2, dash + std::string("\u2013").size() + 1};
+        for (int t = 0; t < 2; t++)
+        {
+            int hour = 0, min = 0;
+            char half[3] = {};
+            std::sscanf(text.c_str() + starts[t], "%d:%d %2s", &hour, &min, half);
+            times[t] = (hour % 12 + (half[0] == 'P' ? 12 : 0)) * 60 + min;
+        }
+        return minute >= times[0] && minute < times[1];
+    }
+    return false;
+}
+
+// Benchmark of the "open at time T" query over count synthetic restaurants: the compiled hours columns against
+// the compiled per-record hours and the weekday_text parsing it replaces, all checked to agree
+int run_hours_benchmark(size_t count)
+{
+    RestaurantStore store;
+    fill_synthetic_store(store, count, 42);
+
+    // Validate every hour of the week before timing anything
+    std::vector<uint32_t> open;
+    for (int minute = 0; minute < kMinutesPerWeek; minute += 60 + 7)
+    {
+        restaurants_open_at(store, minute, open);
+        size_t from_records = 0;
+        size_t from_text = 0;
+        for (uint32_t i = 0; i < store.size(); i++)
+        {
+            from_records += is_open_at(store[i].hours.week, minute);
+            from_text += open_at_from_weekday_text(store[i].hours, minute);
+        }
+        if (open.size() != from_records || open.size() != from_text)
+        {
+            std::cerr << "Open-at query disagrees with the reference paths at week minute " << minute << std::endl;
+            return 1;
+        }
+    }
+
+    int friday_late = week_minute(5, 22, 30);
+    size_t sink = 0;
+    double columns_us = time_per_call_us(200, [&]()
+                                         { sink += restaurants_open_at(store, friday_late, open); });
+    double records_us = time_per_call_us(50, [&]()
+                                         {
+        for (uint32_t i = 0; i < store.size(); i++)
+            sink += is_open_at(store[i].hours.week, friday_late); });
+    double text_us = time_per_call_us(5, [&]()
+                                      {
+        for (uint32_t i = 0; i < store.size(); i++)
+            sink += open_at_from_weekday_text(store[i].hours, friday_late); });
+    double now_us = time_per_call_us(200, [&]()
+                                     { sink += restaurants_open_at(store, current_week_minute(), open); });
+
+    std::cout << "open-at query over " << count << " synthetic restaurants (" << open.size() << " open now)" << std::endl;
+    std::cout << "  Friday 22:30, hours columns:   " << columns_us << " us/query" << std::endl;
+    std::cout << "  Friday 22:30, per record:      " << records_us << " us/query" << std::endl;
+    std::cout << "  Friday 22:30, weekday_text:    " << text_us << " us/query" << std::endl;
+    std::cout << "  now, hours columns:            " << now_us << " us/query" << std::endl;
+    return sink == 0 ? 1 : 0;
+}
+
+// Ingest throughput of the type and rating indices on synthetic restaurants, for 1..max_threads workers: the old
+// single-lock maps (one insert per place) against the sharded index (private batches merged per shard). The sharded
+// ingest is then repeated with a reader taking snapshots throughout, and every snapshot is checked for consistency.
+int run_ingest_benchmark(size_t count, int max_threads)
+{
+    RestaurantStore store;
+    fill_synthetic_store(store, count, 42);
+    const uint32_t kChunk = 256; // places per batch, about what one swept area yields
+
+    // Runs `threads` workers over the store in kChunk ranges; returns seconds
+    auto run_workers = [&](int threads, const std::function<void(uint32_t, uint32_t)> &ingest)
+    {
+        std::atomic<uint32_t> next{0};
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int w = 0; w < threads; w++)
+        {
+            workers.emplace_back([&]()
+                                 {
+                for (uint32_t first = next.fetch_add(kChunk); first < store.size(); first = next.fetch_add(kChunk))
+                    ingest(first, std::min<uint32_t>(first + kChunk, store.size())); });
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::cout << "type + rating index ingest of " << count << " synthetic restaurants (" << std::thread::hardware_concurrency()
+              << " hardware threads)" << std::endl;
+    bool consistent = true;
+    for (int threads = 1; threads <= std::max(1, max_threads); threads *= 2)
+    {
+        // Single-lock maps, as every worker would have to share them before
+        std::unordered_map<std::string, std::vector<uint32_t>> type_map;
+        std::unordered_map<std::string, std::vector<uint32_t>> rating_map;
+        std::mutex map_mutex;
+        double locked_s = run_workers(threads, [&](uint32_t first, uint32_t end)
+                                      {
+            for (uint32_t index = first; index < end; index++)
+            {
+                std::lock_guard<std::mutex> lock(map_mutex);
+                for (const std::string &type : store[index].types)
+                    type_map[type].push_back(index);
+                rating_map[rating_bucket(store[index].rating)].push_back(index);
+            } });
+
+        // Sharded index. Workers take their range from the shared counter but begin it under a lock, in index order,
+        // as enrich_and_store does under the store lock.
+        double sharded_s = 0.0;
+        size_t snapshots = 0;
+        for (bool with_reader : {false, true})
+        {
+            RestaurantIndex index;
+            std::mutex assign_mutex;
+            uint32_t assigned = 0;
+            std::atomic<bool> ingesting{true};
+            std::thread reader;
+            if (with_reader)
+            {
+                reader = std::thread([&]()
+                                     {
+                    std::vector<uint32_t> all, typed;
+                    while (ingesting)
+                    {
+                        RestaurantIndex::Snapshot snapshot = index.snapshot();
+                        snapshot.of_type("restaurant", all); // every synthetic place has this type
+                        snapshot.of_type("sushi_restaurant", typed);
+                        if (all.size() != snapshot.visible || typed.size() > all.size())
+                            consistent = false;
+                        snapshots++;
+                    } });
+            }
+            double elapsed_s = run_workers(threads, [&](uint32_t, uint32_t)
+                                           {
+                uint32_t first, end;
+                {
+                    std::lock_guard<std::mutex> lock(assign_mutex);
+                    first = assigned;
+                    end = assigned = std::min<uint32_t>(first + kChunk, store.size());
+                    index.watermark.begin(first, end);
+                }
+                index.index_range(store, first, end); });
+            ingesting = false;
+            if (reader.joinable())
+            {
+                reader.join();
+            }
+            if (!with_reader)
+            {
+                sharded_s = elapsed_s;
+            }
+
+            std::vector<uint32_t> check;
+            for (const auto &entry : type_map)
+            {
+                if (index.snapshot().of_type(entry.first, check) != entry.second.size())
+                    consistent = false;
+            }
+        }
+        std::cout << "  " << threads << " thread" << (threads > 1 ? "s" : " ") << ":  single lock " << static_cast<int>(count / locked_s / 1000)
+                  << "k places/s, sharded " << static_cast<int>(count / sharded_s / 1000) << "k places/s (" << snapshots
+                  << " snapshots checked during a second run)" << std::endl;
+    }
+    if (!consistent)
+    {
+        std::cerr << "Sharded index snapshot was inconsistent" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Counters reported by sweep_area
+typedef struct SweepStats
+{
+    int tiles = 0;              // tiles queried
+    int splits = 0;             // tiles that hit the 60-result cap and were subdivided
+    int api_calls = 0;          // nearbysearch pages requested
+    int duplicates_dropped = 0; // results already seen from an overlapping tile
+    int failed_tiles = 0;       // tiles whose search an error or the deadline stopped early; the area is not fully covered
+    size_t unique_places = 0;
+} SweepStats;
+
+// Square tile of the sweep, queried through the circle that circumscribes it
+typedef struct SweepTile
+{
+    double lat;
+    double lon;
+    double half_side_m;
+} SweepTile;
+
+// Covers the circle of radius_m around (lat, lon) with square tiles and gets past the 60-result cap of a single query.
+// A tile whose query comes back full is split into four quadrants (down to min_half_side_m), tiles run concurrently on
+// up to max_workers threads, and results are deduplicated by place_id across the overlapping tiles.
+std::vector<restaurant_data> sweep_area(double lat, double lon, double radius_m, const std::string &api_key,
+                                        int max_workers, double min_half_side_m, SweepStats &stats)
+{
+    const size_t kFullQuery = 60; // three pages of 20; anything less means the tile was fully covered
+    std::vector<restaurant_data> found;
+    std::unordered_set<std::string> seen;
+    std::deque<SweepTile> pending = {SweepTile{lat, lon, radius_m}};
+    int active = 0;
+    std::mutex mutex;
+    std::condition_variable wake;
+    Deadline deadline = threadDeadline; // the caller's, carried onto the workers
+
+    auto worker = [&]()
+    {
+        DeadlineScope scope(deadline);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]()
+                      { return !pending.empty() || active == 0; });
+            if (pending.empty())
+            {
+                return; // nothing queued and nobody left who could queue more
+            }
+            SweepTile tile = pending.front();
+            pending.pop_front();
+            active++;
+            lock.unlock();
+
+            std::ostringstream location;
+            location << std::setprecision(9) << tile.lat << "," << tile.lon;
+            int calls = 0;
+            bool complete = false;
+            int query_radius = static_cast<int>(std::ceil(tile.half_side_m * std::sqrt(2.0)));
+            std::vector<restaurant_data> results = fetch_nearby_restaurants(location.str(), query_radius, -1, api_key, &calls, nullptr, &complete);
+
+            lock.lock();
+            stats.tiles++;
+            stats.api_calls += calls;
+            if (!complete)
+            {
+                stats.failed_tiles++;
+            }
+            if (results.size() >= kFullQuery && tile.half_side_m / 2 >= min_half_side_m)
+            {
+                // The tile was truncated; cover it again with four smaller tiles
+                stats.splits++;
+                double half = tile.half_side_m / 2;
+                double dlat = half / (kEarthRadiusMeters * kDegToRad);
+                double dlon = dlat / std::max(0.01, std::cos(tile.lat * kDegToRad));
+                for (int quadrant = 0; quadrant < 4; quadrant++)
+                {
+                    SweepTile child{tile.lat + (quadrant & 1 ? dlat : -dlat), tile.lon + (quadrant & 2 ? dlon : -dlon), half};
+                    // Skip quadrants whose circle misses the sweep area entirely
+                    if (distance_meters(lat, lon, child.lat, child.lon) <= radius_m + half * std::sqrt(2.0))
+                    {
+                        pending.push_back(child);
+                    }
+                }
+            }
+            for (restaurant_data &restaurant : results)
+            {
+                if (distance_meters(lat, lon, restaurant.location.lat, restaurant.location.lon) > radius_m)
+                {
+                    continue; // corner of a tile circle outside the requested area
+                }
+                if (!restaurant.place_id.empty() && !seen.insert(restaurant.place_id).second)
+                {
+                    stats.duplicates_dropped++;
+                    continue;
+                }
+                found.push_back(std::move(restaurant));
+            }
+            active--;
+            wake.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < std::max(1, max_workers); w++)
+    {
+        workers.emplace_back(worker);
+    }
+    for (std::thread &thread : workers)
+    {
+        thread.join();
+    }
+
+    stats.unique_places = found.size();
+    std::cout << "Sweep: " << stats.tiles << " tiles (" << stats.splits << " split), " << stats.api_calls << " API calls, "
+              << stats.duplicates_dropped << " duplicates dropped, " << stats.unique_places << " unique places";
+    if (stats.failed_tiles > 0)
+    {
+        std::cout << ", " << stats.failed_tiles << " tiles failed";
+    }
+    if (stats.unique_places > 0)
+    {
+        std::cout << " (" << static_cast<double>(stats.api_calls) / stats.unique_places << " calls per place)";
+    }
+    std::cout << std::endl;
+    return found;
+}
+
+// Writers of restaurantStore and restaurantSpatialIndex hold this exclusively (pipelined loads, the daemon's fetches);
+// the daemon's queries and restaurantIndex's ingest workers read under a shared lock
+std::shared_mutex restaurantStoreMutex;
+
+// Enriches a batch of freshly fetched restaurants with details and moves them into the store and indices.
+// Safe to call for several batches at once.
+void enrich_and_store(std::vector<restaurant_data> &restaurants, const std::string &apiKey)
+{
+    // Get detailed information including opening hours for every restaurant concurrently
+    fetch_place_details_concurrent(restaurants, apiKey, maxDetailsInFlight);
+
+    // each restaurant is moved into the store once and the indices only hold its position. New records get the
+    // contiguous range [first, end) while the lock is held; indexing them happens after it is released, so other
+    // batches can be stored and indexed at the same time
+    auto start = std::chrono::steady_clock::now();
+    uint32_t first = 0;
+    uint32_t end = 0;
+    std::vector<uint32_t> refreshed;
+    {
+        std::lock_guard<std::shared_mutex> lock(restaurantStoreMutex);
+        first = static_cast<uint32_t>(restaurantStore.size());
+        for (restaurant_data &restaurant : restaurants)
+        {
+            bool inserted = true;
+            uint32_t index = restaurantStore.add(std::move(restaurant), &inserted);
+            if (!inserted)
+                refreshed.push_back(index);
+        }
+        end = static_cast<uint32_t>(restaurantStore.size());
+        restaurantIndex.watermark.begin(first, end);
+    }
+    restaurantIndex.index_range(restaurantStore, first, end, &restaurantStoreMutex);
+    restaurantText.index_range(restaurantStore, first, end, &restaurantStoreMutex);
+    restaurantText.update(restaurantStore, refreshed, &restaurantStoreMutex); // a refreshed record may have been renamed
+    pipelineMetrics.index.record_since(start);
+}
+
+// Rebuilds derived indices and persists caches once a load has finished
+void finish_load()
+{
+    places_http_client().print_stats(std::cout);
+    placesScheduler.print_stats(std::cout);
+    placeDetailsCache.print_stats(std::cout);
+    nearbyFlights.print_stats(std::cout, "Nearby");
+    detailsFlights.print_stats(std::cout, "Details");
+    placeDetailsCache.save(detailsCachePath);
+    auto start = std::chrono::steady_clock::now();
+    restaurantSpatialIndex.build(restaurantStore);
+    pipelineMetrics.index.record_since(start);
+    pipelineMetrics.print_summary(std::cout);
+    write_metrics_file();
+}
+
+// Enriches freshly fetched restaurants with details and moves them into the store and maps
+void load_restaurants(std::vector<restaurant_data> &restaurants, const std::string &apiKey)
+{
+    enrich_and_store(restaurants, apiKey);
+    finish_load();
+}
+
+// A circle the daemon has fetched every place inside, and when
+typedef struct CoveredArea
+{
+    double lat;
+    double lon;
+    double radius_m;
+    int64_t fetched_at;
+} CoveredArea;
+
+std::string snapshotPath = ".store_snapshot"; // next to .env; written by --serve at exit and mapped at its next start
+
+// Sections of a store snapshot. Each is one flat array of fixed-size values starting on a cache line, so once the
+// file is mapped every column, posting list and grid array is used in place.
+enum SnapshotSection : uint32_t
+{
+    SECTION_LAT,                  // float per record
+    SECTION_LON,                  // float per record
+    SECTION_RATING,               // float per record, as in RestaurantStore::rating
+    SECTION_EXACT_RATING,         // double per record, as in restaurant_data::rating
+    SECTION_FLAGS,                // RestaurantFlags per record
+    SECTION_TYPES,                // TypeSet per record
+    SECTION_HOURS_FIRST,          // uint32_t per record, into SECTION_HOURS_POOL
+    SECTION_HOURS_COUNT,          // uint8_t per record
+    SECTION_HOURS_POOL,           // WeekInterval, without the unused runs refreshes leave in the live pool
+    SECTION_TEXT_OFFSETS,         // uint32_t per (record, SnapshotText) plus an end, into SECTION_TEXT
+    SECTION_TEXT,                 // every string back to back
+    SECTION_TYPE_FIRST,           // uint32_t per record plus an end, into SECTION_TYPE_IDS
+    SECTION_TYPE_IDS,             // uint32_t place type ids (see PlaceTypeInterner) in each record's original order
+    SECTION_TYPE_NAMES,           // interned type names in id order, each followed by '\0'
+    SECTION_TYPE_POSTING_FIRST,   // uint32_t per place type id plus an end, into SECTION_TYPE_POSTINGS
+    SECTION_TYPE_POSTINGS,        // uint32_t record indices, ascending within each type
+    SECTION_RATING_POSTING_FIRST, // uint32_t per kRatingBuckets entry plus an end, into SECTION_RATING_POSTINGS
+    SECTION_RATING_POSTINGS,      // uint32_t record indices, ascending within each bucket
+    SECTION_GRID_CELLS,           // GridIndex cell offsets into SECTION_GRID_ENTRIES
+    SECTION_GRID_ENTRIES,         // uint32_t record indices by cell
+    SECTION_COVERED,              // CoveredArea
+    kSnapshotSections
+};
+
+// Strings kept per record; the multi-valued ones are joined so every record has exactly kSnapshotTexts of them
+enum SnapshotText : uint32_t
+{
+    TEXT_PLACE_ID,
+    TEXT_NAME,
+    TEXT_ADDRESS,
+    TEXT_CUISINE,
+    TEXT_URL,
+    TEXT_STATUS,
+    TEXT_WEEKDAY, // weekday_text lines joined by '\n'
+    TEXT_PERIODS, // "open\tclose" periods joined by '\n'
+    kSnapshotTexts
+};
+
+typedef struct SnapshotHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;     // kSnapshotByteOrder as the writer stored it; reads back different on the other endianness
+    uint32_t type_set_bytes; // sizeof(TypeSet), which is stored in its in-memory form
+    uint64_t file_bytes;
+    int64_t written_at;      // unix seconds
+    uint32_t records;
+    uint32_t place_types;    // type ids in use when written (the known types, then the interned names)
+    uint32_t covered;
+    uint32_t reserved;
+    GridShape grid;
+    uint64_t section_offset[kSnapshotSections];
+    uint64_t section_bytes[kSnapshotSections];
+} SnapshotHeader;
+
+const char kSnapshotMagic[4] = {'R', 'F', 'S', 'N'};
+const uint32_t kSnapshotVersion = 1;
+const uint32_t kSnapshotByteOrder = 0x01020304;
+const uint64_t kSnapshotAlignment = 64;
+static_assert(std::is_trivially_copyable_v<TypeSet> && std::is_trivially_copyable_v<WeekInterval> &&
+                  std::is_trivially_copyable_v<GridShape> && std::is_trivially_copyable_v<CoveredArea>,
+              "snapshot sections are written and mapped as raw memory");
+
+// Forces a file's data, or a directory's entries, out to disk; false if that failed. A no-op where there is no fsync.
+bool sync_to_disk(const std::string &path)
+{
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#else
+    (void)path;
+    return true;
+#endif
+}
+
+// Writes a store, its type and rating postings, its grid and the daemon's covered areas to path via a temporary file
+// and rename, so a reader only ever maps a complete snapshot. The temporary file is synced before the rename and the
+// directory after it, so a crash leaves the old snapshot or the new one, never a renamed but unwritten file. Returns
+// false on write errors or when the strings outgrow 32-bit offsets.
+bool save_store_snapshot(const std::string &path, const RestaurantStore &store, const SpatialIndex &spatial, const std::vector<CoveredArea> &covered)
+{
+    uint32_t count = static_cast<uint32_t>(store.size());
+    std::vector<double> exact_rating(count);
+    std::vector<uint32_t> hours_first(count);
+    std::vector<WeekInterval> hours_pool;
+    std::vector<uint64_t> text_offsets;
+    std::string text;
+    std::vector<uint32_t> type_first(count + 1, 0);
+    std::vector<uint32_t> type_ids;
+    text_offsets.reserve(static_cast<size_t>(count) * kSnapshotTexts + 1);
+    for (uint32_t index = 0; index < count; index++)
+    {
+        const restaurant_data &restaurant = store[index];
+        exact_rating[index] = restaurant.rating;
+        hours_first[index] = static_cast<uint32_t>(hours_pool.size());
+        auto week = store.hours_pool.begin() + store.hours_first[index];
+        hours_pool.insert(hours_pool.end(), week, week + store.hours_count[index]);
+
+        for (const std::string *field : {&restaurant.place_id, &restaurant.name, &restaurant.address, &restaurant.cuisine,
+                                         &restaurant.url, &restaurant.current_status})
+        {
+            text_offsets.push_back(text.size());
+            text += *field;
+        }
+        text_offsets.push_back(text.size());
+        for (size_t l = 0; l < restaurant.hours.weekday_text.size(); l++)
+        {
+            text += (l ? "\n" : "") + restaurant.hours.weekday_text[l];
+        }
+        text_offsets.push_back(text.size());
+        for (size_t p = 0; p < restaurant.hours.periods.size(); p++)
+        {
+            text += (p ? "\n" : "") + restaurant.hours.periods[p].first + "\t" + restaurant.hours.periods[p].second;
+        }
 
-        // Iterate through each type in the restaurant's types vector
         for (const std::string &type : restaurant.types)
         {
-            restaurantInfoMap[type].push_back(restaurant);
-        }
-        if (restaurant.rating <= 5.0 || restaurant.rating >= 4.8)
-            restaurantRatingMap["5.0-4.8"].push_back(restaurant);
-        else if (restaurant.rating <= 4.79 && restaurant.rating >= 4.4)
-            restaurantRatingMap["4.79-4.4"].push_back(restaurant);
-        else if (restaurant.rating <= 4.39 && restaurant.rating >= 3.8)
-            restaurantRatingMap["4.39-3.8"].push_back(restaurant);
-        else if (restaurant.rating <= 3.79 && restaurant.rating >= 3.0)
-            restaurantRatingMap["3.79-3.0"].push_back(restaurant);
-        else if (restaurant.rating <= 2.9 && restaurant.rating >= 2.5)
-            restaurantRatingMap["2.9-2.5"].push_back(restaurant);
-        else if (restaurant.rating <= 2.49)
-            restaurantRatingMap["<=2.49"].push_back(restaurant);
-        else
-            restaurantRatingMap["no rating"].push_back(restaurant);
+            type_ids.push_back(static_cast<uint32_t>(placeTypes.intern(type)));
+        }
+        type_first[index + 1] = static_cast<uint32_t>(type_ids.size());
+    }
+    text_offsets.push_back(text.size());
+    if (text.size() > UINT32_MAX)
+    {
+        std::cerr << "Store too large for a snapshot (" << text.size() << " bytes of text)" << std::endl;
+        return false;
+    }
+    std::vector<uint32_t> narrow_offsets(text_offsets.begin(), text_offsets.end());
+
+    // Type and rating postings in CSR form; records are visited in order, so each list comes out ascending
+    uint32_t place_types = static_cast<uint32_t>(placeTypes.size());
+    std::vector<uint32_t> type_posting_first(place_types + 1, 0);
+    std::vector<uint32_t> rating_posting_first(kRatingBucketCount + 1, 0);
+    for (uint32_t id : type_ids)
+    {
+        type_posting_first[id + 1]++;
+    }
+    for (uint32_t index = 0; index < count; index++)
+    {
+        rating_posting_first[rating_bucket_index(exact_rating[index]) + 1]++;
+    }
+    std::partial_sum(type_posting_first.begin(), type_posting_first.end(), type_posting_first.begin());
+    std::partial_sum(rating_posting_first.begin(), rating_posting_first.end(), rating_posting_first.begin());
+    std::vector<uint32_t> type_postings(type_ids.size());
+    std::vector<uint32_t> rating_postings(count);
+    std::vector<uint32_t> type_fill(type_posting_first.begin(), type_posting_first.end() - 1);
+    std::vector<uint32_t> rating_fill(rating_posting_first.begin(), rating_posting_first.end() - 1);
+    for (uint32_t index = 0; index < count; index++)
+    {
+        for (uint32_t t = type_first[index]; t < type_first[index + 1]; t++)
+        {
+            type_postings[type_fill[type_ids[t]]++] = index;
+        }
+        rating_postings[rating_fill[rating_bucket_index(exact_rating[index])]++] = index;
+    }
+    std::string type_names;
+    for (int id = kKnownPlaceTypes; id < static_cast<int>(place_types); id++)
+    {
+        type_names += placeTypes.name(id);
+        type_names += '\0';
+    }
+
+    // The grid is stored as built; one built over an older state of the store is rebuilt first
+    const SpatialIndex *grid = &spatial;
+    SpatialIndex rebuilt;
+    if (spatial.cell_entries().size() != count)
+    {
+        rebuilt.build(store);
+        grid = &rebuilt;
+    }
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.byte_order = kSnapshotByteOrder;
+    header.type_set_bytes = sizeof(TypeSet);
+    header.written_at = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    header.records = count;
+    header.place_types = place_types;
+    header.covered = static_cast<uint32_t>(covered.size());
+    header.grid = grid->grid();
+
+    std::string temp_name = path + ".tmp";
+    {
+        std::ofstream file(temp_name, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "Could not write snapshot " << temp_name << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header)); // rewritten once the sections are placed
+        uint64_t offset = sizeof(header);
+        auto section = [&](SnapshotSection id, const void *data, size_t bytes)
+        {
+            static const char padding[kSnapshotAlignment] = {};
+            uint64_t pad = (kSnapshotAlignment - offset % kSnapshotAlignment) % kSnapshotAlignment;
+            file.write(padding, static_cast<std::streamsize>(pad));
+            offset += pad;
+            header.section_offset[id] = offset;
+            header.section_bytes[id] = bytes;
+            file.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+            offset += bytes;
+        };
+        section(SECTION_LAT, store.lat.data(), count * sizeof(float));
+        section(SECTION_LON, store.lon.data(), count * sizeof(float));
+        section(SECTION_RATING, store.rating.data(), count * sizeof(float));
+        section(SECTION_EXACT_RATING, exact_rating.data(), count * sizeof(double));
+        section(SECTION_FLAGS, store.flags.data(), count);
+        section(SECTION_TYPES, store.types.data(), count * sizeof(TypeSet));
+        section(SECTION_HOURS_FIRST, hours_first.data(), count * sizeof(uint32_t));
+        section(SECTION_HOURS_COUNT, store.hours_count.data(), count);
+        section(SECTION_HOURS_POOL, hours_pool.data(), hours_pool.size() * sizeof(WeekInterval));
+        section(SECTION_TEXT_OFFSETS, narrow_offsets.data(), narrow_offsets.size() * sizeof(uint32_t));
+        section(SECTION_TEXT, text.data(), text.size());
+        section(SECTION_TYPE_FIRST, type_first.data(), type_first.size() * sizeof(uint32_t));
+        section(SECTION_TYPE_IDS, type_ids.data(), type_ids.size() * sizeof(uint32_t));
+        section(SECTION_TYPE_NAMES, type_names.data(), type_names.size());
+        section(SECTION_TYPE_POSTING_FIRST, type_posting_first.data(), type_posting_first.size() * sizeof(uint32_t));
+        section(SECTION_TYPE_POSTINGS, type_postings.data(), type_postings.size() * sizeof(uint32_t));
+        section(SECTION_RATING_POSTING_FIRST, rating_posting_first.data(), rating_posting_first.size() * sizeof(uint32_t));
+        section(SECTION_RATING_POSTINGS, rating_postings.data(), rating_postings.size() * sizeof(uint32_t));
+        section(SECTION_GRID_CELLS, grid->cells().data(), grid->cells().size_bytes());
+        section(SECTION_GRID_ENTRIES, grid->cell_entries().data(), grid->cell_entries().size_bytes());
+        section(SECTION_COVERED, covered.data(), covered.size() * sizeof(CoveredArea));
+        header.file_bytes = offset;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.close(); // flushes
+        if (!file)
+        {
+            std::cerr << "Could not write snapshot " << temp_name << std::endl;
+            return false;
+        }
+    }
+    if (!sync_to_disk(temp_name))
+    {
+        std::cerr << "Could not sync snapshot " << temp_name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (std::rename(temp_name.c_str(), path.c_str()) != 0)
+    {
+        return false;
+    }
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    if (!sync_to_disk(directory.empty() ? "." : directory))
+    {
+        std::cerr << "Could not sync the directory of snapshot " << path << std::endl; // the file itself is complete
+    }
+    return true;
+}
+
+#ifndef _WIN32
+// A store snapshot mapped read-only. Opening checks the header and the section bounds and nothing per record: columns,
+// strings, postings and grid are used straight from the page cache, so opening costs the same for ten places or a
+// million and pages are only read once a query touches them. It has the columns matches_filter and GridIndex read,
+// so queries run on it exactly as on the live store.
+typedef struct MappedSnapshot
+{
+    // One record's fields as views into the mapping, named like restaurant_data's so the same formatting code takes either
+    typedef struct Record
+    {
+        std::string_view place_id;
+        std::string_view name;
+        std::string_view address;
+        std::string_view cuisine;
+        std::string_view url;
+        std::string_view current_status;
+        LatLon location;
+        double rating = 0.0;
+        bool is_operational = true;
+    } Record;
+
+    const float *lat = nullptr;
+    const float *lon = nullptr;
+    const float *rating = nullptr;
+    const uint8_t *flags = nullptr;
+    const TypeSet *types = nullptr;
+    GridIndex<MappedSnapshot> spatial; // the stored grid, adopted in place
+    int64_t written_at = 0;
+
+    MappedSnapshot() {}
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+    ~MappedSnapshot() { close(); }
+
+    // Maps path and checks it; false (with a message unless the file is simply missing) if it can't be used
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != ENOENT)
+                std::cerr << "Could not open snapshot " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat info = {};
+        if (fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(SnapshotHeader))
+        {
+            ::close(fd);
+            std::cerr << "Ignoring truncated snapshot " << path << std::endl;
+            return false;
+        }
+        void *mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "Could not map snapshot " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        base = static_cast<const char *>(mapping);
+        mapped_bytes = static_cast<size_t>(info.st_size);
+        madvise(mapping, mapped_bytes, MADV_WILLNEED); // start reading ahead without waiting for it
+
+        std::string problem = attach();
+        if (!problem.empty())
+        {
+            std::cerr << "Ignoring snapshot " << path << ": " << problem << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (base)
+        {
+            munmap(const_cast<char *>(base), mapped_bytes);
+        }
+        base = nullptr;
+        mapped_bytes = 0;
+        records = 0;
+    }
+
+    size_t size() const { return records; }
+    size_t file_bytes() const { return mapped_bytes; }
+
+    std::string_view text(uint32_t index, SnapshotText field) const
+    {
+        size_t slot = static_cast<size_t>(index) * kSnapshotTexts + field;
+        return std::string_view(text_data + text_offsets[slot], text_offsets[slot + 1] - text_offsets[slot]);
+    }
+
+    Record operator[](uint32_t index) const
+    {
+        Record record;
+        record.place_id = text(index, TEXT_PLACE_ID);
+        record.name = text(index, TEXT_NAME);
+        record.address = text(index, TEXT_ADDRESS);
+        record.cuisine = text(index, TEXT_CUISINE);
+        record.url = text(index, TEXT_URL);
+        record.current_status = text(index, TEXT_STATUS);
+        record.location = LatLon(lat[index], lon[index]);
+        record.rating = exact_rating[index];
+        record.is_operational = flags[index] & FLAG_OPERATIONAL;
+        return record;
+    }
+
+    std::span<const WeekInterval> week(uint32_t index) const { return std::span<const WeekInterval>(hours_pool + hours_first[index], hours_count[index]); }
+    std::span<const uint32_t> type_ids(uint32_t index) const { return std::span<const uint32_t>(type_id_data + type_first[index], type_first[index + 1] - type_first[index]); }
+
+    bool is_open_at(uint32_t index, int week_minute) const { return week_covers(hours_pool + hours_first[index], hours_count[index], week_minute); }
+
+    bool has_type(uint32_t index, int type_id) const
+    {
+        std::span<const uint32_t> ids = type_ids(index);
+        return std::find(ids.begin(), ids.end(), static_cast<uint32_t>(type_id)) != ids.end();
+    }
+
+    // Records of a google type, ascending; the stored postings, so nothing is scanned
+    size_t of_type(const std::string &type, std::vector<uint32_t> &out) const
+    {
+        int id = placeTypes.find(type);
+        if (id < 0 || static_cast<uint32_t>(id) >= place_types)
+        {
+            out.clear();
+            return 0;
+        }
+        out.assign(type_postings + type_posting_first[id], type_postings + type_posting_first[id + 1]);
+        return out.size();
+    }
+
+    size_t in_rating_bucket(const std::string &bucket, std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        for (int b = 0; b < kRatingBucketCount; b++)
+        {
+            if (bucket == kRatingBuckets[b])
+                out.assign(rating_postings + rating_posting_first[b], rating_postings + rating_posting_first[b + 1]);
+        }
+        return out.size();
+    }
+
+    std::span<const CoveredArea> covered() const { return std::span<const CoveredArea>(covered_areas, covered_count); }
+
+private:
+    const char *base = nullptr;
+    size_t mapped_bytes = 0;
+    uint32_t records = 0;
+    uint32_t place_types = 0;
+    uint32_t covered_count = 0;
+    const double *exact_rating = nullptr;
+    const uint32_t *hours_first = nullptr;
+    const uint8_t *hours_count = nullptr;
+    const WeekInterval *hours_pool = nullptr;
+    const uint32_t *text_offsets = nullptr;
+    const char *text_data = nullptr;
+    const uint32_t *type_first = nullptr;
+    const uint32_t *type_id_data = nullptr;
+    const uint32_t *type_posting_first = nullptr;
+    const uint32_t *type_postings = nullptr;
+    const uint32_t *rating_posting_first = nullptr;
+    const uint32_t *rating_postings = nullptr;
+    const CoveredArea *covered_areas = nullptr;
+
+    // Whether count offsets never decrease (the ends were checked against their sections)
+    static bool ascending(const uint32_t *offsets, uint64_t count)
+    {
+        for (uint64_t i = 1; i < count; i++)
+        {
+            if (offsets[i] < offsets[i - 1])
+                return false;
+        }
+        return true;
+    }
+
+    // Whether count values are all below bound
+    static bool all_below(const uint32_t *values, uint64_t count, uint64_t bound)
+    {
+        uint32_t largest = 0;
+        for (uint64_t i = 0; i < count; i++)
+            largest = std::max(largest, values[i]); // no early exit, so the loop vectorizes
+        return count == 0 || largest < bound;
+    }
+
+    // Points the members into the mapping; the reason the file can't be used, or "" if it can
+    std::string attach()
+    {
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion)
+            return "not a version " + std::to_string(kSnapshotVersion) + " snapshot";
+        if (header.byte_order != kSnapshotByteOrder || header.type_set_bytes != sizeof(TypeSet))
+            return "written on a different platform";
+        if (header.file_bytes != mapped_bytes)
+            return "size does not match its header";
+
+        uint64_t n = header.records;
+        uint64_t cells = header.grid.rows > 0 ? static_cast<uint64_t>(header.grid.rows) * header.grid.cols + 1 : 0;
+        const uint64_t expected[kSnapshotSections] = {
+            n * sizeof(float), n * sizeof(float), n * sizeof(float), n * sizeof(double), n, n * sizeof(TypeSet),
+            n * sizeof(uint32_t), n, UINT64_MAX, (n * kSnapshotTexts + 1) * sizeof(uint32_t), UINT64_MAX,
+            (n + 1) * sizeof(uint32_t), UINT64_MAX, UINT64_MAX, (uint64_t(header.place_types) + 1) * sizeof(uint32_t), UINT64_MAX,
+            (kRatingBucketCount + 1) * sizeof(uint32_t), n * sizeof(uint32_t), cells * sizeof(uint32_t), n * sizeof(uint32_t),
+            header.covered * sizeof(CoveredArea)}; // UINT64_MAX: any length
+        for (uint32_t s = 0; s < kSnapshotSections; s++)
+        {
+            uint64_t offset = header.section_offset[s];
+            uint64_t bytes = header.section_bytes[s];
+            if (offset % kSnapshotAlignment != 0 || bytes > mapped_bytes || offset > mapped_bytes - bytes ||
+                (expected[s] != UINT64_MAX && bytes != expected[s]))
+                return "section " + std::to_string(s) + " is out of bounds";
+        }
+        auto at = [&](SnapshotSection s)
+        { return static_cast<const void *>(base + header.section_offset[s]); };
+        auto count_of = [&](SnapshotSection s, size_t item)
+        { return header.section_bytes[s] / item; };
+
+        lat = static_cast<const float *>(at(SECTION_LAT));
+        lon = static_cast<const float *>(at(SECTION_LON));
+        rating = static_cast<const float *>(at(SECTION_RATING));
+        exact_rating = static_cast<const double *>(at(SECTION_EXACT_RATING));
+        flags = static_cast<const uint8_t *>(at(SECTION_FLAGS));
+        types = static_cast<const TypeSet *>(at(SECTION_TYPES));
+        hours_first = static_cast<const uint32_t *>(at(SECTION_HOURS_FIRST));
+        hours_count = static_cast<const uint8_t *>(at(SECTION_HOURS_COUNT));
+        hours_pool = static_cast<const WeekInterval *>(at(SECTION_HOURS_POOL));
+        text_offsets = static_cast<const uint32_t *>(at(SECTION_TEXT_OFFSETS));
+        text_data = static_cast<const char *>(at(SECTION_TEXT));
+        type_first = static_cast<const uint32_t *>(at(SECTION_TYPE_FIRST));
+        type_id_data = static_cast<const uint32_t *>(at(SECTION_TYPE_IDS));
+        type_posting_first = static_cast<const uint32_t *>(at(SECTION_TYPE_POSTING_FIRST));
+        type_postings = static_cast<const uint32_t *>(at(SECTION_TYPE_POSTINGS));
+        rating_posting_first = static_cast<const uint32_t *>(at(SECTION_RATING_POSTING_FIRST));
+        rating_postings = static_cast<const uint32_t *>(at(SECTION_RATING_POSTINGS));
+        covered_areas = static_cast<const CoveredArea *>(at(SECTION_COVERED));
+        const uint32_t *grid_cells = static_cast<const uint32_t *>(at(SECTION_GRID_CELLS));
+        const uint32_t *grid_entries = static_cast<const uint32_t *>(at(SECTION_GRID_ENTRIES));
+
+        // The ends of the offset arrays are the only values checked against the data they index
+        if (text_offsets[n * kSnapshotTexts] != header.section_bytes[SECTION_TEXT] ||
+            type_first[n] != count_of(SECTION_TYPE_IDS, sizeof(uint32_t)) ||
+            type_posting_first[header.place_types] != count_of(SECTION_TYPE_POSTINGS, sizeof(uint32_t)) ||
+            rating_posting_first[kRatingBucketCount] != n || (cells > 0 && grid_cells[cells - 1] != n) ||
+            header.section_bytes[SECTION_HOURS_POOL] % sizeof(WeekInterval) != 0)
+            return "offsets do not match their sections";
+
+        // Every offset, run and index the readers follow stays inside what it points into, so a damaged file of the
+        // right size is turned away here instead of being read past the mapping by a query or the restore
+        uint64_t hours_pool_count = count_of(SECTION_HOURS_POOL, sizeof(WeekInterval));
+        uint64_t type_id_count = count_of(SECTION_TYPE_IDS, sizeof(uint32_t));
+        if (!ascending(text_offsets, n * kSnapshotTexts + 1) || !ascending(type_first, n + 1) ||
+            !ascending(type_posting_first, uint64_t(header.place_types) + 1) || !ascending(rating_posting_first, kRatingBucketCount + 1) ||
+            !ascending(grid_cells, cells))
+            return "offsets are out of order";
+        for (uint64_t i = 0; i < n; i++)
+        {
+            if (uint64_t(hours_first[i]) + hours_count[i] > hours_pool_count)
+                return "hours of record " + std::to_string(i) + " are out of bounds";
+        }
+        if (!all_below(type_id_data, type_id_count, header.place_types) ||
+            !all_below(type_postings, count_of(SECTION_TYPE_POSTINGS, sizeof(uint32_t)), n) ||
+            !all_below(rating_postings, n, n) || !all_below(grid_entries, cells > 0 ? n : 0, n))
+            return "a type id or record index is out of range";
+
+        // Type bits past the known types depend on interning order; replaying the names reproduces it in a fresh
+        // process (e.g. at daemon start) and a process that already interned other names can't use this file. Names
+        // are only looked up here: a rejected file must not leave its names behind in placeTypes.
+        const char *names_begin = static_cast<const char *>(at(SECTION_TYPE_NAMES));
+        const char *names_end = names_begin + header.section_bytes[SECTION_TYPE_NAMES];
+        std::vector<std::string_view> names;
+        std::unordered_set<std::string_view> unseen; // names the process has not interned yet, in file order
+        int next_id = placeTypes.size();
+        for (const char *name = names_begin; name < names_end;)
+        {
+            size_t length = strnlen(name, static_cast<size_t>(names_end - name));
+            std::string_view text(name, length);
+            int id = kKnownPlaceTypes + static_cast<int>(names.size());
+            int known = placeTypes.find(text);
+            if (known >= 0 ? known != id : id != next_id++ || !unseen.insert(text).second)
+                return "its place type ids differ from this process's";
+            names.push_back(text);
+            name += length + 1;
+        }
+        if (kKnownPlaceTypes + names.size() != header.place_types)
+            return "type names do not match its header";
+
+        // Every check has passed; intern the names the process has not seen, which hands out the ids checked above
+        for (size_t n = 0; n < names.size(); n++)
+        {
+            if (placeTypes.intern(names[n]) != kKnownPlaceTypes + static_cast<int>(n))
+                return "its place type ids differ from this process's"; // another thread interned a type meanwhile
+        }
+
+        records = header.records;
+        place_types = header.place_types;
+        covered_count = header.covered;
+        written_at = header.written_at;
+        spatial.adopt(*this, header.grid, std::span<const uint32_t>(grid_cells, cells), std::span<const uint32_t>(grid_entries, n));
+        return "";
+    }
+} MappedSnapshot;
+
+// A snapshot record as an owned restaurant_data, for moving a mapped snapshot into the live store
+restaurant_data to_restaurant_data(const MappedSnapshot &snapshot, uint32_t index)
+{
+    MappedSnapshot::Record record = snapshot[index];
+    restaurant_data restaurant;
+    restaurant.place_id = std::string(record.place_id);
+    restaurant.name = std::string(record.name);
+    restaurant.address = std::string(record.address);
+    restaurant.cuisine = std::string(record.cuisine);
+    restaurant.url = std::string(record.url);
+    restaurant.current_status = std::string(record.current_status);
+    restaurant.location = record.location;
+    restaurant.rating = record.rating;
+    restaurant.is_operational = record.is_operational;
+    for (uint32_t id : snapshot.type_ids(index))
+    {
+        restaurant.types.push_back(placeTypes.name(static_cast<int>(id)));
+    }
+
+    restaurant.hours.open_now = snapshot.flags[index] & FLAG_OPEN_NOW;
+    std::span<const WeekInterval> week = snapshot.week(index);
+    restaurant.hours.week.assign(week.begin(), week.end());
+    std::string_view lines = snapshot.text(index, TEXT_WEEKDAY);
+    while (!lines.empty())
+    {
+        size_t end = std::min(lines.find('\n'), lines.size());
+        restaurant.hours.weekday_text.emplace_back(lines.substr(0, end));
+        lines.remove_prefix(std::min(end + 1, lines.size()));
+    }
+    std::string_view periods = snapshot.text(index, TEXT_PERIODS);
+    while (!periods.empty())
+    {
+        size_t end = std::min(periods.find('\n'), periods.size());
+        std::string_view period = periods.substr(0, end);
+        size_t tab = std::min(period.find('\t'), period.size());
+        restaurant.hours.periods.emplace_back(std::string(period.substr(0, tab)), std::string(period.substr(std::min(tab + 1, period.size()))));
+        periods.remove_prefix(std::min(end + 1, periods.size()));
+    }
+    return restaurant;
+}
+
+// Fills store with every record of a mapped snapshot. Unlike mapping, this allocates each record's strings, so the
+// daemon runs it in the background while it answers from the mapping.
+void restore_store(const MappedSnapshot &snapshot, RestaurantStore &store)
+{
+    store.clear();
+    for (uint32_t index = 0; index < snapshot.size(); index++)
+    {
+        store.add(to_restaurant_data(snapshot, index));
+    }
+}
+#endif
+
+// Example main function showing how to use the fetch_nearby_restaurants function
+// NOTE THIS FUNCTION NEEDS TO GET THE INTERSECITON COORDINATES (FROM MOUSE CLICK?) AND add an xy to the latlon to each restaurant; should be handled above tbh
+void generateRestaurantMaps(std::string location, std::string apiKey)
+{
+    // Fetch nearby restaurants
+    int radius;
+    int limit;
+    std::cout << "Enter the radius: " << std::endl;
+    std::cin >> radius;
+    std::cout << "Enter the limit (60 locations max): " << std::endl;
+    std::cin >> limit;
+    DeadlineScope scope(Deadline::after_ms(requestPolicy.lookup_budget_ms));
+    Deadline deadline = threadDeadline;
+
+    // Pipeline the load: each page is enriched and stored on its own thread while the next page token matures,
+    // instead of waiting for every page before the first details request goes out
+    std::deque<std::vector<restaurant_data>> pages; // deque keeps earlier pages in place while new ones are added
+    std::vector<std::future<void>> enrichments;
+    fetch_nearby_restaurants(location, radius, limit, apiKey, nullptr, [&](std::vector<restaurant_data> &page)
+                             {
+        pages.push_back(std::move(page));
+        std::vector<restaurant_data> &batch = pages.back();
+        enrichments.push_back(std::async(std::launch::async, [&batch, &apiKey, deadline]()
+                                         {
+            DeadlineScope scope(deadline);
+            enrich_and_store(batch, apiKey); })); });
+
+    for (std::future<void> &enrichment : enrichments)
+    {
+        enrichment.get();
+    }
+    finish_load();
+}
+
+std::atomic<bool> stopRequested{false}; // set by SIGINT/SIGTERM in the long-running modes
+
+// Makes SIGINT/SIGTERM ask the long-running modes to wind down instead of killing the process
+void install_stop_handlers()
+{
+    std::signal(SIGINT, [](int)
+                { stopRequested = true; });
+    std::signal(SIGTERM, [](int)
+                { stopRequested = true; });
+}
+
+// Fixed set of worker threads draining a FIFO of tasks
+typedef struct ThreadPool
+{
+    explicit ThreadPool(int threads)
+    {
+        for (int t = 0; t < std::max(1, threads); t++)
+        {
+            workers.emplace_back([this]()
+                                 { run(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Finishes the queued tasks, then joins the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]()
+                          { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+} ThreadPool;
+
+// Quotes a string for JSON output
+std::string json_escape(std::string_view text)
+{
+    std::string escaped = "\"";
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\r':
+            escaped += "\\r";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+    }
+    return escaped + "\"";
+}
+
+// What a query needs from each restaurant beyond the nearbysearch basics (name, location, rating, types, address)
+typedef struct QueryNeeds
+{
+    bool website = true;     // details: website, falling back to the Maps url
+    bool hours = true;       // details: weekly hours and the status text derived from them
+    bool open_now = true;    // answered by nearbysearch (opening_hours.open_now)
+    bool operational = true; // answered by nearbysearch (business_status)
+} QueryNeeds;
+
+// Parses a comma-separated list of website, hours, open_now and operational (or "all"); false on an unknown name
+bool parse_query_needs(const std::string &spec, QueryNeeds &needs)
+{
+    needs.website = needs.hours = needs.open_now = needs.operational = false;
+    std::istringstream names(spec);
+    std::string name;
+    while (std::getline(names, name, ','))
+    {
+        if (name == "all")
+            needs = QueryNeeds();
+        else if (name == "website")
+            needs.website = true;
+        else if (name == "hours")
+            needs.hours = true;
+        else if (name == "open_now")
+            needs.open_now = true;
+        else if (name == "operational")
+            needs.operational = true;
+        else
+        {
+            std::cerr << "Unknown field " << name << " (expected website, hours, open_now, operational or all)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The details request a query needs, if any
+typedef struct FetchPlan
+{
+    bool details = false;
+    std::string fields; // field mask of the details request
+} FetchPlan;
+
+// Works out the smallest details field mask covering what nearbysearch does not answer. open_now and business_status
+// come with every nearby result, so queries that only need those skip the details call altogether. Queries needing
+// both website and hours use the full mask, which costs a few bytes more and can be stored in the details cache.
+FetchPlan plan_fetch(const QueryNeeds &needs)
+{
+    FetchPlan plan;
+    if (needs.website && needs.hours)
+    {
+        plan.fields = kDetailsFields;
+    }
+    else if (needs.website)
+    {
+        plan.fields = "url,website";
+    }
+    else if (needs.hours)
+    {
+        plan.fields = "opening_hours";
+    }
+    plan.details = !plan.fields.empty();
+    return plan;
+}
+
+// Calls and bytes one planned query used and saved
+typedef struct FetchReport
+{
+    size_t restaurants = 0;
+    uint64_t details_calls = 0; // details requests made
+    uint64_t details_saved = 0; // details requests not made: skipped by the plan, answered by the cache or joined in flight
+    FetchTraffic traffic;       // everything the query's own requests transferred
+
+    // Bytes not downloaded: compression, plus the skipped details calls at the mean details response size seen so far
+    uint64_t bytes_saved() const
+    {
+        uint64_t responses = pipelineMetrics.requests[static_cast<size_t>(MetricEndpoint::Details)].load();
+        uint64_t mean_details = responses ? pipelineMetrics.bytes_decoded[static_cast<size_t>(MetricEndpoint::Details)].load() / responses : 0;
+        return (traffic.body_bytes > traffic.wire_bytes ? traffic.body_bytes - traffic.wire_bytes : 0) + details_saved * mean_details;
+    }
+} FetchReport;
+
+// Nearby search plus exactly the details the plan asks for. Requests made by other threads are not counted,
+// so several planned queries can run at once. False if the search stopped early (error, quota, denied key, deadline)
+// or a restaurant the plan needed details for was left without them; restaurants then holds whatever did arrive.
+bool fetch_planned(const std::string &location, int radius, int limit, const std::string &api_key,
+                   const FetchPlan &plan, std::vector<restaurant_data> &restaurants, FetchReport &report)
+{
+    FetchTraffic start = threadTraffic;
+    bool complete = false;
+    restaurants = fetch_nearby_restaurants(location, radius, limit, api_key, nullptr, nullptr, &complete);
+    if (plan.details)
+    {
+        DetailsFetchOptions options;
+        options.fields = plan.fields;
+        options.store_results = plan.fields == kDetailsFields; // cache entries hold the full field set
+        uint64_t before = threadTraffic.requests;
+        int enriched = fetch_place_details_concurrent(restaurants, api_key, maxDetailsInFlight, options);
+        report.details_calls = threadTraffic.requests - before;
+        int wanted = static_cast<int>(std::count_if(restaurants.begin(), restaurants.end(),
+                                                    [](const restaurant_data &restaurant) { return !restaurant.place_id.empty(); }));
+        complete = complete && enriched >= wanted;
+    }
+    report.restaurants = restaurants.size();
+    report.details_saved = restaurants.size() > report.details_calls ? restaurants.size() - report.details_calls : 0;
+    report.traffic.requests = threadTraffic.requests - start.requests;
+    report.traffic.wire_bytes = threadTraffic.wire_bytes - start.wire_bytes;
+    report.traffic.body_bytes = threadTraffic.body_bytes - start.body_bytes;
+    return complete;
+}
+
+// One restaurant as a single line of JSON (the record format of batch output)
+std::string restaurant_to_json(const restaurant_data &restaurant)
+{
+    std::ostringstream out;
+    out << std::setprecision(9) << "{\"place_id\":" << json_escape(restaurant.place_id) << ",\"name\":" << json_escape(restaurant.name)
+        << ",\"lat\":" << restaurant.location.lat << ",\"lon\":" << restaurant.location.lon << ",\"rating\":" << restaurant.rating
+        << ",\"cuisine\":" << json_escape(restaurant.cuisine) << ",\"address\":" << json_escape(restaurant.address)
+        << ",\"url\":" << json_escape(restaurant.url) << ",\"is_operational\":" << (restaurant.is_operational ? "true" : "false")
+        << ",\"current_status\":" << json_escape(restaurant.current_status) << ",\"types\":[";
+    for (size_t t = 0; t < restaurant.types.size(); t++)
+    {
+        out << (t ? "," : "") << json_escape(restaurant.types[t]);
+    }
+    out << "],\"hours\":{\"open_now\":" << (restaurant.hours.open_now ? "true" : "false") << ",\"periods\":[";
+    for (size_t p = 0; p < restaurant.hours.periods.size(); p++)
+    {
+        out << (p ? "," : "") << "[" << json_escape(restaurant.hours.periods[p].first) << "," << json_escape(restaurant.hours.periods[p].second) << "]";
+    }
+    out << "],\"weekday_text\":[";
+    for (size_t l = 0; l < restaurant.hours.weekday_text.size(); l++)
+    {
+        out << (l ? "," : "") << json_escape(restaurant.hours.weekday_text[l]);
+    }
+    out << "]}}";
+    return out.str();
+}
+
+// One row of a batch input file
+typedef struct BatchQuery
+{
+    double lat = 0.0;
+    double lon = 0.0;
+    int radius_m = 0;
+} BatchQuery;
+
+// Reads "lat,lon,radius_m" rows (commas or whitespace; blank lines and # comments skipped); false on a bad row
+bool read_batch_queries(const std::string &input_path, std::vector<BatchQuery> &queries)
+{
+    std::ifstream input(input_path);
+    if (!input.is_open())
+    {
+        std::cerr << "Could not open " << input_path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int line_number = 1; std::getline(input, line); line_number++)
+    {
+        std::replace(line.begin(), line.end(), ',', ' ');
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        BatchQuery query;
+        if (!(fields >> query.lat >> query.lon >> query.radius_m) || query.radius_m <= 0)
+        {
+            std::cerr << input_path << ":" << line_number << ": expected lat,lon,radius_m" << std::endl;
+            return false;
+        }
+        queries.push_back(query);
+    }
+    return true;
+}
+
+// Batch mode: one nearby + details lookup per input row, spread over a bounded set of workers that share the HTTP
+// client, scheduler and details cache. Each finished row is appended to output_path as NDJSON (one restaurant per
+// line, tagged with its row) and only then recorded in output_path + ".checkpoint" with the output size at that
+// point. A rerun resumes: output written after the last checkpoint is truncated and finished rows are skipped.
+// Memory stays bounded by workers x 60 restaurants. Details are fetched as plan_fetch(needs) decides, and each row
+// reports the calls and bytes it used and saved. Returns the number of rows not completed.
+size_t run_batch(const std::string &input_path, const std::string &output_path, int workers, const std::string &api_key,
+                 const QueryNeeds &needs = QueryNeeds())
+{
+    std::vector<BatchQuery> queries;
+    if (!read_batch_queries(input_path, queries))
+    {
+        return 1;
+    }
+
+    // Checkpoint format: "rows <count>" header, then "<row> <output bytes after it>" per finished row
+    std::string checkpoint_path = output_path + ".checkpoint";
+    std::vector<bool> done(queries.size(), false);
+    size_t done_count = 0;
+    uintmax_t output_size = 0;
+    bool has_header = false;
+    {
+        std::ifstream checkpoint(checkpoint_path);
+        std::string header;
+        size_t rows = 0;
+        if (checkpoint >> header >> rows)
+        {
+            if (header != "rows" || rows != queries.size())
+            {
+                std::cerr << checkpoint_path << " belongs to a different input; remove it to start over" << std::endl;
+                return queries.size();
+            }
+            has_header = true;
+            size_t row = 0;
+            uintmax_t size_after = 0;
+            while (checkpoint >> row >> size_after)
+            {
+                if (row < done.size() && !done[row])
+                {
+                    done[row] = true;
+                    done_count++;
+                }
+                output_size = std::max(output_size, size_after);
+            }
+        }
+    }
+    if (done_count > 0)
+    {
+        std::cout << "Resuming: " << done_count << " of " << queries.size() << " rows already done" << std::endl;
+    }
+
+    // Drop lines from rows that were cut off before they reached the checkpoint
+    {
+        std::ofstream create(output_path, std::ios::app);
+    }
+    std::error_code resize_error;
+    std::filesystem::resize_file(output_path, output_size, resize_error);
+    std::ofstream output(output_path, std::ios::app | std::ios::binary);
+    std::ofstream checkpoint(checkpoint_path, std::ios::app);
+    if (resize_error || !output.is_open() || !checkpoint.is_open())
+    {
+        std::cerr << "Could not open " << output_path << " or its checkpoint for writing" << std::endl;
+        return queries.size() - done_count;
+    }
+    if (!has_header)
+    {
+        checkpoint << "rows " << queries.size() << std::endl;
+    }
+
+    FetchPlan plan = plan_fetch(needs);
+    std::cout << "Details: " << (plan.details ? "fields=" + plan.fields : std::string("skipped (nearbysearch answers the query)")) << std::endl;
+
+    std::mutex output_mutex; // guards output, checkpoint, output_size and totals
+    std::atomic<size_t> next_row{0};
+    std::atomic<size_t> finished{done_count};
+    FetchReport totals;
+    auto worker = [&]()
+    {
+        for (size_t row = next_row++; row < queries.size() && !stopRequested; row = next_row++)
+        {
+            if (done[row])
+            {
+                continue;
+            }
+            const BatchQuery &query = queries[row];
+            std::ostringstream location;
+            location << std::setprecision(9) << query.lat << "," << query.lon;
+            FetchReport report;
+            DeadlineScope scope(Deadline::after_ms(requestPolicy.lookup_budget_ms));
+            std::vector<restaurant_data> restaurants;
+            bool complete = fetch_planned(location.str(), query.radius_m, 60, api_key, plan, restaurants, report);
+            if (threadDeadline.cut_short())
+            {
+                std::cerr << "Row " << row << " ran out of time; left for the next run" << std::endl;
+                continue; // not checkpointed, so a resumed run fetches it again
+            }
+            if (!complete)
+            {
+                std::cerr << "Row " << row << " failed; left for the next run" << std::endl;
+                continue;
+            }
+
+            std::string lines;
+            for (const restaurant_data &restaurant : restaurants)
+            {
+                lines += "{\"row\":" + std::to_string(row) + ",\"restaurant\":" + restaurant_to_json(restaurant) + "}\n";
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            output << lines;
+            output.flush();
+            output_size += lines.size();
+            checkpoint << row << " " << output_size << std::endl; // only once the row's lines are on disk
+            totals.details_calls += report.details_calls;
+            totals.details_saved += report.details_saved;
+            totals.traffic.requests += report.traffic.requests;
+            totals.traffic.wire_bytes += report.traffic.wire_bytes;
+            totals.traffic.body_bytes += report.traffic.body_bytes;
+            std::cout << "Row " << row << ": " << restaurants.size() << " restaurants, " << report.traffic.requests << " requests ("
+                      << report.details_calls << " details, " << report.details_saved << " saved), " << report.traffic.wire_bytes
+                      << " bytes on the wire, ~" << report.bytes_saved() << " saved (" << ++finished << "/" << queries.size() << ")" << std::endl;
+            if (finished % 100 == 0)
+            {
+                placeDetailsCache.save(detailsCachePath); // an interrupted run keeps the details it paid for
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < std::max(1, workers); w++)
+    {
+        threads.emplace_back(worker);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    placeDetailsCache.save(detailsCachePath);
+
+    std::cout << "Batch: " << finished << " of " << queries.size() << " rows done"
+              << (finished < queries.size() ? " (interrupted or failed; run again to resume)" : "") << std::endl;
+    std::cout << "Planner: " << totals.traffic.requests << " requests (" << totals.details_calls << " details calls, " << totals.details_saved
+              << " saved), " << totals.traffic.wire_bytes << " bytes on the wire (" << totals.traffic.body_bytes << " decoded), ~"
+              << totals.bytes_saved() << " bytes saved" << std::endl;
+    pipelineMetrics.print_summary(std::cout);
+    write_metrics_file();
+    return queries.size() - finished;
+}
+
+// How BackgroundRefresher spends its budget. Volatile fields are kept fresh first: open_now/current_status are
+// recomputed locally from compiled hours (no API call), places without compiled hours and every place's operational
+// status are refetched through the narrow field mask, and the full details only when they are a week old.
+typedef struct RefreshPolicy
+{
+    int status_interval_s = 60;                   // local open_now/current_status pass
+    int64_t open_now_max_age_s = 3600;            // places without compiled hours: refetch open_now this often
+    int64_t operational_max_age_s = 24 * 3600;    // is_operational and hours through kVolatileDetailsFields
+    int64_t details_max_age_s = 7 * 24 * 3600;    // everything through kDetailsFields
+    double calls_per_minute = 30.0;               // API budget for refetches, spread evenly over time
+    int max_batch = 20;                           // refetches started in one tick at most
+} RefreshPolicy;
+
+// Keeps the live store fresh in the background. Tracks when each place was last checked, picks the most overdue
+// places within the call budget, fetches them without holding any lock and applies the results to the records and
+// column arrays in place under short exclusive locks, so readers are never held up by a network round trip.
+// Places keep their store index, so the maps and the spatial index stay valid.
+typedef struct BackgroundRefresher
+{
+    RefreshPolicy policy;
+    std::string api_key;
+    std::atomic<uint64_t> status_updates{0};     // records whose open state or status text was recomputed locally
+    std::atomic<uint64_t> volatile_refreshes{0}; // narrow details requests
+    std::atomic<uint64_t> full_refreshes{0};     // full details requests
+    std::atomic<uint64_t> changed{0};            // refetched places whose status, hours or website had changed
+    std::atomic<uint64_t> failures{0};
+
+    BackgroundRefresher() {}
+    BackgroundRefresher(const BackgroundRefresher &) = delete;
+    BackgroundRefresher &operator=(const BackgroundRefresher &) = delete;
+    ~BackgroundRefresher() { stop(); }
+
+    void start()
+    {
+        stopping = false;
+        last_tick = std::chrono::steady_clock::now();
+        thread = std::thread([this]()
+                             {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            while (!wake.wait_for(lock, std::chrono::seconds(1), [this]() { return stopping; }))
+            {
+                lock.unlock();
+                tick();
+                lock.lock();
+            } });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // One round: the local status pass when it is due, then as many refetches as the budget has accumulated
+    void tick()
+    {
+        int64_t now = unix_now();
+        track_new_places(now);
+        if (now - last_status_pass >= policy.status_interval_s)
+        {
+            last_status_pass = now;
+            refresh_status_locally();
+        }
+
+        auto tick_time = std::chrono::steady_clock::now();
+        budget = std::min<double>(policy.max_batch, budget + policy.calls_per_minute / 60.0 * std::chrono::duration<double>(tick_time - last_tick).count());
+        last_tick = tick_time;
+        if (budget >= 1.0)
+        {
+            budget -= static_cast<double>(refetch_due(now, static_cast<size_t>(budget)));
+        }
+    }
+
+    void print_stats(std::ostream &out) const
+    {
+        out << "Refresher: " << status_updates.load() << " local status updates, " << volatile_refreshes.load() << " volatile and "
+            << full_refreshes.load() << " full refetches, " << changed.load() << " changed, " << failures.load() << " failed" << std::endl;
+    }
+
+private:
+    std::thread thread;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::vector<int64_t> volatile_checked; // by store index: last open_now/operational refresh
+    std::vector<int64_t> full_checked;     // by store index: last full details refresh
+    int64_t last_status_pass = 0;
+    int last_status_day = -1;
+    double budget = 0.0;
+    std::chrono::steady_clock::time_point last_tick;
+
+    static int64_t unix_now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Places added since the last tick were just fetched, so they start out fresh
+    void track_new_places(int64_t now)
+    {
+        std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+        volatile_checked.resize(restaurantStore.size(), now);
+        full_checked.resize(restaurantStore.size(), now);
+    }
+
+    // Recomputes open_now and current_status from compiled hours for the places whose open state flipped (or all of
+    // them when the day changed, since "Opens Tuesday 11:00" becomes "Opens 11:00")
+    void refresh_status_locally()
+    {
+        int minute = current_week_minute();
+        bool new_day = minute / kMinutesPerDay != last_status_day;
+        last_status_day = minute / kMinutesPerDay;
+
+        std::vector<uint32_t> stale;
+        {
+            std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+            for (uint32_t index = 0; index < restaurantStore.size(); index++)
+            {
+                if (restaurantStore.hours_count[index] == 0 || !(restaurantStore.flags[index] & FLAG_OPERATIONAL))
+                    continue;
+                bool open = restaurantStore.is_open_at(index, minute);
+                if (new_day || open != ((restaurantStore.flags[index] & FLAG_OPEN_NOW) != 0))
+                    stale.push_back(index);
+            }
+        }
+
+        // Short exclusive sections so queries keep flowing between them
+        const size_t kApplyBatch = 256;
+        for (size_t first = 0; first < stale.size(); first += kApplyBatch)
+        {
+            std::lock_guard<std::shared_mutex> lock(restaurantStoreMutex);
+            for (size_t n = first; n < std::min(stale.size(), first + kApplyBatch); n++)
+            {
+                uint32_t index = stale[n];
+                restaurant_data &restaurant = restaurantStore.records[index];
+                restaurant.hours.open_now = restaurantStore.is_open_at(index, minute);
+                update_current_status(restaurant);
+                restaurantStore.sync_columns(index);
+            }
+        }
+        status_updates += stale.size();
+    }
+
+    // Refetches up to max_calls overdue places, volatile ones first; returns the number of requests made
+    size_t refetch_due(int64_t now, size_t max_calls)
+    {
+        // (full refresh?, overdue ratio, index); volatile refreshes sort first, then the most overdue
+        std::vector<std::tuple<bool, double, uint32_t>> due;
+        std::vector<restaurant_data> volatile_batch;
+        std::vector<restaurant_data> full_batch;
+        std::vector<uint32_t> volatile_indices;
+        std::vector<uint32_t> full_indices;
+        {
+            std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+            for (uint32_t index = 0; index < volatile_checked.size(); index++)
+            {
+                double full_overdue = static_cast<double>(now - full_checked[index]) / policy.details_max_age_s;
+                int64_t volatile_limit = restaurantStore.hours_count[index] ? policy.operational_max_age_s : policy.open_now_max_age_s;
+                double volatile_overdue = static_cast<double>(now - volatile_checked[index]) / volatile_limit;
+                if (volatile_overdue >= 1.0)
+                    due.emplace_back(false, -volatile_overdue, index);
+                else if (full_overdue >= 1.0)
+                    due.emplace_back(true, -full_overdue, index);
+            }
+            size_t take = std::min(max_calls, due.size());
+            std::partial_sort(due.begin(), due.begin() + take, due.end());
+            for (size_t n = 0; n < take; n++)
+            {
+                bool full = std::get<0>(due[n]);
+                uint32_t index = std::get<2>(due[n]);
+                restaurant_data copy = restaurantStore[index];
+                copy.hours = OpeningHours(); // the decoder appends, so start from empty hours
+                (full ? full_batch : volatile_batch).push_back(std::move(copy));
+                (full ? full_indices : volatile_indices).push_back(index);
+            }
+        }
+
+        refetch(volatile_batch, volatile_indices, false, now);
+        refetch(full_batch, full_indices, true, now);
+        return volatile_batch.size() + full_batch.size();
+    }
+
+    void refetch(std::vector<restaurant_data> &batch, const std::vector<uint32_t> &indices, bool full, int64_t now)
+    {
+        if (batch.empty())
+        {
+            return;
+        }
+        DetailsFetchOptions options;
+        options.use_cache = false;
+        options.store_results = full; // a narrow response would overwrite the cached website
+        options.fields = full ? kDetailsFields : kVolatileDetailsFields;
+        std::vector<uint8_t> enriched;
+        options.enriched = &enriched;
+        fetch_place_details_concurrent(batch, api_key, maxDetailsInFlight, options);
+        (full ? full_refreshes : volatile_refreshes) += batch.size();
+
+        std::lock_guard<std::shared_mutex> lock(restaurantStoreMutex);
+        for (size_t n = 0; n < batch.size(); n++)
+        {
+            uint32_t index = indices[n];
+            volatile_checked[index] = now;
+            if (full)
+                full_checked[index] = now;
+            restaurant_data &restaurant = restaurantStore.records[index];
+            if (!enriched[n] || restaurant.place_id != batch[n].place_id)
+            {
+                failures++;
+                continue;
+            }
+
+            const restaurant_data &fresh = batch[n];
+            bool differs = restaurant.is_operational != fresh.is_operational || restaurant.hours.open_now != fresh.hours.open_now ||
+                           restaurant.hours.weekday_text != fresh.hours.weekday_text || (full && restaurant.url != fresh.url);
+            changed += differs;
+            restaurant.is_operational = fresh.is_operational;
+            restaurant.hours = std::move(batch[n].hours);
+            restaurant.current_status = std::move(batch[n].current_status);
+            if (full)
+            {
+                restaurant.url = std::move(batch[n].url);
+            }
+            restaurantStore.sync_columns(index);
+        }
+    }
+} BackgroundRefresher;
+
+#ifndef _WIN32
+// Long-running query server: one process keeps the HTTP client, the details cache, the store with its maps and
+// the spatial index warm and answers line-based requests from many clients over a Unix domain socket.
+// An area is fetched (swept, so the 60-result cap does not apply) the first time a query reaches outside what is
+// already covered; repeated and overlapping queries inside covered areas are answered from memory.
+//
+// Requests, one per line:   nearby <lat> <lon> <radius_m> [type=<t>] [min_rating=<r>] [open=1] [limit=<n>]
+//                           top <lat> <lon> <radius_m> [same filters] [prefer=<t>] [weights=<r>,<d>,<o>,<t>]
+//                               (the limit (default 10) best by rank_restaurants, each with its "score")
+//                           find <words...> [type=<t>] [min_rating=<r>] [open=1] [limit=<n>] [near=<lat>,<lon>,<radius_m>] [typos=0]
+//                               (name and address search over what is loaded, each result with its "match")
+//                           stats
+//                           metrics   (pipeline metrics in Prometheus text format, as the "prometheus" string)
+//                           ping
+// Every response is a single line of JSON. With PLACES_METRICS_FILE set, the metrics are also rewritten there
+// every metrics_interval_seconds for a textfile collector.
+typedef struct QueryDaemon
+{
+    std::string api_key;
+    int sweep_workers = 4;
+    int64_t coverage_ttl_seconds = 6 * 3600; // covered areas are refetched after this to pick up new places
+    double max_radius_m = 20000.0;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> memory_answers{0};
+    std::atomic<uint64_t> area_fetches{0};
+    BackgroundRefresher refresher; // started by serve when refresher.policy.calls_per_minute > 0
+    int metrics_interval_seconds = 15;
+    std::string snapshot_path; // store snapshot mapped by serve at start and rewritten at exit; empty for neither
+
+    // A client of the serve loop. Only the loop thread touches it; while busy, a pool worker is answering one of its
+    // lines, and the loop neither reads from nor closes the socket.
+    typedef struct Connection
+    {
+        std::string buffer;  // received bytes not yet taken as request lines
+        bool busy = false;
+        bool closed = false; // the client hung up or a response could not be sent; closed once not busy
+    } Connection;
+
+    // Listens on socket_path until stopRequested is set. One thread polls every idle connection and hands each complete
+    // request line to a pool of worker threads, so connected but quiet clients hold no worker.
+    bool serve(const std::string &socket_path, int threads)
+    {
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (listen_fd < 0 || socket_path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "Could not create socket " << socket_path << std::endl;
+            return false;
+        }
+        std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+        unlink(socket_path.c_str()); // left behind by a previous run
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 128) != 0)
+        {
+            std::cerr << "Could not listen on " << socket_path << std::endl;
+            close(listen_fd);
+            return false;
+        }
+        int wake[2] = {-1, -1}; // workers write a byte to wake[1] when they have answered, so the loop polls that client again
+        if (pipe(wake) != 0)
+        {
+            std::cerr << "Could not create the serve loop's wake pipe" << std::endl;
+            close(listen_fd);
+            return false;
+        }
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+        std::cout << "Serving on " << socket_path << " with " << threads << " threads" << std::endl;
+        open_snapshot();
+        if (refresher.policy.calls_per_minute > 0)
+        {
+            refresher.api_key = api_key;
+            refresher.start();
+        }
+
+        std::unordered_map<int, Connection> connections;
+        std::mutex answered_mutex;
+        std::vector<std::pair<int, bool>> answered; // connections a worker is done with, and whether its response was sent
+        {
+            ThreadPool pool(threads);
+            auto metrics_written = std::chrono::steady_clock::now();
+            std::vector<pollfd> waiting;
+            while (!stopRequested)
+            {
+                if (std::chrono::steady_clock::now() - metrics_written >= std::chrono::seconds(metrics_interval_seconds))
+                {
+                    metrics_written = std::chrono::steady_clock::now();
+                    write_metrics_file();
+                }
+
+                std::vector<std::pair<int, bool>> done;
+                {
+                    std::lock_guard<std::mutex> lock(answered_mutex);
+                    done.swap(answered);
+                }
+                for (const std::pair<int, bool> &client : done)
+                {
+                    Connection &connection = connections[client.first];
+                    connection.busy = false;
+                    if (!client.second)
+                    {
+                        connection.closed = true;
+                        connection.buffer.clear(); // nobody left to answer
+                    }
+                }
+
+                // Hand the next complete line of every idle connection to the pool; lines a client sent before hanging
+                // up are still answered, one at a time and in order
+                for (auto entry = connections.begin(); entry != connections.end();)
+                {
+                    int fd = entry->first;
+                    Connection &connection = entry->second;
+                    size_t newline = connection.busy ? std::string::npos : connection.buffer.find('\n');
+                    if (newline != std::string::npos)
+                    {
+                        std::string line = connection.buffer.substr(0, newline);
+                        connection.buffer.erase(0, newline + 1);
+                        if (!line.empty() && line.back() == '\r')
+                        {
+                            line.pop_back();
+                        }
+                        connection.busy = true;
+                        pool.submit([this, fd, line, &answered_mutex, &answered, &wake]()
+                                    {
+                                        bool sent = send_response(fd, handle(line) + "\n");
+                                        {
+                                            std::lock_guard<std::mutex> lock(answered_mutex);
+                                            answered.emplace_back(fd, sent);
+                                        }
+                                        char byte = 0;
+                                        ssize_t woken = write(wake[1], &byte, 1); // a full pipe already wakes the loop
+                                        (void)woken; });
+                    }
+                    if (!connection.busy && connection.closed && connection.buffer.find('\n') == std::string::npos)
+                    {
+                        close(fd);
+                        entry = connections.erase(entry);
+                        continue;
+                    }
+                    ++entry;
+                }
+
+                waiting.assign({{listen_fd, POLLIN, 0}, {wake[0], POLLIN, 0}});
+                for (const auto &entry : connections)
+                {
+                    if (!entry.second.busy && !entry.second.closed)
+                    {
+                        waiting.push_back({entry.first, POLLIN, 0});
+                    }
+                }
+                if (poll(waiting.data(), waiting.size(), 200) <= 0)
+                {
+                    continue; // timeout (re-check the stop flag) or EINTR from the signal
+                }
+                if (waiting[0].revents & POLLIN)
+                {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd >= 0)
+                    {
+                        connections[fd];
+                    }
+                }
+                if (waiting[1].revents & POLLIN)
+                {
+                    char drain[64];
+                    while (read(wake[0], drain, sizeof(drain)) > 0)
+                    {
+                    }
+                }
+                char chunk[4096];
+                for (size_t w = 2; w < waiting.size(); w++)
+                {
+                    if (waiting[w].revents == 0)
+                    {
+                        continue;
+                    }
+                    Connection &connection = connections[waiting[w].fd];
+                    ssize_t received = recv(waiting[w].fd, chunk, sizeof(chunk), 0); // readable, so this does not block
+                    if (received <= 0)
+                    {
+                        connection.closed = true;
+                    }
+                    else
+                    {
+                        connection.buffer.append(chunk, static_cast<size_t>(received));
+                    }
+                }
+            }
+            // the pool's destructor lets requests already being answered finish
+        }
+        for (const auto &entry : connections)
+        {
+            close(entry.first);
+        }
+        close(wake[0]);
+        close(wake[1]);
+        refresher.stop();
+        refresher.print_stats(std::cout);
+        save_snapshot();
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        return true;
+    }
+
+    // Answers one request line
+    std::string handle(const std::string &line)
+    {
+        auto start = std::chrono::steady_clock::now();
+        requests++;
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+
+        if (command == "ping")
+        {
+            return "{\"status\":\"OK\"}";
+        }
+        if (command == "stats")
+        {
+            std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+            std::ostringstream out;
+            out << "{\"status\":\"OK\",\"requests\":" << requests.load() << ",\"memory_answers\":" << memory_answers.load()
+                << ",\"area_fetches\":" << area_fetches.load() << ",\"restaurants\":" << restaurantStore.size()
+                << ",\"indexed\":" << restaurantIndex.watermark.visible() << ",\"from_snapshot\":" << (current_snapshot() ? "true" : "false")
+                << ",\"details_cache_hits\":" << placeDetailsCache.hits.load() << ",\"refresh\":{\"status_updates\":" << refresher.status_updates.load()
+                << ",\"volatile_refetches\":" << refresher.volatile_refreshes.load() << ",\"full_refetches\":" << refresher.full_refreshes.load()
+                << ",\"changed\":" << refresher.changed.load() << ",\"failed\":" << refresher.failures.load() << "}"
+                << ",\"coalesced\":{\"nearby\":" << nearbyFlights.saved.load() << ",\"details\":" << detailsFlights.saved.load() << "}";
+            uint64_t hedged = 0, hedge_wins = 0, retried = 0, timed_out = 0, abandoned = 0;
+            for (size_t e = 0; e < kMetricEndpointCount; e++)
+            {
+                hedged += pipelineMetrics.hedges[e].load();
+                hedge_wins += pipelineMetrics.hedge_wins[e].load();
+                retried += pipelineMetrics.retries[e].load();
+                timed_out += pipelineMetrics.timeouts[e].load();
+                abandoned += pipelineMetrics.abandoned[e].load();
+            }
+            out << ",\"places_requests\":{\"hedged\":" << hedged << ",\"hedge_wins\":" << hedge_wins << ",\"retried\":" << retried
+                << ",\"timed_out\":" << timed_out << ",\"abandoned\":" << abandoned << "}}";
+            return out.str();
+        }
+        if (command == "metrics")
+        {
+            std::ostringstream text;
+            pipelineMetrics.write_prometheus(text);
+            return "{\"status\":\"OK\",\"prometheus\":" + json_escape(text.str()) + "}";
+        }
+        if (command == "find")
+        {
+            return find(words, start);
+        }
+        if (command != "nearby" && command != "top")
+        {
+            return error("unknown command " + command);
+        }
+        bool ranked = command == "top";
+
+        double lat = 0.0, lon = 0.0, radius = 0.0;
+        if (!(words >> lat >> lon >> radius) || radius <= 0.0 || radius > max_radius_m || std::abs(lat) > 90.0 || std::abs(lon) > 180.0)
+        {
+            return error(ranked ? "expected: top <lat> <lon> <radius_m> [type=] [prefer=] [min_rating=] [open=1] [limit=] [weights=<r>,<d>,<o>,<t>] [deadline_ms=]"
+                                : "expected: nearby <lat> <lon> <radius_m> [type=] [min_rating=] [open=1] [limit=] [deadline_ms=]");
+        }
+        RestaurantFilter filter;
+        RankQuery rank;
+        size_t limit = ranked ? 10 : 20;
+        int64_t deadline_ms = requestPolicy.lookup_budget_ms;
+        std::string option;
+        while (words >> option)
+        {
+            size_t equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+            if (key == "type")
+                filter.require_type(value);
+            else if (key == "min_rating")
+                filter.min_rating = std::strtof(value.c_str(), nullptr);
+            else if (key == "open" && value == "1")
+                filter.open_at = current_week_minute(); // from compiled hours, so it stays right while cached
+            else if (key == "limit")
+                limit = std::strtoul(value.c_str(), nullptr, 10);
+            else if (key == "deadline_ms")
+                deadline_ms = std::strtoll(value.c_str(), nullptr, 10); // 0 waits for the fetch however long it takes
+            else if (ranked && key == "prefer")
+                rank.type = value;
+            else if (ranked && key == "weights")
+            {
+                if (std::sscanf(value.c_str(), "%f,%f,%f,%f", &rank.weights.rating, &rank.weights.distance, &rank.weights.open, &rank.weights.type) != 4)
+                    return error("weights takes four numbers: rating,distance,open,type");
+            }
+            else
+                return error("unknown option " + option);
+        }
+
+        bool from_memory = is_covered(lat, lon, radius);
+        bool partial = false;
+        if (!from_memory)
+        {
+            // The query's deadline counts from its arrival, so time spent waiting for another fetch is part of it
+            DeadlineScope scope(Deadline::after_ms(deadline_ms, start));
+            partial = !cover_area(lat, lon, radius, from_memory);
+        }
+        if (from_memory)
+        {
+            memory_answers++;
+        }
+        else if (!filter.type.empty())
+        {
+            filter.require_type(filter.type); // the fetch may have brought the first place of this type
+        }
+
+        // Until the live store has been restored, answers come straight from the mapped snapshot
+        std::shared_ptr<const MappedSnapshot> snapshot = current_snapshot();
+        std::ostringstream out;
+        out << std::setprecision(9) << "{\"status\":\"OK\",\"source\":\"" << (from_memory ? (snapshot ? "snapshot" : "memory") : "fetched") << "\","
+            << (partial ? "\"partial\":true," : "") << "\"results\":[";
+        rank.center = LatLon(static_cast<float>(lat), static_cast<float>(lon));
+        rank.radius_m = radius;
+        rank.k = limit;
+        rank.filter = filter;
+        if (snapshot)
+        {
+            ranked ? write_ranked(out, *snapshot, snapshot->spatial, rank) : write_results(out, *snapshot, snapshot->spatial, lat, lon, radius, filter, limit);
+        }
+        else
+        {
+            std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+            ranked ? write_ranked(out, restaurantStore, restaurantSpatialIndex, rank) : write_results(out, restaurantStore, restaurantSpatialIndex, lat, lon, radius, filter, limit);
+        }
+        out << "],\"elapsed_us\":" << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() << "}";
+        return out.str();
+    }
+
+private:
+    std::mutex coverage_mutex;
+    std::vector<CoveredArea> covered;
+
+    // An area fetch under way; queries inside its circle wait for it rather than sweep the same ground again
+    typedef struct AreaFetch
+    {
+        uint64_t id;
+        double lat;
+        double lon;
+        double radius_m;
+        std::shared_future<bool> done; // fetch_area's result
+    } AreaFetch;
+    std::vector<AreaFetch> fetching; // guarded by coverage_mutex
+    uint64_t fetch_ids = 0;
+    std::mutex restore_mutex; // one joiner for the restoring thread
+
+    // is_covered for callers already holding coverage_mutex
+    bool covers(double lat, double lon, double radius) const
+    {
+        int64_t now = unix_now();
+        for (const CoveredArea &area : covered)
+        {
+            if (now - area.fetched_at <= coverage_ttl_seconds &&
+                distance_meters(lat, lon, area.lat, area.lon) + radius <= area.radius_m)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    std::mutex snapshot_mutex;
+    std::shared_ptr<const MappedSnapshot> snapshot; // set from open_snapshot until restoring it into the store is done
+    std::thread restoring;
+
+    static int64_t unix_now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static std::string error(const std::string &message)
+    {
+        return "{\"status\":\"INVALID_REQUEST\",\"error_message\":" + json_escape(message) + "}";
+    }
+
+    // Matches within radius of (lat, lon), nearest first, as JSON objects; store is the live store or a mapped snapshot
+    template <typename Store>
+    static void write_results(std::ostream &out, const Store &store, const GridIndex<Store> &grid, double lat, double lon, double radius,
+                              const RestaurantFilter &filter, size_t limit)
+    {
+        LatLon center(static_cast<float>(lat), static_cast<float>(lon));
+        std::vector<std::pair<double, uint32_t>> found;
+        for (uint32_t index : grid.within_radius(center, radius, filter))
+        {
+            found.emplace_back(distance_meters(lat, lon, store.lat[index], store.lon[index]), index);
+        }
+        std::sort(found.begin(), found.end());
+        for (size_t n = 0; n < found.size() && n < limit; n++)
+        {
+            out << (n ? "," : "") << "{";
+            write_fields(out, store[found[n].second], found[n].first);
+            out << "}";
+        }
+    }
+
+    // Name and address search over the live store; words are the query, key=value tokens the options
+    std::string find(std::istringstream &words, std::chrono::steady_clock::time_point start)
+    {
+        TextQuery query;
+        std::string word;
+        while (words >> word)
+        {
+            size_t equals = word.find('=');
+            if (equals == std::string::npos)
+            {
+                query.text += (query.text.empty() ? "" : " ") + word;
+                continue;
+            }
+            std::string key = word.substr(0, equals);
+            std::string value = word.substr(equals + 1);
+            float lat = 0.0f, lon = 0.0f;
+            if (key == "type")
+                query.filter.require_type(value);
+            else if (key == "min_rating")
+                query.filter.min_rating = std::strtof(value.c_str(), nullptr);
+            else if (key == "open" && value == "1")
+                query.filter.open_at = current_week_minute();
+            else if (key == "limit")
+                query.limit = std::strtoul(value.c_str(), nullptr, 10);
+            else if (key == "typos")
+                query.typos = value != "0";
+            else if (key == "near" && std::sscanf(value.c_str(), "%f,%f,%lf", &lat, &lon, &query.radius_m) == 3 && query.radius_m > 0.0)
+                query.center = LatLon(lat, lon);
+            else
+                return error("unknown option " + word);
+        }
+        if (query.text.empty())
+        {
+            return error("expected: find <words...> [type=] [min_rating=] [open=1] [limit=] [near=<lat>,<lon>,<radius_m>] [typos=0]");
+        }
+        if (current_snapshot())
+        {
+            wait_for_restore(); // the text index is built once the store is restored
+        }
+
+        std::vector<TextHit> hits;
+        std::ostringstream out;
+        out << std::setprecision(9) << "{\"status\":\"OK\",\"source\":\"memory\",\"results\":[";
+        {
+            std::shared_lock<std::shared_mutex> lock(restaurantStoreMutex);
+            restaurantText.search(restaurantStore, query, hits);
+            for (size_t n = 0; n < hits.size(); n++)
+            {
+                const restaurant_data &restaurant = restaurantStore[hits[n].index];
+                double distance = query.radius_m > 0.0 ? distance_meters(query.center.lat, query.center.lon, restaurant.location.lat, restaurant.location.lon) : -1.0;
+                out << (n ? "," : "") << "{";
+                write_fields(out, restaurant, distance);
+                out << ",\"match\":\"" << kMatchKindNames[hits[n].match] << "\",\"in_name\":" << (hits[n].in_name ? "true" : "false") << "}";
+            }
+        }
+        out << "],\"elapsed_us\":" << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() << "}";
+        return out.str();
+    }
+
+    // The best rank.k matches by rank_restaurants, best first, with their scores
+    template <typename Store>
+    static void write_ranked(std::ostream &out, const Store &store, const GridIndex<Store> &grid, const RankQuery &rank)
+    {
+        std::vector<RankedRestaurant> best = rank_restaurants(store, grid, rank);
+        for (size_t n = 0; n < best.size(); n++)
+        {
+            out << (n ? "," : "") << "{";
+            write_fields(out, store[best[n].index], best[n].distance_m);
+            out << ",\"score\":" << best[n].score << "}";
+        }
+    }
+
+    // restaurant is a reference into the store, or a record of views into the mapping; distance_m < 0 leaves it out
+    template <typename Record>
+    static void write_fields(std::ostream &out, const Record &restaurant, double distance_m)
+    {
+        out << "\"name\":" << json_escape(restaurant.name) << ",\"place_id\":" << json_escape(restaurant.place_id)
+            << ",\"lat\":" << restaurant.location.lat << ",\"lon\":" << restaurant.location.lon << ",\"rating\":" << restaurant.rating;
+        if (distance_m >= 0.0)
+            out << ",\"distance_m\":" << static_cast<int>(distance_m);
+        out << ",\"cuisine\":" << json_escape(restaurant.cuisine)
+            << ",\"address\":" << json_escape(restaurant.address) << ",\"status\":" << json_escape(restaurant.current_status)
+            << ",\"url\":" << json_escape(restaurant.url);
+    }
+
+    std::shared_ptr<const MappedSnapshot> current_snapshot()
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        return snapshot;
+    }
+
+    // Maps the snapshot left by the previous run so queries are answered right away, then restores the live store,
+    // indices and grid from it on a background thread. Queries switch to the store once it is complete; the mapping
+    // goes away with the last query still using it.
+    void open_snapshot()
+    {
+        if (snapshot_path.empty())
+        {
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<MappedSnapshot> mapped = std::make_shared<MappedSnapshot>();
+        if (!mapped->open(snapshot_path))
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(coverage_mutex);
+            covered.assign(mapped->covered().begin(), mapped->covered().end());
+        }
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            snapshot = mapped;
+        }
+        std::cout << "Mapped " << mapped->size() << " restaurants from " << snapshot_path << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+        restoring = std::thread([this, mapped]()
+                                {
+            auto restore_start = std::chrono::steady_clock::now();
+            RestaurantStore restored;
+            restore_store(*mapped, restored);
+            {
+                std::lock_guard<std::shared_mutex> lock(restaurantStoreMutex);
+                restaurantStore = std::move(restored);
+                rebuild_restaurant_maps();
+                restaurantText.rebuild(restaurantStore);
+                restaurantSpatialIndex.build(restaurantStore);
+            }
+            {
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                snapshot.reset();
+            }
+            std::cout << "Restored the store from the snapshot in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - restore_start).count() << " ms" << std::endl; });
+    }
+
+    void wait_for_restore()
+    {
+        std::lock_guard<std::mutex> lock(restore_mutex);
+        if (restoring.joinable())
+        {
+            restoring.join();
+        }
+    }
+
+    // Writes the store for the next start to map
+    void save_snapshot()
+    {
+        wait_for_restore();
+        if (snapshot_path.empty())
+        {
+            return;
+        }
+        std::shared_lock<std::shared_mutex> store_lock(restaurantStoreMutex);
+        std::lock_guard<std::mutex> lock(coverage_mutex);
+        if (save_store_snapshot(snapshot_path, restaurantStore, restaurantSpatialIndex, covered))
+        {
+            std::cout << "Saved " << restaurantStore.size() << " restaurants to " << snapshot_path << std::endl;
+        }
+    }
+
+    // True if the circle lies inside an area fetched within the coverage TTL
+    bool is_covered(double lat, double lon, double radius)
+    {
+        std::lock_guard<std::mutex> lock(coverage_mutex);
+        return covers(lat, lon, radius);
+    }
+
+    // Gets the circle into memory for a query that found it uncovered. A fetch already running over all of it is
+    // waited for, but only until the thread's deadline, so queries never queue behind fetches of other areas and a
+    // slow sweep holds up just the queries inside it. Otherwise the circle is fetched here. Returns false if the
+    // circle is not wholly in memory (the answer is partial); joined tells whether another query's fetch did the work.
+    bool cover_area(double lat, double lon, double radius, bool &joined)
+    {
+        std::promise<bool> result;
+        std::shared_future<bool> running;
+        uint64_t id = 0;
+        {
+            std::lock_guard<std::mutex> lock(coverage_mutex);
+            if (covers(lat, lon, radius))
+            {
+                joined = true; // a fetch finished since the caller looked
+                return true;
+            }
+            for (const AreaFetch &fetch : fetching)
+            {
+                if (distance_meters(lat, lon, fetch.lat, fetch.lon) + radius <= fetch.radius_m)
+                {
+                    running = fetch.done;
+                    break;
+                }
+            }
+            if (!running.valid())
+            {
+                id = ++fetch_ids;
+                fetching.push_back({id, lat, lon, radius, result.get_future().share()});
+            }
+        }
+        if (running.valid())
+        {
+            joined = true;
+            if (threadDeadline.set() && running.wait_until(threadDeadline.at) != std::future_status::ready)
+            {
+                return false;
+            }
+            return running.get();
+        }
+
+        joined = false;
+        bool fetched = false;
+        try
+        {
+            fetched = fetch_area(lat, lon, radius);
+        }
+        catch (...)
+        {
+            finish_area_fetch(id, result, false);
+            throw;
+        }
+        finish_area_fetch(id, result, fetched);
+        return fetched;
+    }
+
+    // Releases the queries waiting on an area fetch started by cover_area
+    void finish_area_fetch(uint64_t id, std::promise<bool> &result, bool fetched)
+    {
+        {
+            std::lock_guard<std::mutex> lock(coverage_mutex);
+            fetching.erase(std::remove_if(fetching.begin(), fetching.end(), [&](const AreaFetch &fetch)
+                                          { return fetch.id == id; }),
+                           fetching.end());
+        }
+        result.set_value(fetched);
+    }
+
+    // Sweeps the circle, enriches what was found and publishes it to the store, maps and spatial index. Returns false
+    // if a tile's search failed (network, quota, denied key) or the thread's deadline cut the fetch short: what arrived
+    // is kept, but the area is not marked covered.
+    bool fetch_area(double lat, double lon, double radius)
+    {
+        wait_for_restore(); // new places go into the restored store, not one about to be replaced
+        area_fetches++;
+        SweepStats stats;
+        std::vector<restaurant_data> restaurants = sweep_area(lat, lon, radius, api_key, sweep_workers, 100.0, stats);
+        enrich_and_store(restaurants, api_key);
+        {
+            std::lock_guard<std::shared_mutex> lock(restaurantStoreMutex);
+            auto start = std::chrono::steady_clock::now();
+            restaurantSpatialIndex.build(restaurantStore);
+            pipelineMetrics.index.record_since(start);
+        }
+        if (threadDeadline.cut_short())
+        {
+            std::cerr << "Fetch of " << lat << "," << lon << " r=" << radius << " ran out of time; the next query there fetches again" << std::endl;
+            return false;
+        }
+        if (stats.failed_tiles > 0)
+        {
+            std::cerr << "Fetch of " << lat << "," << lon << " r=" << radius << " lost " << stats.failed_tiles
+                      << " tiles; the next query there fetches again" << std::endl;
+            return false;
+        }
+
+        int64_t now = unix_now();
+        std::lock_guard<std::mutex> lock(coverage_mutex);
+        covered.erase(std::remove_if(covered.begin(), covered.end(), [&](const CoveredArea &area)
+                                     { return now - area.fetched_at > coverage_ttl_seconds ||
+                                              distance_meters(lat, lon, area.lat, area.lon) + area.radius_m <= radius; }),
+                      covered.end());
+        covered.push_back({lat, lon, radius, now});
+        return true;
+    }
+
+    // Writes a whole response to a client; false if it went away
+    static bool send_response(int fd, const std::string &response)
+    {
+        for (size_t sent = 0; sent < response.size();)
+        {
+            ssize_t written = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0)
+            {
+                return false;
+            }
+            sent += static_cast<size_t>(written);
+        }
+        return true;
+    }
+} QueryDaemon;
+
+// Sends one request line to a running daemon and prints the response with the round-trip time
+int ask_daemon(const std::string &socket_path, const std::string &request)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (fd < 0 || socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Could not create socket" << std::endl;
+        return 1;
+    }
+    std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        std::cerr << "No daemon listening on " << socket_path << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string line = request + "\n";
+    send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+    std::string response;
+    char chunk[4096];
+    ssize_t received;
+    while (response.find('\n') == std::string::npos && (received = recv(fd, chunk, sizeof(chunk), 0)) > 0)
+    {
+        response.append(chunk, static_cast<size_t>(received));
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    close(fd);
+
+    std::cout << response;
+    std::cerr << "(" << elapsed_ms << " ms round trip)" << std::endl;
+    return response.empty() ? 1 : 0;
+}
+
+// Behaviour of the local Places stand-in
+typedef struct MockPlacesOptions
+{
+    int results_per_query = 60; // served as pages of 20 linked by next_page_token
+    int latency_ms = 20;        // added to every response
+    int jitter_ms = 10;         // uniform extra latency on top of latency_ms
+    double error_rate = 0.0;    // share of requests answered with OVER_QUERY_LIMIT or HTTP 500
+    int token_delay_ms = 100;   // page tokens answer INVALID_REQUEST until this old
+    double slow_rate = 0.0;     // share of responses held back a further slow_ms, like a stalled backend
+    int slow_ms = 1000;
+    double truncate_rate = 0.0; // share of nearbysearch pages whose connection drops halfway through the body
+} MockPlacesOptions;
+
+// Minimal HTTP/1.1 server on 127.0.0.1 that imitates the nearbysearch and details endpoints with synthetic
+// fixtures, so the fetch path can be exercised and timed without an API key or network access.
+// Connections are kept alive and each one is served by its own thread.
+typedef struct MockPlacesServer
+{
+    MockPlacesOptions options;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors_injected{0};
+    std::atomic<uint64_t> slow_responses{0};
+    std::atomic<uint64_t> truncated_responses{0};
+
+    MockPlacesServer() {}
+    MockPlacesServer(const MockPlacesServer &) = delete;
+    MockPlacesServer &operator=(const MockPlacesServer &) = delete;
+    ~MockPlacesServer() { stop(); }
+
+    // Listens on the given port (0 picks a free one); returns false if the socket could not be set up
+    bool start(int port = 0)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        socklen_t length = sizeof(address);
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 128) != 0 ||
+            getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+        {
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        bound_port = ntohs(address.sin_port);
+        running = true;
+        acceptor = std::thread([this]()
+                               { accept_loop(); });
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+        {
+            return;
+        }
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        acceptor.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int fd : open_fds)
+            {
+                shutdown(fd, SHUT_RDWR); // unblocks the connection threads
+            }
+        }
+        for (std::thread &connection : connections)
+        {
+            connection.join();
+        }
+        connections.clear();
+    }
+
+    // Value for placesApiBase that routes requests here
+    std::string base_url() const { return "http://127.0.0.1:" + std::to_string(bound_port) + "/maps/api/place"; }
+
+private:
+    int listen_fd = -1;
+    int bound_port = 0;
+    std::atomic<bool> running{false};
+    std::thread acceptor;
+    std::mutex mutex;
+    std::vector<std::thread> connections;
+    std::unordered_set<int> open_fds;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> tokens; // token -> time issued
+
+    void accept_loop()
+    {
+        while (running)
+        {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                continue; // woken by stop() or a transient error
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            open_fds.insert(fd);
+            connections.emplace_back([this, fd]()
+                                     { serve_connection(fd); });
+        }
+    }
+
+    // Answers requests on one keep-alive connection until the client hangs up
+    void serve_connection(int fd)
+    {
+        std::mt19937 rng(static_cast<unsigned>(fd) * 2654435761u);
+        std::string buffer;
+        char chunk[4096];
+        while (true)
+        {
+            size_t header_end;
+            while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received <= 0)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    open_fds.erase(fd);
+                    close(fd);
+                    return;
+                }
+                buffer.append(chunk, static_cast<size_t>(received));
+            }
+
+            // "GET <target> HTTP/1.1"
+            size_t target_start = buffer.find(' ') + 1;
+            std::string target = buffer.substr(target_start, buffer.find(' ', target_start) - target_start);
+            buffer.erase(0, header_end + 4);
+            requests++;
+
+            int status = 200;
+            std::string body = respond(target, status, rng);
+            int delay = options.latency_ms + (options.jitter_ms > 0 ? static_cast<int>(rng() % (options.jitter_ms + 1)) : 0);
+            if (options.slow_rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < options.slow_rate)
+            {
+                slow_responses++;
+                delay += options.slow_ms;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+            std::string response = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Error") +
+                                   "\r\nContent-Type: application/json; charset=UTF-8\r\nContent-Length: " +
+                                   std::to_string(body.size()) + "\r\n\r\n" + body;
+            bool truncate = status == 200 && options.truncate_rate > 0.0 && target.find("/nearbysearch/json") != std::string::npos &&
+                            std::uniform_real_distribution<double>(0.0, 1.0)(rng) < options.truncate_rate;
+            size_t length = truncate ? response.size() - body.size() / 2 : response.size();
+            for (size_t sent = 0; sent < length;)
+            {
+                ssize_t written = send(fd, response.data() + sent, length - sent, MSG_NOSIGNAL);
+                if (written <= 0)
+                    break;
+                sent += static_cast<size_t>(written);
+            }
+            if (truncate)
+            {
+                truncated_responses++;
+                std::lock_guard<std::mutex> lock(mutex);
+                open_fds.erase(fd);
+                close(fd); // the client sees the body end early
+                return;
+            }
+        }
+    }
+
+    static std::string query_param(const std::string &target, const std::string &name)
+    {
+        size_t start = target.find(name + "=");
+        while (start != std::string::npos && start > 0 && target[start - 1] != '?' && target[start - 1] != '&')
+        {
+            start = target.find(name + "=", start + 1);
+        }
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+        start += name.size() + 1;
+        return target.substr(start, target.find('&', start) - start);
+    }
+
+    std::string respond(const std::string &target, int &status, std::mt19937 &rng)
+    {
+        if (options.error_rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < options.error_rate)
+        {
+            errors_injected++;
+            if (rng() % 2)
+            {
+                status = 500;
+                return "{}";
+            }
+            return "{\"html_attributions\":[],\"status\":\"OVER_QUERY_LIMIT\",\"error_message\":\"mock quota exceeded\"}";
+        }
+        if (target.find("/nearbysearch/json") != std::string::npos)
+        {
+            return nearby_page(target);
+        }
+        if (target.find("/details/json") != std::string::npos)
+        {
+            return details(query_param(target, "place_id"), query_param(target, "fields"));
+        }
+        status = 404;
+        return "{}";
+    }
+
+    // Page "<seed>:<page>" of the synthetic results for a location
+    std::string nearby_page(const std::string &target)
+    {
+        std::string token = query_param(target, "pagetoken");
+        std::string seed;
+        int page = 0;
+        double lat = 43.65, lon = -79.38;
+        if (token.empty())
+        {
+            std::string location = query_param(target, "location");
+            seed = std::to_string(std::hash<std::string>()(location) % 1000000007);
+            std::sscanf(location.c_str(), "%lf,%lf", &lat, &lon);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto issued = tokens.find(token);
+            if (issued == tokens.end() ||
+                std::chrono::steady_clock::now() - issued->second < std::chrono::milliseconds(options.token_delay_ms))
+            {
+                return "{\"html_attributions\":[],\"results\":[],\"status\":\"INVALID_REQUEST\"}";
+            }
+            std::sscanf(token.c_str(), "%*[^:]:%d:%lf:%lf", &page, &lat, &lon);
+            seed = token.substr(0, token.find(':'));
+        }
+
+        int first = page * 20;
+        int count = std::max(0, std::min(20, options.results_per_query - first));
+        std::ostringstream json;
+        json << std::setprecision(9) << "{\"html_attributions\":[],";
+        if (first + count < options.results_per_query)
+        {
+            std::ostringstream next;
+            next << std::setprecision(9) << seed << ":" << page + 1 << ":" << lat << ":" << lon;
+            std::lock_guard<std::mutex> lock(mutex);
+            tokens[next.str()] = std::chrono::steady_clock::now();
+            json << "\"next_page_token\":\"" << next.str() << "\",";
+        }
+        json << "\"results\":[";
+        for (int n = first; n < first + count; n++)
+        {
+            unsigned h = static_cast<unsigned>(std::hash<std::string>()(seed + "/" + std::to_string(n)));
+            json << (n > first ? "," : "")
+                 << "{\"business_status\":\"OPERATIONAL\",\"geometry\":{\"location\":{\"lat\":" << lat + (static_cast<int>(h % 2001) - 1000) * 1e-6
+                 << ",\"lng\":" << lon + (static_cast<int>((h / 2001) % 2001) - 1000) * 1e-6 << "}},"
+                 << "\"name\":\"Mock Restaurant " << seed << "-" << n << "\",\"opening_hours\":{\"open_now\":" << (h % 3 ? "true" : "false") << "},"
+                 << "\"place_id\":\"mock-" << seed << "-" << n << "\",\"rating\":" << (h % 41) / 10.0 + 1.0 << ","
+                 << "\"types\":[\"" << (h % 2 ? "sushi_restaurant" : "pizza_restaurant") << "\",\"restaurant\",\"food\",\"point_of_interest\",\"establishment\"],"
+                 << "\"user_ratings_total\":" << h % 5000 << ",\"vicinity\":\"" << n << " Mock Street\"}";
+        }
+        json << "],\"status\":\"OK\"}";
+        return json.str();
+    }
+
+    // Like the real endpoint, only the fields asked for are returned (all of them when the mask is missing)
+    static std::string details(const std::string &place_id, const std::string &fields)
+    {
+        static const char *days[] = {"Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday"};
+        auto asked = [&](const char *field)
+        {
+            return fields.empty() || ("," + fields + ",").find(std::string(",") + field + ",") != std::string::npos;
+        };
+        std::ostringstream json;
+        json << "{\"html_attributions\":[],\"result\":{";
+        const char *separator = "";
+        if (asked("name"))
+        {
+            json << "\"name\":\"" << place_id << "\"";
+            separator = ",";
+        }
+        if (asked("opening_hours"))
+        {
+            json << separator << "\"opening_hours\":{\"open_now\":true,\"periods\":[";
+            for (int day = 0; day < 7; day++)
+            {
+                json << (day ? "," : "") << "{\"close\":{\"day\":" << day << ",\"time\":\"2200\"},\"open\":{\"day\":" << day << ",\"time\":\"1100\"}}";
+            }
+            json << "],\"weekday_text\":[";
+            for (int day = 0; day < 7; day++)
+            {
+                json << (day ? "," : "") << "\"" << days[day] << ": 11:00\\u202fAM \\u2013 10:00\\u202fPM\"";
+            }
+            json << "]}";
+            separator = ",";
+        }
+        if (asked("url"))
+        {
+            json << separator << "\"url\":\"https://maps.google.com/?cid=" << std::hash<std::string>()(place_id) % 100000 << "\"";
+            separator = ",";
+        }
+        if (asked("website"))
+        {
+            json << separator << "\"website\":\"https://example.com/" << place_id << "\"";
+        }
+        json << "},\"status\":\"OK\"}";
+        return json.str();
+    }
+} MockPlacesServer;
+
+// Value at quantile q (0..1) of an already sorted sample
+double percentile(const std::vector<double> &sorted, double q)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// End-to-end benchmark against the local mock: each lookup runs fetch_nearby_restaurants followed by the concurrent
+// details engine, exactly as generateRestaurantMaps does, with lookups spread over `concurrency` threads
+int run_e2e_benchmark(int lookups, int concurrency, const MockPlacesOptions &options)
+{
+    MockPlacesServer server;
+    server.options = options;
+    if (!server.start())
+    {
+        std::cerr << "Could not start the mock Places server" << std::endl;
+        return 1;
+    }
+    placesApiBase = server.base_url();
+    placeDetailsCache.enabled = false;
+    pageTokenMinDelayMs = 0;
+    pageTokenDelayMs = options.token_delay_ms;
+
+    std::vector<double> latencies_ms(lookups);
+    std::atomic<int> next_lookup{0};
+    std::atomic<size_t> places{0};
+    uint64_t allocations_before = allocationCount.load();
+
+    // Progress lines from the fetch functions would swamp the report
+    std::ostringstream discarded;
+    std::streambuf *console = std::cout.rdbuf(discarded.rdbuf());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int w = 0; w < std::max(1, concurrency); w++)
+    {
+        workers.emplace_back([&]()
+                             {
+            for (int n = next_lookup++; n < lookups; n = next_lookup++)
+            {
+                auto lookup_start = std::chrono::steady_clock::now();
+                std::string location = std::to_string(43.60 + 0.001 * n) + "," + std::to_string(-79.40 - 0.001 * n);
+                std::vector<restaurant_data> restaurants = fetch_nearby_restaurants(location, 1000, 60, "mock-key");
+                fetch_place_details_concurrent(restaurants, "mock-key", maxDetailsInFlight);
+                places += restaurants.size();
+                latencies_ms[n] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lookup_start).count();
+            } });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(console);
+    server.stop();
+
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    uint64_t requests = server.requests.load();
+    std::cout << "end-to-end against local mock (" << lookups << " lookups, " << concurrency << " concurrent, latency "
+              << options.latency_ms << "+" << options.jitter_ms << " ms, error rate " << options.error_rate << ")" << std::endl;
+    std::cout << "  places fetched:   " << places.load() << std::endl;
+    std::cout << "  HTTP requests:    " << requests << " (" << requests / elapsed_s << " req/s, " << server.errors_injected.load() << " injected errors)" << std::endl;
+    std::cout << "  lookup latency:   p50 " << percentile(latencies_ms, 0.50) << " ms, p99 " << percentile(latencies_ms, 0.99) << " ms" << std::endl;
+    std::cout << "  allocations:      " << allocationCount.load() - allocations_before << " ("
+              << static_cast<double>(allocationCount.load() - allocations_before) / std::max<size_t>(1, places.load()) << " per place)" << std::endl;
+    std::cout << "  peak RSS:         " << peak_rss_kib() << " KiB" << std::endl;
+    places_http_client().print_stats(std::cout);
+    placesScheduler.print_stats(std::cout);
+    nearbyFlights.print_stats(std::cout, "Nearby");
+    detailsFlights.print_stats(std::cout, "Details");
+    pipelineMetrics.print_summary(std::cout);
+    return 0;
+}
+
+// Tail latency of details lookups against a mock where a share of responses stall: each lookup enriches one page of
+// places through the concurrent details engine. Runs with neither hedges nor retries, with requestPolicy's hedging and
+// retries, and with those under a lookup deadline, and reports the latency spread and what each policy cost in requests.
+int run_hedge_benchmark(int lookups, double slow_rate, int slow_ms, double error_rate)
+{
+    MockPlacesOptions options;
+    options.slow_rate = slow_rate;
+    options.slow_ms = slow_ms;
+    options.error_rate = error_rate;
+    MockPlacesServer server;
+    server.options = options;
+    if (!server.start())
+    {
+        std::cerr << "Could not start the mock Places server" << std::endl;
+        return 1;
+    }
+    placesApiBase = server.base_url();
+    placeDetailsCache.enabled = false;
+    placesScheduler.configure(PlacesEndpoint::Details, 1000.0, 1000.0); // measure the mock, not the API's quota
+    places_http_client().max_host_connections = 2L * maxDetailsInFlight; // the mock has no HTTP/2 streams to multiplex onto
+    const int kPlacesPerLookup = 20;
+    const RequestPolicy defaults = requestPolicy;
+
+    typedef struct HedgeRun
+    {
+        const char *name;
+        double hedge_percentile;
+        int max_retries;
+        int64_t lookup_budget_ms;
+    } HedgeRun;
+    const HedgeRun runs[] = {{"no hedging or retries", 0.0, 0, 0},
+                             {"hedged + retried", defaults.hedge_percentile, defaults.max_retries, 0},
+                             {"hedged + retried, 300 ms deadline", defaults.hedge_percentile, defaults.max_retries, 300}};
+
+    std::cout << "details lookups against local mock (" << lookups << " lookups of " << kPlacesPerLookup << " places, "
+              << options.latency_ms << "+" << options.jitter_ms << " ms, " << slow_rate * 100.0 << "% stalled by " << slow_ms
+              << " ms, error rate " << error_rate << ", hedge at p" << defaults.hedge_percentile << ")" << std::endl;
+    const size_t details = static_cast<size_t>(MetricEndpoint::Details);
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+    {
+        const HedgeRun &run = runs[r];
+        requestPolicy.hedge_percentile = run.hedge_percentile;
+        requestPolicy.max_retries = run.max_retries;
+        requestPolicy.lookup_budget_ms = run.lookup_budget_ms;
+        uint64_t requests_before = server.requests.load();
+        uint64_t hedges_before = pipelineMetrics.hedges[details].load();
+        uint64_t wins_before = pipelineMetrics.hedge_wins[details].load();
+        uint64_t retries_before = pipelineMetrics.retries[details].load();
+        uint64_t timeouts_before = pipelineMetrics.timeouts[details].load();
+        uint64_t abandoned_before = pipelineMetrics.abandoned[details].load();
+
+        std::ostringstream discarded;
+        std::streambuf *console = std::cout.rdbuf(discarded.rdbuf());
+        std::streambuf *errors = std::cerr.rdbuf(discarded.rdbuf());
+        std::vector<double> latencies_ms;
+        size_t enriched = 0;
+        for (int n = -1; n < lookups; n++) // the first lookup warms connections and the hedge delay's histogram
+        {
+            std::vector<restaurant_data> restaurants(kPlacesPerLookup);
+            for (int i = 0; i < kPlacesPerLookup; i++)
+            {
+                restaurants[i].place_id = "hedge" + std::to_string(r) + "-" + std::to_string(n) + "-" + std::to_string(i);
+                restaurants[i].name = restaurants[i].place_id;
+            }
+            auto start = std::chrono::steady_clock::now();
+            DeadlineScope scope(Deadline::after_ms(requestPolicy.lookup_budget_ms, start));
+            int filled = fetch_place_details_concurrent(restaurants, "mock-key", maxDetailsInFlight);
+            if (n >= 0)
+            {
+                latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                enriched += static_cast<size_t>(filled);
+            }
+        }
+        std::cout.rdbuf(console);
+        std::cerr.rdbuf(errors);
+
+        std::sort(latencies_ms.begin(), latencies_ms.end());
+        std::cout << "  " << run.name << ":" << std::endl;
+        std::cout << "    latency p50 " << percentile(latencies_ms, 0.50) << " ms, p95 " << percentile(latencies_ms, 0.95) << " ms, p99 " << percentile(latencies_ms, 0.99) << " ms, max "
+                  << (latencies_ms.empty() ? 0.0 : latencies_ms.back()) << " ms; " << enriched << "/" << static_cast<size_t>(lookups) * kPlacesPerLookup
+                  << " places enriched" << std::endl;
+        std::cout << "    " << server.requests.load() - requests_before << " requests: " << pipelineMetrics.hedges[details].load() - hedges_before
+                  << " hedged (" << pipelineMetrics.hedge_wins[details].load() - wins_before << " won), "
+                  << pipelineMetrics.retries[details].load() - retries_before << " retried, " << pipelineMetrics.timeouts[details].load() - timeouts_before
+                  << " timed out, " << pipelineMetrics.abandoned[details].load() - abandoned_before << " abandoned" << std::endl;
+    }
+    requestPolicy = defaults;
+    server.stop();
+    std::cout << "  hedge delay at the end: " << requestPolicy.hedge_delay_ms(MetricEndpoint::Details) << " ms; " << server.slow_responses.load()
+              << " responses stalled, " << server.errors_injected.load() << " errors injected" << std::endl;
+    return 0;
+}
+
+// Allocation comparison of one 60-result nearby query against the local mock: the restaurant_data path used by
+// generateRestaurantMaps against arena-backed ingest. Both run once to warm connections and the type interner.
+int run_arena_benchmark(int queries)
+{
+    MockPlacesOptions options;
+    options.latency_ms = 1;
+    options.jitter_ms = 0;
+    MockPlacesServer server;
+    server.options = options;
+    if (!server.start())
+    {
+        std::cerr << "Could not start the mock Places server" << std::endl;
+        return 1;
+    }
+    placesApiBase = server.base_url();
+    pageTokenMinDelayMs = 0;
+    pageTokenDelayMs = options.token_delay_ms;
+
+    std::ostringstream discarded;
+    std::streambuf *console = std::cout.rdbuf(discarded.rdbuf());
+    const std::string location = "43.6532,-79.3832";
+    size_t owned_results = 0;
+    size_t arena_results = 0;
+    uint64_t owned_allocations = 0;
+    uint64_t arena_allocations = 0;
+    IngestArena arena;
+    for (int q = -1; q < queries; q++)
+    {
+        uint64_t before = allocationCount.load();
+        std::vector<restaurant_data> restaurants = fetch_nearby_restaurants(location, 1000, 60, "mock-key");
+        uint64_t owned = allocationCount.load() - before;
+
+        arena.clear();
+        before = allocationCount.load();
+        fetch_nearby_into_arena(location, 1000, 60, "mock-key", arena);
+        uint64_t arena_owned = allocationCount.load() - before;
+
+        if (q >= 0)
+        {
+            owned_allocations += owned;
+            arena_allocations += arena_owned;
+            owned_results += restaurants.size();
+            arena_results += arena.restaurants.size();
+        }
+        for (size_t i = 0; i < restaurants.size() && i < arena.restaurants.size(); i++)
+        {
+            if (restaurants[i].place_id != arena.restaurants[i].place_id || restaurants[i].name != arena.restaurants[i].name)
+            {
+                std::cout.rdbuf(console);
+                std::cerr << "Arena ingest disagrees with restaurant_data ingest on result " << i << std::endl;
+                return 1;
+            }
+        }
+    }
+    std::cout.rdbuf(console);
+    server.stop();
+
+    int runs = std::max(1, queries);
+    std::cout << "nearby query against local mock, allocations per query (average of " << runs << ", includes HTTP)" << std::endl;
+    std::cout << "  restaurant_data: " << owned_allocations / runs << " for " << owned_results / runs << " results" << std::endl;
+    std::cout << "  arena:           " << arena_allocations / runs << " for " << arena_results / runs << " results" << std::endl;
+    return owned_results == arena_results ? 0 : 1;
+}
+
+// Time to first result of the coroutine stream against the blocking path (nearby pages, then the details engine)
+// for the same query on the local mock, plus what cancelling the stream after a few results saves
+int run_stream_benchmark(int queries, int latency_ms)
+{
+    MockPlacesOptions options;
+    options.latency_ms = latency_ms;
+    options.jitter_ms = 0;
+    MockPlacesServer server;
+    server.options = options;
+    if (!server.start())
+    {
+        std::cerr << "Could not start the mock Places server" << std::endl;
+        return 1;
+    }
+    placesApiBase = server.base_url();
+    pageTokenMinDelayMs = 0;
+    pageTokenDelayMs = options.token_delay_ms;
+    placeDetailsCache.enabled = false; // every run pays for its details
+
+    std::ostringstream discarded;
+    std::streambuf *console = std::cout.rdbuf(discarded.rdbuf());
+    std::vector<double> blocking_first, blocking_total, stream_first, stream_total;
+    size_t blocking_results = 0, stream_results = 0;
+    uint64_t full_requests = 0, cancelled_requests = 0;
+    const size_t kTakeBeforeCancel = 5;
+    FetchLoop loop;
+    for (int q = 0; q < queries; q++)
+    {
+        std::string location = std::to_string(43.60 + 0.01 * q) + ",-79.38"; // distinct queries, nothing coalesces
+        auto start = std::chrono::steady_clock::now();
+        std::vector<restaurant_data> restaurants = fetch_nearby_restaurants(location, 1000, 60, "mock-key");
+        fetch_place_details_concurrent(restaurants, "mock-key", maxDetailsInFlight);
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        blocking_first.push_back(elapsed); // nothing is visible before the call returns
+        blocking_total.push_back(elapsed);
+        blocking_results += restaurants.size();
+
+        location = std::to_string(43.60 + 0.01 * q) + ",-79.50";
+        uint64_t requests_before = server.requests.load();
+        start = std::chrono::steady_clock::now();
+        RestaurantStream stream = stream_restaurants(loop, location, 1000, 60, "mock-key", true, maxDetailsInFlight);
+        restaurant_data restaurant;
+        for (size_t n = 0; stream.next(restaurant); n++)
+        {
+            if (n == 0)
+            {
+                stream_first.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            stream_results++;
+        }
+        stream_total.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        full_requests += server.requests.load() - requests_before;
+
+        location = std::to_string(43.60 + 0.01 * q) + ",-79.60";
+        requests_before = server.requests.load();
+        RestaurantStream early = stream_restaurants(loop, location, 1000, 60, "mock-key", true, maxDetailsInFlight);
+        for (size_t n = 0; n < kTakeBeforeCancel && early.next(restaurant); n++)
+        {
+        }
+        early.cancel();
+        cancelled_requests += server.requests.load() - requests_before;
+    }
+
+    // Pages that break off mid-body have already handed out some results; their retries must not hand them out again
+    MockPlacesOptions cut_options = options;
+    cut_options.truncate_rate = 0.5;
+    MockPlacesServer cut_server;
+    cut_server.options = cut_options;
+    size_t cut_results = 0, repeated = 0;
+    if (cut_server.start())
+    {
+        placesApiBase = cut_server.base_url();
+        for (int q = 0; q < queries; q++)
+        {
+            RestaurantStream stream = stream_restaurants(loop, std::to_string(43.60 + 0.01 * q) + ",-79.70", 1000, 60, "mock-key", false);
+            std::unordered_set<std::string> seen;
+            restaurant_data restaurant;
+            while (stream.next(restaurant))
+            {
+                cut_results++;
+                repeated += !seen.insert(restaurant.place_id).second;
+            }
+        }
+        cut_server.stop();
+    }
+    std::cout.rdbuf(console);
+    server.stop();
+
+    for (std::vector<double> *sample : {&blocking_first, &blocking_total, &stream_first, &stream_total})
+    {
+        std::sort(sample->begin(), sample->end());
+    }
+    int runs = std::max(1, queries);
+    std::cout << "nearby + details against local mock (" << queries << " queries, latency " << latency_ms << " ms), median" << std::endl;
+    std::cout << "  blocking:  first result " << percentile(blocking_first, 0.5) << " ms, all " << blocking_results / runs << " after "
+              << percentile(blocking_total, 0.5) << " ms" << std::endl;
+    std::cout << "  stream:    first result " << percentile(stream_first, 0.5) << " ms, all " << stream_results / runs << " after "
+              << percentile(stream_total, 0.5) << " ms" << std::endl;
+    std::cout << "  cancelled after " << kTakeBeforeCancel << " results: " << cancelled_requests / runs << " requests instead of "
+              << full_requests / runs << std::endl;
+    std::cout << "  pages cut off mid-body: " << cut_server.truncated_responses.load() << " retried, " << cut_results / runs
+              << " results per query, " << repeated << " repeated place_ids" << std::endl;
+    return stream_results == blocking_results && repeated == 0 ? 0 : 1;
+}
+
+// Restart cost for count synthetic places: rebuilding the store from the cached JSON responses (nearbysearch pages and
+// one details body per place, through the streaming decoders) and re-indexing it, against mapping a snapshot of the
+// same store. Queries, postings and records read from the mapping are checked against the rebuilt store.
+int run_snapshot_benchmark(size_t count)
+{
+    RestaurantStore source;
+    fill_synthetic_store(source, count, 42);
+
+    // The responses a restart without a snapshot replays
+    std::vector<std::string> pages;
+    std::vector<std::string> details(count);
+    size_t json_bytes = 0;
+    auto hhmm = [](int minute)
+    {
+        char text[8];
+        std::snprintf(text, sizeof(text), "\"%02d%02d\"", minute % kMinutesPerDay / 60, minute % 60);
+        return std::string(text);
+    };
+    for (size_t first = 0; first < count; first += 20)
+    {
+        std::ostringstream json;
+        json << std::setprecision(9) << "{\"html_attributions\":[],\"results\":[";
+        for (size_t i = first; i < std::min(count, first + 20); i++)
+        {
+            const restaurant_data &restaurant = source[static_cast<uint32_t>(i)];
+            json << (i > first ? "," : "") << "{\"business_status\":\"" << (restaurant.is_operational ? "OPERATIONAL" : "CLOSED_PERMANENTLY")
+                 << "\",\"geometry\":{\"location\":{\"lat\":" << restaurant.location.lat << ",\"lng\":" << restaurant.location.lon
+                 << "}},\"name\":" << json_escape(restaurant.name) << ",\"opening_hours\":{\"open_now\":" << (restaurant.hours.open_now ? "true" : "false")
+                 << "},\"place_id\":" << json_escape(restaurant.place_id) << ",\"rating\":" << restaurant.rating << ",\"types\":[";
+            for (size_t t = 0; t < restaurant.types.size(); t++)
+            {
+                json << (t ? "," : "") << json_escape(restaurant.types[t]);
+            }
+            json << "],\"vicinity\":\"" << i << " Synthetic Street\"}";
+
+            std::ostringstream body;
+            body << "{\"html_attributions\":[],\"result\":{\"opening_hours\":{\"open_now\":" << (restaurant.hours.open_now ? "true" : "false") << ",\"periods\":[";
+            for (size_t p = 0; p < restaurant.hours.week.size(); p++)
+            {
+                const WeekInterval &interval = restaurant.hours.week[p];
+                body << (p ? "," : "") << "{";
+                if (interval.open != 0 || interval.close != kMinutesPerWeek) // around the clock has no close
+                    body << "\"close\":{\"day\":" << interval.close / kMinutesPerDay << ",\"time\":" << hhmm(interval.close) << "},";
+                body << "\"open\":{\"day\":" << interval.open / kMinutesPerDay << ",\"time\":" << hhmm(interval.open) << "}}";
+            }
+            body << "],\"weekday_text\":[";
+            for (size_t l = 0; l < restaurant.hours.weekday_text.size(); l++)
+            {
+                body << (l ? "," : "") << json_escape(restaurant.hours.weekday_text[l]);
+            }
+            body << "]},\"url\":\"https://maps.google.com/?cid=" << i << "\",\"website\":\"https://example.com/" << restaurant.place_id << "\"},\"status\":\"OK\"}";
+            details[i] = body.str();
+            json_bytes += details[i].size();
+        }
+        json << "],\"status\":\"OK\"}";
+        pages.push_back(json.str());
+        json_bytes += pages.back().size();
+    }
+
+    // Rebuild: decode every response, store the places, then the type/rating indices and the grid
+    std::ostringstream discarded;
+    std::streambuf *console = std::cout.rdbuf(discarded.rdbuf());
+    uint64_t allocations = allocationCount.load();
+    auto start = std::chrono::steady_clock::now();
+    RestaurantStore rebuilt;
+    RestaurantIndex index;
+    SpatialIndex grid;
+    size_t next_details = 0;
+    for (const std::string &page : pages)
+    {
+        NearbyPageDecoder decoder;
+        decoder.feed(page.data(), page.size());
+        decoder.finish();
+        for (restaurant_data &restaurant : decoder.page.restaurants)
+        {
+            const std::string &body = details[next_details++];
+            PlaceDetailsDecoder details_decoder(restaurant);
+            details_decoder.feed(body.data(), body.size());
+            details_decoder.finish();
+            rebuilt.add(std::move(restaurant));
+        }
+    }
+    index.watermark.begin(0, static_cast<uint32_t>(rebuilt.size()));
+    index.index_range(rebuilt, 0, static_cast<uint32_t>(rebuilt.size()));
+    grid.build(rebuilt);
+    double rebuild_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t rebuild_allocations = allocationCount.load() - allocations;
+    std::cout.rdbuf(console);
+
+    std::string path = (std::filesystem::temp_directory_path() / "rf_bench_snapshot").string();
+    start = std::chrono::steady_clock::now();
+    if (!save_store_snapshot(path, rebuilt, grid, std::vector<CoveredArea>()))
+    {
+        return 1;
+    }
+    double save_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Map and answer one query, many times over; the file is in the page cache after the first run
+    RestaurantFilter filter;
+    filter.min_rating = 4.0f;
+    LatLon center(43.6532f, -79.3832f);
+    const int kOpens = 21;
+    std::vector<double> open_ms, first_query_ms;
+    uint64_t open_allocations = 0;
+    size_t first_results = 0;
+    for (int run = 0; run < kOpens; run++)
+    {
+        MappedSnapshot mapped;
+        allocations = allocationCount.load();
+        start = std::chrono::steady_clock::now();
+        if (!mapped.open(path))
+        {
+            return 1;
+        }
+        auto opened = std::chrono::steady_clock::now();
+        open_allocations += allocationCount.load() - allocations;
+        first_results = mapped.spatial.within_radius(center, 1000.0, filter).size();
+        open_ms.push_back(std::chrono::duration<double, std::milli>(opened - start).count());
+        first_query_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(open_ms.begin(), open_ms.end());
+    std::sort(first_query_ms.begin(), first_query_ms.end());
+
+    // Once more with the file dropped from the page cache, as after a reboot
+    double cold_ms = -1.0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0 && fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0)
+    {
+        MappedSnapshot mapped;
+        start = std::chrono::steady_clock::now();
+        if (mapped.open(path))
+        {
+            mapped.spatial.within_radius(center, 1000.0, filter);
+            cold_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    // The mapping must answer exactly as the rebuilt store does
+    MappedSnapshot mapped;
+    if (!mapped.open(path))
+    {
+        return 1;
+    }
+    size_t mismatches = 0;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> lat(43.60f, 43.78f);
+    std::uniform_real_distribution<float> lon(-79.52f, -79.27f);
+    static const char *kQueryTypes[] = {"", "sushi_restaurant", "cafe", "bar", "restaurant"};
+    for (int q = 0; q < 200; q++)
+    {
+        RestaurantFilter random_filter;
+        random_filter.require_type(kQueryTypes[rng() % 5]);
+        random_filter.min_rating = static_cast<float>(rng() % 3) * 1.5f;
+        random_filter.open_at = rng() % 2 ? static_cast<int>(rng() % kMinutesPerWeek) : -1;
+        random_filter.operational_only = rng() % 2;
+        LatLon point(lat(rng), lon(rng));
+        double radius = 200.0 + rng() % 2800;
+        std::vector<uint32_t> expected = grid.within_radius(point, radius, random_filter);
+        std::vector<uint32_t> found = mapped.spatial.within_radius(point, radius, random_filter);
+        std::sort(expected.begin(), expected.end());
+        std::sort(found.begin(), found.end());
+        mismatches += expected != found;
+        mismatches += grid.nearest(point, 10, random_filter) != mapped.spatial.nearest(point, 10, random_filter);
+    }
+    std::vector<uint32_t> expected, found;
+    for (const char *type : kQueryTypes)
+    {
+        index.snapshot().of_type(type, expected);
+        mapped.of_type(type, found);
+        mismatches += expected != found;
+    }
+    for (const char *bucket : kRatingBuckets)
+    {
+        index.snapshot().in_rating_bucket(bucket, expected);
+        mapped.in_rating_bucket(bucket, found);
+        mismatches += expected != found;
+    }
+    for (uint32_t i = 0; i < rebuilt.size(); i += 97)
+    {
+        const restaurant_data &original = rebuilt[i];
+        restaurant_data copy = to_restaurant_data(mapped, i);
+        bool same_week = original.hours.week.size() == copy.hours.week.size();
+        for (size_t w = 0; same_week && w < copy.hours.week.size(); w++)
+        {
+            same_week = original.hours.week[w].open == copy.hours.week[w].open && original.hours.week[w].close == copy.hours.week[w].close;
+        }
+        mismatches += !same_week || original.place_id != copy.place_id || original.name != copy.name || original.address != copy.address ||
+                      original.url != copy.url || original.cuisine != copy.cuisine || original.current_status != copy.current_status ||
+                      original.rating != copy.rating || original.types != copy.types || original.is_operational != copy.is_operational ||
+                      original.hours.open_now != copy.hours.open_now || original.hours.periods != copy.hours.periods ||
+                      original.hours.weekday_text != copy.hours.weekday_text;
+    }
+
+    // What the daemon does in the background after mapping
+    RestaurantStore restored;
+    start = std::chrono::steady_clock::now();
+    restore_store(mapped, restored);
+    double restore_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t snapshot_bytes = mapped.file_bytes();
+    mapped.close();
+    std::filesystem::remove(path);
+
+    std::cout << "startup with " << count << " synthetic restaurants" << std::endl;
+    std::cout << "  rebuild from cached JSON: " << rebuild_ms << " ms (" << json_bytes / (1024 * 1024) << " MiB of responses, "
+              << rebuild_allocations << " allocations)" << std::endl;
+    std::cout << "  snapshot: " << snapshot_bytes << " bytes, written in " << save_ms << " ms" << std::endl;
+    std::cout << "  mmap snapshot: " << percentile(open_ms, 0.5) << " ms median, " << open_allocations / kOpens
+              << " allocations; first query (" << first_results << " results) answered " << percentile(first_query_ms, 0.5) << " ms after start" << std::endl;
+    if (cold_ms >= 0.0)
+    {
+        std::cout << "  mmap + first query with the file evicted from the page cache: " << cold_ms << " ms" << std::endl;
+    }
+    std::cout << "  restoring the live store from the mapping: " << restore_ms << " ms" << std::endl;
+    std::cout << "  speedup to first answer: " << rebuild_ms / percentile(first_query_ms, 0.5) << "x" << std::endl;
+    if (mismatches > 0)
+    {
+        std::cerr << mismatches << " queries, postings or records differ between the snapshot and the rebuilt store" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Top-k ranking over count synthetic places, all inside the query radius, against the obvious implementation (every
+// place scored with the double-precision haversine, then a full sort). The engine's top k must match it.
+int run_rank_benchmark(size_t count, size_t k)
+{
+    RestaurantStore store;
+    fill_synthetic_store(store, count, 42);
+    SpatialIndex grid;
+    grid.build(store);
+
+    const int kQueries = 200;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+    std::vector<RankQuery> queries(kQueries);
+    for (RankQuery &query : queries)
+    {
+        query.center = LatLon(43.69f + jitter(rng), -79.395f + jitter(rng));
+        query.radius_m = 15000.0; // reaches every corner of the synthetic area
+        query.k = k;
+        query.type = "sushi_restaurant";
+    }
+
+    rank_restaurants(store, grid, queries[0]); // sizes the scratch arrays
+    std::vector<double> rank_us;
+    uint64_t allocations = allocationCount.load();
+    size_t results = 0;
+    for (const RankQuery &query : queries)
+    {
+        auto start = std::chrono::steady_clock::now();
+        results += rank_restaurants(store, grid, query).size();
+        rank_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    uint64_t rank_allocations = allocationCount.load() - allocations;
+    std::sort(rank_us.begin(), rank_us.end());
+
+    // The scoring pass alone over every place
+    int type_id = placeTypes.find("sushi_restaurant");
+    std::vector<float> bonus(count), score(count), distance(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bonus[i] = (store.flags[i] & FLAG_OPEN_NOW ? 0.5f : 0.0f) + (store.types[i].test(type_id) ? 0.5f : 0.0f);
+    }
+    std::vector<double> kernel_us;
+    for (const RankQuery &query : queries)
+    {
+        auto start = std::chrono::steady_clock::now();
+        score_candidates(store.lat.data(), store.lon.data(), store.rating.data(), bonus.data(), count, query, score.data(), distance.data());
+        kernel_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(kernel_us.begin(), kernel_us.end());
+    double max_distance_error = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        double expected = distance_meters(queries.back().center.lat, queries.back().center.lon, store.lat[i], store.lon[i]);
+        max_distance_error = std::max(max_distance_error, std::abs(distance[i] - expected));
+    }
+
+    // Baseline and check, on the timed queries and on smaller filtered ones that take the gathering path
+    auto full_sort = [&](const RankQuery &query)
+    {
+        std::vector<std::pair<double, uint32_t>> scored;
+        int query_type = placeTypes.find(query.type);
+        for (uint32_t i = 0; i < store.size(); i++)
+        {
+            if (!matches_filter(store, i, query.filter))
+                continue;
+            double d = distance_meters(query.center.lat, query.center.lon, store.lat[i], store.lon[i]);
+            if (d > query.radius_m)
+                continue;
+            bool open = query.open_at >= 0 ? store.is_open_at(i, query.open_at) : (store.flags[i] & FLAG_OPEN_NOW) != 0;
+            double s = query.weights.rating * store.rating[i] / 5.0 + query.weights.distance * std::max(0.0, 1.0 - d / query.radius_m) +
+                       (open ? query.weights.open : 0.0) + (store.types[i].test(query_type) ? query.weights.type : 0.0);
+            scored.emplace_back(-s, i);
+        }
+        std::sort(scored.begin(), scored.end());
+        return scored;
+    };
+    std::vector<RankQuery> checks = queries;
+    std::uniform_real_distribution<float> lat(43.60f, 43.78f);
+    std::uniform_real_distribution<float> lon(-79.52f, -79.27f);
+    for (int q = 0; q < kQueries; q++)
+    {
+        RankQuery query;
+        query.center = LatLon(lat(rng), lon(rng));
+        query.radius_m = 300.0 + rng() % 3000;
+        query.k = k;
+        query.type = q % 2 ? "cafe" : "bar";
+        query.open_at = q % 3 ? static_cast<int>(rng() % kMinutesPerWeek) : -1;
+        query.weights.distance = 2.0f;
+        query.filter.min_rating = static_cast<float>(rng() % 3) * 1.5f;
+        query.filter.operational_only = rng() % 2;
+        checks.push_back(query);
+    }
+    std::vector<double> naive_us;
+    size_t mismatches = 0;
+    for (size_t q = 0; q < checks.size(); q++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::pair<double, uint32_t>> scored = full_sort(checks[q]);
+        if (q < queries.size())
+            naive_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+
+        std::vector<RankedRestaurant> best = rank_restaurants(store, grid, checks[q]);
+        mismatches += best.size() != std::min(k, scored.size());
+        for (size_t n = 0; n < best.size() && n < scored.size(); n++)
+        {
+            mismatches += std::abs(best[n].score + scored[n].first) > 1e-4;
+        }
+    }
+    std::sort(naive_us.begin(), naive_us.end());
+
+    std::cout << "top " << k << " of " << count << " synthetic restaurants, " << kQueries << " queries over all of them" << std::endl;
+    std::cout << "  rank_restaurants: " << percentile(rank_us, 0.5) << " us median, " << percentile(rank_us, 0.99) << " us p99, "
+              << static_cast<double>(rank_allocations) / kQueries << " allocations per query" << std::endl;
+    std::cout << "  scoring pass alone: " << percentile(kernel_us, 0.5) << " us median (" << percentile(kernel_us, 0.5) * 1000.0 / count
+              << " ns per candidate), max distance error " << max_distance_error << " m" << std::endl;
+    std::cout << "  score all in double + sort: " << percentile(naive_us, 0.5) << " us median (" << percentile(naive_us, 0.5) / percentile(rank_us, 0.5)
+              << "x slower)" << std::endl;
+    if (mismatches > 0 || results == 0)
+    {
+        std::cerr << mismatches << " of " << checks.size() << " rankings differ from the full sort" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Name and address search over count synthetic places with accented, multi-word names: index build and incremental
+// update cost, then keystroke-by-keystroke prefix queries, substring, filtered and misspelt queries against a linear
+// scan that folds and compares every record. Exact results must equal the scan's.
+int run_text_benchmark(size_t count)
+{
+    static const char *kAdjectives[] = {"Golden", "Royal", "Little", "Happy", "Old", "Blue", "Lucky", "Grand", "Sunny", "Silver", "Urban", "Cozy"};
+    static const char *kNouns[] = {"Dragon", "Lotus", "Garden", "Kitchen", "House", "Table", "Spoon", "Harbour", "Maple", "Lantern", "Tiger", "Orchard"};
+    static const char *kKinds[] = {"Sushi", "Pizzeria", "Café", "Crêperie", "Pâtisserie", "Bistro", "Taquería", "Ramen", "Phở", "Trattoria", "Bäckerei", "Grill"};
+    static const char *kPeople[] = {"José", "Zoë", "François", "Müller", "Nguyen", "O'Brien", "Søren", "Renée", "Łukasz", "Ángel", "Mario", "Kim"};
+    static const char *kStreets[] = {"Queen St W", "King St E", "Dundas St W", "Bloor St W", "Yonge St", "Spadina Ave", "College St", "St. Clair Ave W",
+                                     "Danforth Ave", "Ossington Ave", "Rue de l'Église", "Côte-des-Neiges Rd"};
+    RestaurantStore store;
+    fill_synthetic_store(store, count, 42);
+    std::mt19937 rng(5);
+    auto pick = [&](const char *const *list) { return std::string(list[rng() % 12]); };
+    auto make_name = [&]()
+    {
+        switch (rng() % 3)
+        {
+        case 0:
+            return pick(kAdjectives) + " " + pick(kNouns) + " " + pick(kKinds);
+        case 1:
+            return pick(kPeople) + "'s " + pick(kKinds);
+        default:
+            return pick(kKinds) + " " + pick(kNouns) + " " + std::to_string(rng() % 100);
+        }
+    };
+    for (restaurant_data &restaurant : store.records)
+    {
+        restaurant.name = make_name();
+        restaurant.address = std::to_string(1 + rng() % 3000) + " " + pick(kStreets) + ", Toronto";
+    }
+
+    // Build over 90%, then add the rest and rename 1000 places incrementally
+    RestaurantTextIndex index;
+    uint32_t bulk = static_cast<uint32_t>(count - count / 10);
+    auto start = std::chrono::steady_clock::now();
+    index.index_range(store, 0, bulk);
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    index.index_range(store, bulk, static_cast<uint32_t>(count));
+    double add_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::vector<uint32_t> renamed;
+    for (int r = 0; r < 1000; r++)
+    {
+        uint32_t i = static_cast<uint32_t>(rng() % count);
+        store.records[i].name = make_name();
+        renamed.push_back(i);
+    }
+    start = std::chrono::steady_clock::now();
+    index.update(store, renamed);
+    double update_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // The linear scan the index replaces: fold every record, match every word, rank the same way
+    auto scan = [&](const TextQuery &query, bool prefolded, const std::vector<std::string> &folded)
+    {
+        std::string text, name, address;
+        fold_text(query.text, text);
+        std::vector<std::string_view> words;
+        for (size_t at = 0; at < text.size();)
+        {
+            size_t end = std::min(text.find(' ', at), text.size());
+            words.push_back(std::string_view(text).substr(at, end - at));
+            at = end + 1;
+        }
+        std::vector<TextHit> hits;
+        for (uint32_t i = 0; i < store.size(); i++)
+        {
+            if (!prefolded)
+            {
+                fold_text(store[i].name, name);
+                fold_text(store[i].address, address);
+            }
+            std::string_view fields = prefolded ? std::string_view(folded[i]) : std::string_view();
+            std::string_view name_field = prefolded ? fields.substr(0, fields.find('\n')) : std::string_view(name);
+            std::string_view address_field = prefolded ? fields.substr(fields.find('\n') + 1) : std::string_view(address);
+            int worst = MATCH_PREFIX, worst_name = MATCH_PREFIX;
+            for (std::string_view word : words)
+            {
+                int in_name = match_in_field(name_field, word, query.typos);
+                worst = std::max(worst, std::min(in_name, match_in_field(address_field, word, query.typos)));
+                worst_name = std::max(worst_name, in_name);
+            }
+            if (worst >= kMatchKinds || !matches_filter(store, i, query.filter) ||
+                (query.radius_m > 0.0 && distance_meters(query.center.lat, query.center.lon, store.lat[i], store.lon[i]) > query.radius_m))
+                continue;
+            hits.push_back(TextHit{i, static_cast<uint8_t>(worst), worst_name <= worst});
+        }
+        size_t take = std::min(hits.size(), query.limit);
+        std::partial_sort(hits.begin(), hits.begin() + take, hits.end(), [&](const TextHit &a, const TextHit &b)
+                          { return a.match != b.match ? a.match < b.match : a.in_name != b.in_name ? a.in_name
+                                   : store.rating[a.index] != store.rating[b.index] ? store.rating[a.index] > store.rating[b.index]
+                                   : a.index < b.index; });
+        hits.resize(take);
+        return hits;
+    };
+    std::vector<std::string> folded(store.size());
+    for (uint32_t i = 0; i < store.size(); i++)
+    {
+        std::string name, address;
+        fold_text(store[i].name, name);
+        fold_text(store[i].address, address);
+        folded[i] = name + '\n' + address;
+    }
+
+    // Queries: each of 100 names typed a character at a time, substrings, filtered and nearby ones, then misspellings
+    std::vector<TextQuery> keystrokes, exact, misspelt;
+    std::vector<std::string> intended; // the word each misspelt query should find
+    for (int n = 0; n < 100; n++)
+    {
+        const std::string &name = store[static_cast<uint32_t>(rng() % count)].name;
+        for (size_t length = 1; length <= std::min<size_t>(name.size(), 14); length++)
+        {
+            TextQuery query;
+            query.text = name.substr(0, length);
+            keystrokes.push_back(query);
+        }
+    }
+    static const char *kSubstrings[] = {"izzer", "ager", "arbo", "rep", "ntern", "uller", "eglise", "neige", "ossing", "amen"};
+    for (int n = 0; n < 100; n++)
+    {
+        TextQuery query;
+        query.text = kSubstrings[n % 10];
+        if (n % 4 == 1)
+            query.text += std::string(" ") + kStreets[rng() % 12];
+        if (n % 3 == 0)
+            query.filter.require_type("cafe");
+        if (n % 2 == 0)
+        {
+            query.center = LatLon(43.60f + static_cast<float>(rng() % 180) / 1000.0f, -79.52f + static_cast<float>(rng() % 250) / 1000.0f);
+            query.radius_m = 1000.0 + rng() % 3000;
+        }
+        query.typos = false;
+        exact.push_back(query);
+    }
+    for (int n = 0; n < 100; n++)
+    {
+        std::string word = pick(n % 2 ? kNouns : kAdjectives);
+        std::string folded_word;
+        fold_text(word, folded_word);
+        std::string typo = folded_word;
+        size_t at = 1 + rng() % (typo.size() - 2);
+        switch (n % 3)
+        {
+        case 0:
+            typo[at] = static_cast<char>('a' + rng() % 26);
+            break;
+        case 1:
+            std::swap(typo[at], typo[at + 1]);
+            break;
+        default:
+            typo.erase(at, 1);
+        }
+        TextQuery query;
+        query.text = typo;
+        misspelt.push_back(query);
+        intended.push_back(folded_word);
+    }
+
+    auto time_queries = [&](const std::vector<TextQuery> &queries, std::vector<double> &us)
+    {
+        std::vector<TextHit> hits;
+        for (const TextQuery &query : queries)
+        {
+            auto query_start = std::chrono::steady_clock::now();
+            index.search(store, query, hits);
+            us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - query_start).count());
+        }
+        std::sort(us.begin(), us.end());
+    };
+    std::vector<double> keystroke_us, exact_us, misspelt_us, scan_ms;
+    time_queries(keystrokes, keystroke_us);
+    time_queries(exact, exact_us);
+    time_queries(misspelt, misspelt_us);
+    for (size_t q = 0; q < 10; q++)
+    {
+        auto scan_start = std::chrono::steady_clock::now();
+        scan(keystrokes[q * 7], false, folded);
+        scan_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - scan_start).count());
+    }
+    std::sort(scan_ms.begin(), scan_ms.end());
+
+    size_t mismatches = 0;
+    std::vector<TextHit> hits;
+    auto same = [](const std::vector<TextHit> &a, const std::vector<TextHit> &b)
+    {
+        bool equal = a.size() == b.size();
+        for (size_t n = 0; equal && n < a.size(); n++)
+        {
+            equal = a[n].index == b[n].index && a[n].match == b[n].match && a[n].in_name == b[n].in_name;
+        }
+        return equal;
+    };
+    for (const std::vector<TextQuery> *queries : {&keystrokes, &exact})
+    {
+        for (TextQuery query : *queries)
+        {
+            query.typos = false;
+            index.search(store, query, hits);
+            mismatches += !same(hits, scan(query, true, folded));
+        }
+    }
+    size_t found = 0;
+    for (size_t q = 0; q < misspelt.size(); q++)
+    {
+        index.search(store, misspelt[q], hits);
+        std::string name;
+        if (!hits.empty())
+            fold_text(store[hits[0].index].name, name);
+        found += !hits.empty() && match_in_field(name, intended[q], false) == MATCH_PREFIX;
+    }
+
+    std::cout << "text search over " << count << " synthetic restaurants (" << index.terms() << " distinct words)" << std::endl;
+    std::cout << "  index " << bulk << " places: " << build_ms << " ms; add " << count - bulk << " more: " << add_ms
+              << " ms; rename 1000: " << update_ms << " ms" << std::endl;
+    std::cout << "  keystroke prefix queries (" << keystrokes.size() << "): " << percentile(keystroke_us, 0.5) << " us median, "
+              << percentile(keystroke_us, 0.99) << " us p99, " << keystroke_us.back() << " us max" << std::endl;
+    std::cout << "  substring, filtered and nearby queries (" << exact.size() << "): " << percentile(exact_us, 0.5) << " us median, "
+              << percentile(exact_us, 0.99) << " us p99" << std::endl;
+    std::cout << "  misspelt words (" << misspelt.size() << "): " << percentile(misspelt_us, 0.5) << " us median, "
+              << percentile(misspelt_us, 0.99) << " us p99, intended word ranked first for " << found << std::endl;
+    std::cout << "  linear scan with folding: " << percentile(scan_ms, 0.5) << " ms median (" << percentile(scan_ms, 0.5) * 1000.0 / percentile(keystroke_us, 0.5)
+              << "x the median keystroke)" << std::endl;
+    if (mismatches > 0)
+    {
+        std::cerr << mismatches << " queries differ from the linear scan" << std::endl;
+        return 1;
     }
+    return 0;
 }
+#endif
 
-int main()
+int main(int argc, char **argv)
 {
+    // Benchmark modes: --bench-json <nearby.json> [details.json] [iterations]
+    //                  --bench-spatial [count]
+    //                  --bench-hours [count]
+    //                  --bench-ingest [count] [max_threads]
+    //                  --bench-e2e [lookups] [concurrency] [latency_ms] [jitter_ms] [error_rate]
+    //                  --bench-arena [queries]
+    //                  --bench-stream [queries] [latency_ms]
+    //                  --bench-snapshot [count]
+    //                  --bench-rank [count] [k]
+    //                  --bench-text [count]
+    //                  --bench-hedge [lookups] [slow_rate] [slow_ms] [error_rate]
+    // Stream mode:     --stream <lat> <lon> <radius_m> [limit] [details=1]
+    // Batch mode:      --batch <input_file> <output.ndjson> [workers] [website,hours,open_now,operational]
+    // Daemon modes:    --serve <socket_path> [threads] [refresh_calls_per_minute]
+    //                  --ask <socket_path> <request...>
+    //                  --mock-places [port]   (set PLACES_API_BASE to the printed url to use it)
+    if (argc >= 2 && std::string(argv[1]).rfind("--bench-", 0) == 0 && !kCountingAllocations)
+    {
+        std::cerr << "Allocation counts read 0 in this build; compile with -DCOUNT_ALLOCATIONS to measure them" << std::endl;
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--bench-json")
+    {
+        return run_json_benchmark(argv[2], argc >= 4 ? argv[3] : "", argc >= 5 ? std::atoi(argv[4]) : 2000);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-spatial")
+    {
+        return run_spatial_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 100000);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-hours")
+    {
+        return run_hours_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 10000);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-ingest")
+    {
+        return run_ingest_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 200000,
+                                    argc >= 4 ? std::atoi(argv[3]) : static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+    }
+#ifndef _WIN32
+    if (argc >= 2 && std::string(argv[1]) == "--bench-e2e")
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        MockPlacesOptions options;
+        options.latency_ms = argc >= 5 ? std::atoi(argv[4]) : options.latency_ms;
+        options.jitter_ms = argc >= 6 ? std::atoi(argv[5]) : options.jitter_ms;
+        options.error_rate = argc >= 7 ? std::atof(argv[6]) : options.error_rate;
+        return run_e2e_benchmark(argc >= 3 ? std::atoi(argv[2]) : 20, argc >= 4 ? std::atoi(argv[3]) : 4, options);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-hedge")
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        return run_hedge_benchmark(argc >= 3 ? std::atoi(argv[2]) : 100, argc >= 4 ? std::atof(argv[3]) : 0.03, argc >= 5 ? std::atoi(argv[4]) : 1000,
+                                   argc >= 6 ? std::atof(argv[5]) : 0.0);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-arena")
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        return run_arena_benchmark(argc >= 3 ? std::atoi(argv[2]) : 5);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-stream")
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        return run_stream_benchmark(argc >= 3 ? std::atoi(argv[2]) : 5, argc >= 4 ? std::atoi(argv[3]) : 20);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-snapshot")
+    {
+        return run_snapshot_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 300000);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-rank")
+    {
+        return run_rank_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 100000, argc >= 4 ? std::strtoul(argv[3], nullptr, 10) : 10);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-text")
+    {
+        return run_text_benchmark(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 200000);
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--ask")
+    {
+        std::string request = argv[3];
+        for (int a = 4; a < argc; a++)
+        {
+            request += std::string(" ") + argv[a];
+        }
+        return ask_daemon(argv[2], request);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--mock-places")
+    {
+        install_stop_handlers();
+        MockPlacesServer server;
+        if (!server.start(argc >= 3 ? std::atoi(argv[2]) : 0))
+        {
+            std::cerr << "Could not start the mock Places server" << std::endl;
+            return 1;
+        }
+        std::cout << server.base_url() << std::endl;
+        while (!stopRequested)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        return 0;
+    }
+#endif
+
+    curl_global_init(CURL_GLOBAL_DEFAULT); // must run before any handles are created or threads are started
+    if (const char *base = std::getenv("PLACES_API_BASE"))
+    {
+        placesApiBase = base; // e.g. a --mock-places instance
+    }
+    if (const char *path = std::getenv("PLACES_METRICS_FILE"))
+    {
+        metricsPath = path; // e.g. a node_exporter textfile collector directory
+    }
+    if (const char *budget = std::getenv("PLACES_DEADLINE_MS"))
+    {
+        requestPolicy.lookup_budget_ms = std::strtoll(budget, nullptr, 10); // 0 lets a lookup take as long as it needs
+    }
+    if (const char *hedge = std::getenv("PLACES_HEDGE_PERCENTILE"))
+    {
+        requestPolicy.hedge_percentile = std::atof(hedge); // 0 turns hedging off
+    }
+
+    std::string apiKey = getAPIKey(".env"); // Read from .env file
+    placeDetailsCache.load(detailsCachePath);
+
+    // Stream mode: --stream <lat> <lon> <radius_m> [limit] [details]; prints each restaurant the moment it is parsed
+    if (argc >= 5 && std::string(argv[1]) == "--stream")
+    {
+        if (apiKey.empty())
+        {
+            std::cerr << "API_KEY missing from .env" << std::endl;
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        DeadlineScope scope(Deadline::after_ms(requestPolicy.lookup_budget_ms, start));
+        FetchLoop loop;
+        RestaurantStream stream = stream_restaurants(loop, std::string(argv[2]) + "," + argv[3], std::atoi(argv[4]),
+                                                     argc >= 6 ? std::atoi(argv[5]) : 60, apiKey, argc < 7 || std::atoi(argv[6]) != 0);
+        restaurant_data restaurant;
+        while (stream.next(restaurant))
+        {
+            std::cout << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                      << " ms  " << std::defaultfloat << restaurant.name << " (" << restaurant.rating << ") " << restaurant.current_status << std::endl;
+        }
+        placeDetailsCache.save(detailsCachePath);
+        return 0;
+    }
+
+    // Sweep mode: --sweep <lat> <lon> <radius_m> [workers]; covers a whole district past the 60-result cap
+    if (argc >= 5 && std::string(argv[1]) == "--sweep")
+    {
+        if (apiKey.empty())
+        {
+            std::cerr << "API_KEY missing from .env" << std::endl;
+            return 1;
+        }
+        SweepStats stats;
+        std::vector<restaurant_data> restaurants = sweep_area(std::atof(argv[2]), std::atof(argv[3]), std::atof(argv[4]), apiKey,
+                                                              argc >= 6 ? std::atoi(argv[5]) : 4, 100.0, stats);
+        load_restaurants(restaurants, apiKey);
+        return 0;
+    }
+
+    // Batch mode: --batch <input_file> <output.ndjson> [workers] [needs]; SIGINT/SIGTERM stop it at the next row boundary.
+    // needs lists the fields the output must have (website,hours,open_now,operational; default all) so the planner can
+    // narrow or skip the details calls
+    if (argc >= 4 && std::string(argv[1]) == "--batch")
+    {
+        if (apiKey.empty())
+        {
+            std::cerr << "API_KEY missing from .env" << std::endl;
+            return 1;
+        }
+        QueryNeeds needs;
+        if (argc >= 6 && !parse_query_needs(argv[5], needs))
+        {
+            return 1;
+        }
+        install_stop_handlers();
+        return run_batch(argv[2], argv[3], argc >= 5 ? std::atoi(argv[4]) : 4, apiKey, needs) == 0 ? 0 : 1;
+    }
+
+#ifndef _WIN32
+    // Daemon mode: --serve <socket_path> [threads] [refresh_calls_per_minute]; runs until SIGINT/SIGTERM, then saves the details
+    // cache and the store snapshot the next start maps
+    if (argc >= 3 && std::string(argv[1]) == "--serve")
+    {
+        if (apiKey.empty())
+        {
+            std::cerr << "API_KEY missing from .env" << std::endl;
+            return 1;
+        }
+        install_stop_handlers();
+        QueryDaemon daemon;
+        daemon.api_key = apiKey;
+        daemon.snapshot_path = snapshotPath;
+        if (argc >= 5)
+        {
+            daemon.refresher.policy.calls_per_minute = std::atof(argv[4]); // 0 turns the background refresher off
+        }
+        bool served = daemon.serve(argv[2], argc >= 4 ? std::atoi(argv[3]) : 8);
+        finish_load();
+        return served ? 0 : 1;
+    }
+#endif
+
     std::string lat;
     std::string lon;
     std::cout << "Enter the latitude: " << std::endl;
@@ -659,7 +10233,6 @@ int main()
     std::cout << "Enter the longitude: " << std::endl;
     std::cin >> lon;
 
-    std::string apiKey = getAPIKey(".env"); // Read from .env file
     if (!apiKey.empty())
     {
         // Location coordinates (example: New York City)
@@ -668,4 +10241,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}